@@ -0,0 +1,186 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+/*
+ * Micro-benchmark of the kernels of the occurrence functions (see occ.c): each kernel supported by the CPU
+ * solves the same random queries of bwt_occ, bwt_2occ and bwt_2occ4, and its results are compared with the
+ * ones of the scalar kernel. The queries are made both on a small part of the BWT, that is inside the CPU cache
+ * (so the time is the time of the kernel), and on the whole BWT. All kernels are run first with the blocks of
+ * OCC_INTERVAL bases of the .bwt file and then with each size of the lines of the cache-line layout (see bwt_occ_align).
+ *
+ * Usage: occ_bench <prefix of the index> [number of queries]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "../src/fmdindex_load.h"
+#include "../src/occ.h"
+
+//Blocks of the BWT used by the queries inside the CPU cache (32 KB)
+#define HOT_BLOCKS 512
+
+typedef struct
+{
+	uint64_t k, l;
+	ubyte_t c;
+} query_t;
+
+static double now_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//Random queries on the first n_pos positions of the BWT, l - k is at most OCC_INTERVAL (as for the long patterns)
+static void gen_queries(query_t* q, int n, uint64_t n_pos)
+{
+	for (int i = 0; i < n; i++)
+	{
+		uint64_t r = (uint64_t) rand() << 31 | rand();
+		q[i].k = r % n_pos;
+		q[i].l = q[i].k + rand() % OCC_INTERVAL;
+		if (q[i].l >= n_pos)
+			q[i].l = n_pos - 1;
+		q[i].c = rand() & 3;
+	}
+}
+
+//Run each function on all queries, the times (ns for each query) are stored inside ns, the checksums inside sum
+static void run(const bwt_t* bwt, const query_t* q, int n, double ns[3], uint64_t sum[3])
+{
+	uint64_t cntk[4], cntl[4], ok, ol;
+	double t;
+
+	memset(sum, 0, 3 * sizeof(uint64_t));
+
+	t = now_seconds();
+	for (int i = 0; i < n; i++)
+		sum[0] += bwt_occ(bwt, q[i].k, q[i].c);
+	ns[0] = (now_seconds() - t) * 1e9 / n;
+
+	t = now_seconds();
+	for (int i = 0; i < n; i++)
+	{
+		bwt_2occ(bwt, q[i].k, q[i].l, q[i].c, &ok, &ol);
+		sum[1] += ok * 3 + ol;
+	}
+	ns[1] = (now_seconds() - t) * 1e9 / n;
+
+	t = now_seconds();
+	for (int i = 0; i < n; i++)
+	{
+		bwt_2occ4(bwt, q[i].k, q[i].l, cntk, cntl);
+		for (int c = 0; c < 4; c++)
+			sum[2] += (cntk[c] * 3 + cntl[c]) << c;
+	}
+	ns[2] = (now_seconds() - t) * 1e9 / n;
+}
+
+int main(int argc, char *argv[])
+{
+	const char* kernels[] = { "scalar", "popcnt", "avx2", "avx512" };
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: occ_bench <prefix of the index> [number of queries]\n");
+		return 1;
+	}
+	int n = argc > 2 ? atoi(argv[2]) : 10000000;
+	if (n <= 0)
+	{
+		fprintf(stderr, "The number of queries must be positive.\n");
+		return 1;
+	}
+
+	char* fn = (char*) malloc(strlen(argv[1]) + 5);
+	strcat(strcpy(fn, argv[1]), ".bwt");
+	bwt_t* bwt = bwt_restore_bwt(fn);
+
+	//The positions of the BWT are 0..seq_len, without the primary
+	uint64_t n_hot = bwt->seq_len < HOT_BLOCKS * OCC_INTERVAL ? bwt->seq_len : HOT_BLOCKS * OCC_INTERVAL;
+	query_t* hot = (query_t*) malloc(n * sizeof(query_t));
+	query_t* all = (query_t*) malloc(n * sizeof(query_t));
+	srand(11);
+	gen_queries(hot, n, n_hot);
+	gen_queries(all, n, bwt->seq_len);
+
+	printf("Kernel selected at load time: %s\n", occ_kernel_name());
+	printf("%" PRIu64 " bases, %d queries (ns per query)\n\n", bwt->seq_len, n);
+	printf("%-8s %10s %10s %10s | %10s %10s %10s\n", "", "occ", "2occ", "2occ4", "occ", "2occ", "2occ4");
+	printf("%-8s %32s | %32s\n", "kernel", "inside the CPU cache", "whole BWT");
+
+	uint64_t ref_hot[3], ref_all[3];
+	int ret = 0;
+	for (int j = 0; j < sizeof(kernels) / sizeof(kernels[0]) * (OCC_LINE_TYPES + 1); j++)
+	{
+		int i = j % (sizeof(kernels) / sizeof(kernels[0]));
+		double ns_hot[3], ns_all[3];
+		uint64_t sum_hot[3], sum_all[3];
+
+		//Each size of the lines needs the blocks of the .bwt file
+		if (i == 0 && j > 0)
+		{
+			int t = j / (sizeof(kernels) / sizeof(kernels[0])) - 1;
+			bwt_destroy(bwt);
+			bwt = bwt_restore_bwt(fn);
+			if (bwt_occ_align(bwt, occ_line_bases(t)) != 0)
+				break;
+			printf("cache-line layout, %d bases for each line of %d bytes (%.1f MB)\n", occ_line_bases(t), occ_line_words(t) * 4,
+					(double) ((bwt->seq_len / occ_line_bases(t) + 1) * occ_line_words(t) * 4) / (1 << 20));
+		}
+		if (occ_set_kernel(kernels[i]) != 0)
+		{
+			printf("%-8s not supported by the CPU\n", kernels[i]);
+			continue;
+		}
+		bwt_occ_resolve(bwt);
+		run(bwt, hot, n, ns_hot, sum_hot);
+		run(bwt, all, n, ns_all, sum_all);
+		printf("%-8s %10.2f %10.2f %10.2f | %10.2f %10.2f %10.2f", kernels[i], ns_hot[0], ns_hot[1], ns_hot[2], ns_all[0], ns_all[1], ns_all[2]);
+
+		//The results of each kernel with both layouts must be the same of the scalar one with the original layout
+		if (j == 0)
+		{
+			memcpy(ref_hot, sum_hot, sizeof(ref_hot));
+			memcpy(ref_all, sum_all, sizeof(ref_all));
+			printf("\n");
+		}
+		else if (memcmp(ref_hot, sum_hot, sizeof(ref_hot)) || memcmp(ref_all, sum_all, sizeof(ref_all)))
+		{
+			printf("  WRONG RESULTS\n");
+			ret = 1;
+		}
+		else
+			printf("\n");
+	}
+
+	free(fn);
+	free(hot);
+	free(all);
+	bwt_destroy(bwt);
+	return ret;
+}
@@ -67,10 +67,14 @@ static void bns_destroy(bntseq_t *bns);
  */
 uint64_t bwa_sa2pos(const bntseq_t *bns, const bwt_t *bwt, uint64_t sapos, int ref_len, bool *strand)
 {
-	uint64_t pos_f;
+	return bns_sa2pos(bns, bwt_sa(bwt, sapos), ref_len, strand); // position on the forward-reverse coordinate
+}
+
+//Same of bwa_sa2pos, pos_f = SA(sapos) is already known (see bwt_sa_batch)
+uint64_t bns_sa2pos(const bntseq_t *bns, uint64_t pos_f, int ref_len, bool *strand)
+{
 	bool is_rev;
 	*strand = 0; // initialise strand to 0 otherwise we could return without setting it
-	pos_f = bwt_sa(bwt, sapos); // position on the forward-reverse coordinate
 	if (pos_f < bns->l_pac && bns->l_pac < pos_f + ref_len)
 		return (uint64_t) -1;
 	pos_f = bns_depos(bns, pos_f, &is_rev); // position on the forward strand; this may be the first base or the last base
@@ -80,11 +84,14 @@ uint64_t bwa_sa2pos(const bntseq_t *bns, const bwt_t *bwt, uint64_t sapos, int r
 	return pos_f + 1; // FIXME: it is possible that pos_f < bns->anns[ref_id].offset
 }
 
-uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, int64_t *len)
+/*
+ * Same of bns_get_seq, but the sequence is stored inside seq (it must have at least end - beg elements).
+ * Return the length of the sequence.
+ */
+int64_t bns_get_seq_core(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, uint8_t *seq)
 {
 	beg--;//base 0
 	end--;
-	uint8_t *seq = 0;
 	if (end < beg)
 		end ^= beg, beg ^= end, end ^= beg; // if end is smaller, swap
 	if (end > l_pac << 1)
@@ -95,8 +102,6 @@ uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end
 	if (beg >= l_pac || end <= l_pac)
 	{
 		int64_t k, l = 0;
-		*len = end - beg;
-		seq = malloc(end - beg);
 		if (beg >= l_pac)
 		{ // reverse strand
 			int64_t beg_f = (l_pac << 1) - 1 - end;
@@ -109,9 +114,21 @@ uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end
 			for (k = beg; k < end; ++k)
 				seq[l++] = _get_pac(pac, k);
 		}
+		return end - beg;
+	}
+	return 0; // if bridging the forward-reverse boundary, return nothing
+}
+
+uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, int64_t *len)
+{
+	int64_t l = (end > beg ? end - beg : beg - end) + 1;
+	uint8_t *seq = malloc(l);
+	*len = bns_get_seq_core(l_pac, pac, beg, end, seq);
+	if (*len == 0)
+	{
+		free(seq);
+		seq = 0;
 	}
-	else
-		*len = 0; // if bridging the forward-reverse boundary, return nothing
 	return seq;
 }
 
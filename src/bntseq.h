@@ -84,8 +84,10 @@ extern "C" {
 #endif
 
 	uint64_t bwa_sa2pos(const bntseq_t *bns, const bwt_t *bwt, uint64_t sapos, int ref_len, bool *strand);
+	uint64_t bns_sa2pos(const bntseq_t *bns, uint64_t pos_f, int ref_len, bool *strand);
 	int64_t bns_fasta2bntseq(gzFile fp_fa, const char *prefix, int for_only);
 	uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, int64_t *len);
+	int64_t bns_get_seq_core(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, uint8_t *seq);
 
 #ifdef __cplusplus
 }
@@ -24,307 +24,870 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <time.h>
 #include "bounded_backtracking_seach.h"
 #include "sa.h"
 #include "occ.h"
+#include "kmer_index.h"
 #include "bntseq.h"
 
-//Only for debug: 0 no output,3 output
+/*
+ * Only for debug: 0 no output,3 output.
+ * It's only read by the search, so it must be set before starting the searches (also the concurrent ones).
+ */
 int verbose_bound_backtracking_search = 0;
 
-static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t *width);
-
-static stack_t * init_stack(int nmismatch);
-static void reset_stack(stack_t *stack);
+static void reset_stack(stack_t *stack, int nmismatch);
 static void destroy_stack(stack_t *stack);
 
 static inline void pop(stack_t *stack, entry_t *e);
 
-static inline void push(stack_t *stack, int i, uint64_t k, uint64_t l, int n_mm, int is_diff);
+static inline void push(stack_t *stack, int i, uint64_t k, uint64_t l, int n_mm, int last_diff_pos, uint32_t key);
 static inline void shadow(int x, int len, uint64_t max, int last_diff_pos, bwt_width_t *w);
 
-static int bwt_match_exact_alt(const bwt_t *bwt, int len, const ubyte_t *str, uint64_t *k0, uint64_t *l0);
-static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, const uint64_t k, const uint64_t l, input_query* info_seq, uint64_t* numer_forward,
-											uint64_t* numer_rc);
+static void get_pos_from_sa_interval(const bwaidx_t* idx, const uint64_t k, const uint64_t l, lib_aln_search_ctx_t* ctx, uint64_t* numer_forward,
+										uint64_t* numer_rc);
 
-static void get_string_to_pos(const bwaidx_t *idx, input_query* info_seq, search_result* sr);
-static void add_entry_to_result(const bwaidx_t* idx, search_result** rs, uint8_t n_mm, uint64_t n_f, uint64_t n_revC, uint64_t* pos,
-								input_query* info_seq, int* aln_n);
+static void get_string_to_pos(const bwaidx_t *idx, lib_aln_search_ctx_t* ctx, lib_aln_hit_t* h);
+static void add_hit(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint8_t n_mm, const uint64_t* pos, uint64_t n_pos, bool is_rev_comp);
+static void add_entry_to_result(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint8_t n_mm, uint64_t n_f, uint64_t n_revC);
+static uint64_t count_occurrences(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l);
+static void find_bridging_occurrences(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
 
 static int comp(const void * elem1, const void * elem2);
+static void bound_backtracking(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+static void backtracking_start(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+static bool backtracking_step(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, bool prefetch);
+static void reset_results(lib_aln_search_ctx_t* ctx);
+static void discard_hits(lib_aln_search_ctx_t* ctx, int n_mm);
+static bool interval_has_occurrences(const bwaidx_t* idx, const lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l);
+static inline void get_extensions(const bwt_t* bwt, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l, uint64_t ext_k[4], uint64_t ext_l[4]);
+static void clear_cache(lib_aln_search_ctx_t* ctx);
+static inline double now_seconds(void);
 
 //Only for debug
 static void print_pattern_to_search(const ubyte_t * seq, int len);
 static void print_character(int i);
 
-//Modified version of bwt_match_gap in bwtgap.c file
-search_result** get_approximate_match(const bwaidx_t* idx, input_query* info_seq, uint32_t* num_hits)
+/*
+ * Solve the query stored inside ctx (see search_ctx_prepare) with the engine selected by the type of search:
+ * the bounded backtracking or the search schemes.
+ */
+uint32_t get_approximate_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
 {
 	//Warning: Hit means an admissible match (with respect to the input parameters) between the pattern and the reference
 
 	if (verbose_bound_backtracking_search > 2)
 		fprintf(stderr,"Start get_approximate_match\n");
 
+	//Query to solve, see search_ctx_prepare
+	input_query* info_seq = &ctx->seq;
+
+	reset_results(ctx);
+	find_bridging_occurrences(idx, ctx);
+
+	//The search schemes and the seeds need at least one base for each part of the pattern
+	if (info_seq->search_scheme && info_seq->len > info_seq->max_diff)
+		search_scheme_match(idx, ctx);
+	else if (info_seq->seed_verify && info_seq->len > info_seq->max_diff)
+		seed_verify_match(idx, ctx);
+	else
+		bound_backtracking(idx, ctx);
+
+	if (verbose_bound_backtracking_search > 2)
+	{
+		fprintf(stderr, "\nNumber of hit found: %" PRIu32 "\n", ctx->n_hits_found);
+		fprintf(stderr, "End get_approximate_match\n");
+	}
+
+	return ctx->n_hits_found;
+}
+
+/*
+ * Same of get_approximate_match for the queries of n contexts. The backtracking of the queries is advanced
+ * in round-robin, one partial hit at a time: the occurrences needed by the next step of a query are prefetched
+ * while the other queries are advanced, so the accesses to the BWT of the different queries overlap.
+ * The queries solved by the other engines are solved one at a time.
+ */
+void get_approximate_match_interleaved(const bwaidx_t* idx, lib_aln_search_ctx_t** ctx, int n)
+{
+	//Contexts whose backtracking isn't ended, they are kept at the beginning of ctx
+	int n_active = 0;
+
+	for (int j = 0; j < n; j++)
+	{
+		input_query* info_seq = &ctx[j]->seq;
+		if ((info_seq->search_scheme || info_seq->seed_verify) && info_seq->len > info_seq->max_diff)
+		{
+			get_approximate_match(idx, ctx[j]);
+			continue;
+		}
+
+		reset_results(ctx[j]);
+		find_bridging_occurrences(idx, ctx[j]);
+		backtracking_start(idx, ctx[j]);
+
+		lib_aln_search_ctx_t* tmp = ctx[n_active];
+		ctx[n_active++] = ctx[j];
+		ctx[j] = tmp;
+	}
+
+	while (n_active)
+	{
+		for (int j = 0; j < n_active; j++)
+		{
+			if (backtracking_step(idx, ctx[j], true))
+				continue;
+
+			//The search of ctx[j] is ended, the last active context takes its place
+			lib_aln_search_ctx_t* tmp = ctx[j];
+			ctx[j--] = ctx[--n_active];
+			ctx[n_active] = tmp;
+		}
+	}
+}
+
+/*
+ * Same of get_approximate_match, but the SA intervals of the hits have already been found (for example by
+ * the batch search on the trie of the patterns): they are handled in the given order.
+ */
+uint32_t search_ctx_report_hits(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, const scheme_hit_t* hits, size_t n_hits)
+{
+	reset_results(ctx);
+	find_bridging_occurrences(idx, ctx);
+
+	for (size_t i = 0; i < n_hits; i++)
+		if (search_ctx_report_hit(idx, ctx, hits[i].k, hits[i].l, hits[i].n_mm))
+			break;
+
+	return ctx->n_hits_found;
+}
+
+//Discard the results of the previous search
+static void reset_results(lib_aln_search_ctx_t* ctx)
+{
 	/*
-	 * Number of permissible match found.
-	 * Warning: if the current hit found and its r.v. are present inside the reference, it's increased by two
+	 * The hits found are stored inside ctx->hits.
+	 * Warning: if the current hit found and its r.v. are present inside the reference, two hits are added
 	 */
-	int n_hit_found = 0;
+	ctx->hits.n = ctx->ref_pos.n = ctx->diff_pos.n = ctx->hit_str.n = 0;
+	ctx->intervals.n = 0;
+	ctx->n_hits_found = 0;
+	ctx->best_mm = -1;
+	ctx->stop_search = false;
+
+	//The limits are counted from the start of the query
+	ctx->status = 0;
+	ctx->n_expansions = ctx->n_located = 0;
+	ctx->deadline = ctx->limits.max_seconds > 0 ? now_seconds() + ctx->limits.max_seconds : 0;
+
+	//Number of occurrences found for each number of mismatches
+	kv_reserve(uint64_t, ctx->counts, ctx->seq.max_diff + 1);
+	ctx->counts.n = ctx->seq.max_diff + 1;
+	memset(ctx->counts.a, 0, ctx->counts.n * sizeof(uint64_t));
+}
 
-	//Initially, the structure containing the info relative to the hits found has size 4.
-	int m_hit_found = 4;
-	search_result** returnM = (search_result**) malloc(m_hit_found * sizeof(search_result*));
-	for (int i = 0; i < m_hit_found; i++)
-		*(returnM + i) = (search_result *) malloc(sizeof(search_result));
+//Modified version of bwt_match_gap in bwtgap.c file
+static void bound_backtracking(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	backtracking_start(idx, ctx);
+
+	//With priority on the number of mismatches, partial hits calculated previously are extracted
+	while (backtracking_step(idx, ctx, false))
+		;
+}
+
+//Prepare the stack of the partial hits of the query stored inside ctx, see backtracking_step
+static void backtracking_start(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	input_query* info_seq = &ctx->seq;
+
+	//see cal_width implementation
+	cal_width(idx->bwt, info_seq->len, info_seq->seq, ctx->width);
+
+	//Print pattern to search
+	if (verbose_bound_backtracking_search > 2)
+	{
+		fprintf(stderr,"\nThe search pattern is the r.c. of input pattern: ");
+		print_pattern_to_search(info_seq->seq, info_seq->len);
+	}
+	//Reset stack
+	reset_stack(&ctx->stack, info_seq->max_diff);
+
+	push(&ctx->stack, info_seq->len, 0, idx->bwt->seq_len, 0, 0, 0);
+}
+
+/*
+ * Extract the best partial hit of the query stored inside ctx and extend it. Return false when the search is ended.
+ * If prefetch, the blocks of the occurrences needed by the next partial hit are prefetched before returning,
+ * so a caller that advances other queries in the meantime finds them inside the CPU cache.
+ */
+static bool backtracking_step(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, bool prefetch)
+{
+	input_query* info_seq = &ctx->seq;
 
 	/*
 	 * Heap-like data structure to keep partial hits. It is prioritized on the number of mismatch
 	 * inside the partial hits(also called entry): less mismatch have a entry first is extract
 	 */
-	stack_t *stack = init_stack(info_seq->max_diff);
+	stack_t *stack = &ctx->stack;
 
 	//see cal_width implementation
-	bwt_width_t* width = (bwt_width_t*) malloc((info_seq->len + 1) * sizeof(bwt_width_t));
-	cal_width(idx->bwt, info_seq->len, info_seq->seq, width);
+	bwt_width_t* width = ctx->width;
 
 	//Get bwt 
 	bwt_t* bwt = idx->bwt;
 
-	//Max number(s) of mismatch(es) between a hit and the reference
-	const int max_diff = info_seq->max_diff;
+	//Max number(s) of mismatch(es) between a hit and the reference, lowered to the best stratum by ALL_BEST_HIT and UNIQUE_BEST_HIT
+	int max_diff = ctx->best_mm >= 0 ? ctx->best_mm : info_seq->max_diff;
+
+	if (stack->n_entries == 0)
+		return false;
+
+	//Get the best entry among the previously calculated partial hits
+	entry_t e;
+	pop(stack, &e);
+
+	/*
+	 * The entries are extracted in increasing number of mismatches: once the best hits have been found,
+	 * the first entry with more mismatches ends the search
+	 */
+	if (e.n_mm > max_diff)
+		return false;
+
+	//The work of the query is bounded by its limits
+	if (search_ctx_expand(ctx))
+		return false;
+
+	//Defines whether the current entry 'e' is a hit
+	bool hit_found = false;
+
+	/*
+	 * The number of mismatch of the current entry regard the substring [i,n-1] of the
+	 * input pattern.
+	 */
+	int i = e.info;
+
+	//(k,l) is the SA region of [i,n-1]
+	uint64_t k = e.k;
+	uint64_t l = e.l;
+
+	/*
+	 * For the current entry 'e' previously calculated, n_mm_yet_allow is the max number of
+	 * mismatch that 'e' can still contain
+	 */
+	int n_mm_yet_allow = max_diff - e.n_mm;
 
-	//Print pattern to search
 	if (verbose_bound_backtracking_search > 2)
 	{
-		fprintf(stderr,"\nThe search pattern is the r.c. of input pattern: ");
-		print_pattern_to_search(info_seq->seq, info_seq->len);
+		fprintf(stderr,"\n*New entry is extracted, this has: ");
+		fprintf(stderr,"\ni: %d\n", i);
+		fprintf(stderr,"k: %ld\n", k);
+		fprintf(stderr,"l: %ld\n", l);
+		fprintf(stderr,"n_mm_yet_allow: %d\n\n", n_mm_yet_allow);
 	}
-	//Reset stack
-	reset_stack(stack);
 
-	push(stack, info_seq->len, 0, bwt->seq_len, 0, 0);
+	//This control should be useless..
+	if (n_mm_yet_allow < 0)
+		return true;
 
-	//With priority on the number of mismatches, partial hits calculated previously are extracted
-	while (stack->n_entries)
+	if (i > 0 && n_mm_yet_allow < width[i - 1].bid)
 	{
-		//Get the best entry among the previously calculated partial hits
-		entry_t e;
-		pop(stack, &e);
-
-		//Defines whether the current entry 'e' is a hit
-		bool hit_found = false;
+		if (verbose_bound_backtracking_search > 2)
+		{
+			fprintf(stderr,"°°Used width!°°\n");
+			fprintf(stderr,"n_mm_yet_allow: %d\n", n_mm_yet_allow);
+			fprintf(stderr,"width[i - 1].bid: %d\n", width[i - 1].bid);
+		}
+		return true;
+	}
 
+	// Check whether a hit is found
+	if (i == 0)
+	{
+		//This means that the length of the current entry is exactly equal to the length of the input patter
+		hit_found = true;
+	}
+	else if (n_mm_yet_allow == 0 && !prefetch)
+	{
 		/*
-		 * The number of mismatch of the current entry regard the substring [i,n-1] of the
-		 * input pattern.
+		 * This means that the current partial hit have the max possible number of mismatch,
+		 * so the only possible hit is composed by 'e' and the miss base must be equal to the
+		 * base of the input patter. With prefetch the bases are instead added one at a time by
+		 * the next steps, so each step accesses the BWT only once.
 		 */
-		int i = e.info;
+		if (verbose_bound_backtracking_search > 2)
+			fprintf(stderr,"bwt_match_exact_alt\n");
 
-		//(k,l) is the SA region of [i,n-1]
-		uint64_t k = e.k;
-		uint64_t l = e.l;
+		if (bwt_match_exact_alt(bwt, i, info_seq->seq, &k, &l))
+		{
+			if (verbose_bound_backtracking_search > 2)
+			{
+				fprintf(stderr,"hit found\n");
+				fprintf(stderr,"k: %ld\n", k);
+				fprintf(stderr,"l: %ld\n", l);
+			}
+			hit_found = true;
+		}
+		else
+		{
+			if (verbose_bound_backtracking_search > 2)
+				fprintf(stderr,"Hit not found from bwt_match_exact_alt\n");
 
-		/*
-		 * For the current entry 'e' previously calculated, n_mm_yet_allow is the max number of
-		 * mismatch that 'e' can still contain
-		 */
-		int n_mm_yet_allow = max_diff - e.n_mm;
+			return true; // no hit, skip
+		}
+	}
+	if (hit_found)
+	{
+		//This method is used to reduce the search space
+		shadow(l - k + 1, info_seq->len, bwt->seq_len, e.last_diff_pos, width);
+
+		return !search_ctx_report_hit(idx, ctx, k, l, e.n_mm);
+	}
+
+	//Number of bases of the current partial hit
+	const int d = info_seq->len - i;
+
+	//Increase(not decrease..) the size of the current partial hit
+	--i;
+
+	/*
+	 * Give k - 1 and l of the current entry 'e', compute
+	 * O(x,k-1) and O(x,l), where x can be A,C,G,T.
+	 *
+	 * For more detail please see section (2.3) and (2.4) of original paper:
+	 * https://academic.oup.com/bioinformatics/article/25/14/1754/225615
+	 *
+	 */
+	uint64_t ext_k[4], ext_l[4];
+
+	//The SA intervals of the first bases are read from the k-mer table, if it's available
+	const bool use_kmi = d < bwt->kmi_q;
+	if (!use_kmi)
+		get_extensions(bwt, ctx, k, l, ext_k, ext_l);
+
+	//Try to extend the current partial hit whit every possible base
+	for (int j = 1; j <= 4; ++j)
+	{
+		int c = (info_seq->seq[i] + j) & 3;
 
 		if (verbose_bound_backtracking_search > 2)
 		{
-			fprintf(stderr,"\n*New entry is extracted, this has: ");
-			fprintf(stderr,"\ni: %d\n", i);
-			fprintf(stderr,"k: %ld\n", k);
-			fprintf(stderr,"l: %ld\n", l);
-			fprintf(stderr,"n_mm_yet_allow: %d\n\n", n_mm_yet_allow);
+			fprintf(stderr,">Try to extend the current partial hit whit: ");
+			print_character(c);
 		}
-
-		//This control should be useless..
-		if (n_mm_yet_allow < 0)
+		int is_mm = (j != 4 || info_seq->seq[i] > 3);
+		if (is_mm && n_mm_yet_allow == 0)
 			continue;
 
-		if (i > 0 && n_mm_yet_allow < width[i - 1].bid)
+		uint32_t key = 0;
+		if (use_kmi)
+		{
+			key = e.key | (uint32_t) c << (d << 1);
+			kmi_get(bwt, d + 1, key, &k, &l);
+		}
+		else
+		{
+			k = ext_k[c];
+			l = ext_l[c];
+		}
+
+		if (k <= l)
 		{
 			if (verbose_bound_backtracking_search > 2)
 			{
-				fprintf(stderr,"°°Used width!°°\n");
-				fprintf(stderr,"n_mm_yet_allow: %d\n", n_mm_yet_allow);
-				fprintf(stderr,"width[i - 1].bid: %d\n", width[i - 1].bid);
+				if (is_mm)
+					fprintf(stderr, "Found(whit mismatch)-->push inside stack this partial hit whit this values: \n");
+				else
+					fprintf(stderr, "Found(no mismatch)-->push inside stack this partial hit whit this values: \n");
+
+				fprintf(stderr,"i %d\n", i);
+				fprintf(stderr,"k %ld:\n", k);
+				fprintf(stderr,"l %ld:\n", l);
+				fprintf(stderr,"num. mismatch inside this partial hit is: %d\n", e.n_mm + is_mm);
 			}
-			continue;
+			//The partial hit is add in the reference, its last mismatch is kept by the bases added without mismatches
+			push(stack, i, k, l, e.n_mm + is_mm, is_mm ? i : (n_mm_yet_allow == 0 ? e.last_diff_pos : 0), key);
 		}
-
-		// Check whether a hit is found
-		if (i == 0)
+		else
 		{
-			//This means that the length of the current entry is exactly equal to the length of the input patter
-			hit_found = true;
+			if (verbose_bound_backtracking_search > 2)
+				fprintf(stderr, "Not found-->discard\n");
 		}
-		else if (n_mm_yet_allow == 0)
+	}
+
+	//The next entry is extended by the next step: its SA interval is known, so the occurrences can be loaded in the meantime
+	if (prefetch && stack->n_entries)
+	{
+		const substack_t *q = stack->stacks + stack->best;
+		const entry_t *next = q->start_substack + q->n_entries_substack - 1;
+		if (next->info > 0 && (int) (info_seq->len - next->info) >= bwt->kmi_q)
 		{
-			/*
-			 * This means that the current partial hit have the max possible number of mismatch,
-			 * so the only possible hit is composed by 'e' and the miss base must be equal to the
-			 * base of the input patter
-			 */
-			if (verbose_bound_backtracking_search > 2)
-				fprintf(stderr,"bwt_match_exact_alt\n");
+			bwt_prefetch_occ(bwt, next->k - 1);
+			bwt_prefetch_occ(bwt, next->l);
+		}
+	}
+	return true;
+}
 
-			if (bwt_match_exact_alt(bwt, i, info_seq->seq, &k, &l))
-			{
-				if (verbose_bound_backtracking_search > 2)
-				{
-					fprintf(stderr,"hit found\n");
-					fprintf(stderr,"k: %ld\n", k);
-					fprintf(stderr,"l: %ld\n", l);
-				}
-				hit_found = true;
-			}
-			else
-			{
-				if (verbose_bound_backtracking_search > 2)
-					fprintf(stderr,"Hit not found from bwt_match_exact_alt\n");
+/*
+ * Calculate the SA intervals of the 4 strings obtained adding a base to the string of [k,l].
+ * If the context has a cache, they are searched inside it before being calculated: [k,l] identifies the string,
+ * so the queries that share a suffix (for example overlapping k-mers of a read) reuse the extensions.
+ */
+static inline void get_extensions(const bwt_t* bwt, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l, uint64_t ext_k[4], uint64_t ext_l[4])
+{
+	uint64_t cnt_k[4], cnt_l[4];
+	cache_entry_t* p = 0;
 
-				continue; // no hit, skip
-			}
+	if (ctx->cache)
+	{
+		if (ctx->cache_bwt != bwt)
+		{
+			clear_cache(ctx);
+			ctx->cache_bwt = bwt;
 		}
-		if (hit_found)
+
+		p = ctx->cache + (((k * 0x9E3779B97F4A7C15ULL) ^ l) & ctx->cache_mask);
+		if (p->k == k && p->l == l)
 		{
-			/*
-			 * Inside the suffix interval [k,l], some position is relative
-			 * of a hit that is forward respect the pattern input, other
-			 * is r.c. respect the pattern input
-			 */
-			uint64_t numer_forward = 0;
-			uint64_t numer_revC = 0;
-
-			//This method is used to reduce the search space
-			shadow(l - k + 1, info_seq->len, bwt->seq_len, e.last_diff_pos, width);
-
-			//We might have to add both the direct and the reverse complement of the current entry
-			if (!(n_hit_found + 2 <= m_hit_found))
-			{
-				m_hit_found <<= 1;
-				(returnM) = (search_result**) realloc(returnM, m_hit_found * sizeof(search_result*));
-				for (int i = n_hit_found; i < m_hit_found; i++)
-					*(returnM + i) = (search_result *) malloc(sizeof(search_result));
+			++ctx->cache_hits;
+			memcpy(ext_k, p->ext_k, 4 * sizeof(uint64_t));
+			memcpy(ext_l, p->ext_l, 4 * sizeof(uint64_t));
+			return;
+		}
+		++ctx->cache_misses;
+	}
 
-				if (verbose_bound_backtracking_search > 2)
-					fprintf(stderr,"Realloc successfully completed\n");
-			}
-			if (verbose_bound_backtracking_search > 2)
-			{
-				printf("k: %"PRIu64 "\n", k);
-				printf("l: %"PRIu64 "\n", l);
-			}
+	bwt_2occ4(bwt, k - 1, l, cnt_k, cnt_l);
+	for (int c = 0; c < 4; ++c)
+	{
+		ext_k[c] = bwt->L2[c] + cnt_k[c] + 1;
+		ext_l[c] = bwt->L2[c] + cnt_l[c];
+	}
 
-			//For each index j that belongs to the suffix interval [k,l], get_pos_from_sa_interval
-			//return all SA(j) valid
-			uint64_t* position_to_ref = get_pos_from_sa_interval(idx, k, l, info_seq, &numer_forward, &numer_revC);
+	//The previous entry with the same hash is replaced
+	if (p)
+	{
+		p->k = k;
+		p->l = l;
+		memcpy(p->ext_k, ext_k, 4 * sizeof(uint64_t));
+		memcpy(p->ext_l, ext_l, 4 * sizeof(uint64_t));
+	}
+}
 
-			//If all positions corresponding to suffix interval [k, l] are not valid continue
-			if ((numer_forward + numer_revC) == 0)
-				continue;
+//All the entries are empty: k > l is never searched
+static void clear_cache(lib_aln_search_ctx_t* ctx)
+{
+	for (uint64_t i = 0; i <= ctx->cache_mask; ++i)
+	{
+		ctx->cache[i].k = 1;
+		ctx->cache[i].l = 0;
+	}
+}
 
-			//Add hit(s) in returnM and update n_hit_found
-			add_entry_to_result(idx, returnM, e.n_mm, numer_forward, numer_revC, position_to_ref, info_seq, &n_hit_found);
+/*
+ * The cache of the extensions of ctx has at least n_entries entries (rounded up to a power of 2), 0 removes it.
+ * The previous entries and the counters are discarded. Return -1 if the memory can't be allocated.
+ */
+int search_ctx_set_cache(lib_aln_search_ctx_t* ctx, uint32_t n_entries)
+{
+	free(ctx->cache);
+	ctx->cache = 0;
+	ctx->cache_mask = 0;
+	ctx->cache_bwt = 0;
+	ctx->cache_hits = ctx->cache_misses = 0;
 
-			free(position_to_ref);
+	if (n_entries == 0)
+		return 0;
 
-			if (info_seq->type_search == ARBITRARY_HIT)
-				break;
+	uint64_t n = 1;
+	while (n < n_entries)
+		n <<= 1;
 
-			continue;
-		}
+	ctx->cache = (cache_entry_t*) malloc(n * sizeof(cache_entry_t));
+	if (ctx->cache == 0)
+	{
+		fprintf(stderr, "Unable to allocate the cache.\n");
+		return -1;
+	}
+	ctx->cache_mask = n - 1;
+	clear_cache(ctx);
 
-		//Increase(not decrease..) the size of the current partial hit
-		--i;
+	return 0;
+}
 
-		/*
-		 * Give k - 1 and l of the current entry 'e', compute
-		 * O(x,k-1) and O(x,l), where x can be A,C,G,T.
-		 *
-		 * For more detail please see section (2.3) and (2.4) of original paper:
-		 * https://academic.oup.com/bioinformatics/article/25/14/1754/225615
-		 *
-		 */
-		uint64_t cnt_k[4], cnt_l[4];
-		bwt_2occ4(bwt, k - 1, l, cnt_k, cnt_l);
+//The limits of each query solved by ctx, NULL removes them
+void search_ctx_set_limits(lib_aln_search_ctx_t* ctx, const lib_aln_limits_t* limits)
+{
+	if (limits)
+		ctx->limits = *limits;
+	else
+		memset(&ctx->limits, 0, sizeof(lib_aln_limits_t));
+}
 
-		//Try to extend the current partial hit whit every possible base
-		for (int j = 1; j <= 4; ++j)
-		{
-			int c = (info_seq->seq[i] + j) & 3;
+//Return true (and set the status) if the deadline of the current query is over
+bool search_ctx_check_deadline(lib_aln_search_ctx_t* ctx)
+{
+	if (now_seconds() < ctx->deadline)
+		return false;
 
-			if (verbose_bound_backtracking_search > 2)
-			{
-				fprintf(stderr,">Try to extend the current partial hit whit: ");
-				print_character(c);
-			}
-			int is_mm = (j != 4 || info_seq->seq[i] > 3);
-			k = bwt->L2[c] + cnt_k[c] + 1;
-			l = bwt->L2[c] + cnt_l[c];
+	ctx->status |= LIMIT_DEADLINE;
+	return true;
+}
 
-			if (k <= l)
-			{
-				if (verbose_bound_backtracking_search > 2)
-				{
-					if (is_mm)
-						fprintf(stderr, "Found(whit mismatch)-->push inside stack this partial hit whit this values: \n");
-					else
-						fprintf(stderr, "Found(no mismatch)-->push inside stack this partial hit whit this values: \n");
-
-					fprintf(stderr,"i %d\n", i);
-					fprintf(stderr,"k %ld:\n", k);
-					fprintf(stderr,"l %ld:\n", l);
-					fprintf(stderr,"num. mismatch inside this partial hit is: %d\n", e.n_mm + is_mm);
-				}
-				//The partial hit is add in the reference
-				push(stack, i, k, l, e.n_mm + is_mm, is_mm);
-			}
-			else
-			{
-				if (verbose_bound_backtracking_search > 2)
-					fprintf(stderr, "Not found-->discard\n");
-			}
-		}
+//Monotonic clock, in seconds
+static inline double now_seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Handle the hit whose SA interval is [k,l] and whose number of mismatches is n_mm: based on the type of search,
+ * its positions are calculated and the hit(s) added, or only its interval or its number of occurrences is stored.
+ * It's used by all the engines. Return true if the search must be stopped.
+ */
+bool search_ctx_report_hit(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l, int n_mm)
+{
+	input_query* info_seq = &ctx->seq;
+
+	/*
+	 * Inside the suffix interval [k,l], some position is relative
+	 * of a hit that is forward respect the pattern input, other
+	 * is r.c. respect the pattern input
+	 */
+	uint64_t numer_forward = 0;
+	uint64_t numer_revC = 0;
+
+	//No more positions can be located, or the time of the query is over
+	if ((ctx->status & LIMIT_TOTAL_POS) || (ctx->deadline > 0 && search_ctx_check_deadline(ctx)))
+		return true;
+
+	//The hits are reported in increasing number of mismatches: the best modes stop at the first hit worse than the best
+	const bool best_mode = info_seq->type_search == ALL_BEST_HIT || info_seq->type_search == UNIQUE_BEST_HIT;
+	if (best_mode && ctx->best_mm >= 0 && n_mm > ctx->best_mm)
+		return true;
+
+	//Only the number of occurrences is needed: the hit isn't added and its positions aren't calculated
+	if (info_seq->type_search == COUNT_ONLY)
+	{
+		ctx->counts.a[n_mm] += count_occurrences(idx, ctx, k, l);
+		return false;
 	}
 
-	*(num_hits) = n_hit_found;
+	//Only the SA interval is stored, its positions are calculated on demand by pos_iter_next
+	if (info_seq->only_intervals)
+	{
+		//The best modes and ARBITRARY_HIT stop at this interval, so it must contain an occurrence returned by pos_iter_next
+		if ((best_mode || info_seq->type_search == ARBITRARY_HIT) && !interval_has_occurrences(idx, ctx, k, l))
+			return false;
+
+		lib_aln_sa_interval_t* iv = kv_pushp(lib_aln_sa_interval_t, ctx->intervals);
+		iv->k = k;
+		iv->l = l;
+		iv->len = info_seq->len;
+		iv->n_mismatches = n_mm;
+		iv->type_output = info_seq->type_output;
+
+		if (best_mode)
+			ctx->best_mm = n_mm;
+
+		return info_seq->type_search == ARBITRARY_HIT;
+	}
+
+	/*
+	 * At most len - 1 indexes of [k,l] are occurrences that bridge the forward and the r.c. strand (discarded by
+	 * bwa_sa2pos), so with ALLOW_REV_COMP more than len indexes are at least two occurrences: the hit isn't unique
+	 */
+	if (info_seq->type_search == UNIQUE_BEST_HIT && info_seq->type_output == ALLOW_REV_COMP && l - k + 1 > info_seq->len)
+	{
+		discard_hits(ctx, n_mm);
+		return true;
+	}
 
 	if (verbose_bound_backtracking_search > 2)
 	{
-		fprintf(stderr, "\nNumber of hit found: %d\n", n_hit_found);
-		fprintf(stderr, "End get_approximate_match\n");
+		printf("k: %"PRIu64 "\n", k);
+		printf("l: %"PRIu64 "\n", l);
+	}
+
+	//For each index j that belongs to the suffix interval [k,l], get_pos_from_sa_interval
+	//store all SA(j) valid inside ctx->sa_pos
+	get_pos_from_sa_interval(idx, k, l, ctx, &numer_forward, &numer_revC);
+
+	//If all positions corresponding to suffix interval [k, l] are not valid continue
+	if ((numer_forward + numer_revC) == 0)
+		return false;
+
+	//Add hit(s) in ctx->hits
+	add_entry_to_result(idx, ctx, n_mm, numer_forward, numer_revC);
+
+	if (best_mode)
+		ctx->best_mm = n_mm;
+
+	//A second occurrence with the best number of mismatches: no hit is returned
+	if (info_seq->type_search == UNIQUE_BEST_HIT && ctx->counts.a[n_mm] > 1)
+	{
+		discard_hits(ctx, n_mm);
+		return true;
+	}
+
+	return info_seq->type_search == ARBITRARY_HIT || ctx->stop_search || (ctx->status & LIMIT_TOTAL_POS);
+}
+
+/*
+ * True if an index of [k,l] is a valid occurrence (see pos_iter_next). With NO_REV_COMP all of them can be r.c.
+ * occurrences and with ALLOW_REV_COMP at most len - 1 of them bridge the two strands, so only the shorter intervals
+ * are located, until the first valid occurrence.
+ */
+static bool interval_has_occurrences(const bwaidx_t* idx, const lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l)
+{
+	if (ctx->seq.type_output == ALLOW_REV_COMP && l - k + 1 >= ctx->seq.len)
+		return true;
+
+	lib_aln_pos_iter_t it;
+	uint64_t pos;
+	it.idx = idx;
+	it.t = k;
+	it.l = l;
+	it.len = ctx->seq.len;
+	it.type_output = ctx->seq.type_output;
+	return pos_iter_next(&it, &pos, 0, 1) == 1;
+}
+
+/*
+ * Remove the hits found by the current search (UNIQUE_BEST_HIT), the best hit with n_mm mismatches isn't unique.
+ * How many occurrences are seen before the search stops depends on the engine and on the order of the SA intervals,
+ * so the count of n_mm is always 2 (at least two occurrences).
+ */
+static void discard_hits(lib_aln_search_ctx_t* ctx, int n_mm)
+{
+	ctx->hits.n = ctx->ref_pos.n = ctx->diff_pos.n = ctx->hit_str.n = 0;
+	ctx->n_hits_found = 0;
+	ctx->counts.a[n_mm] = 2;
+}
+
+
+lib_aln_search_ctx_t* search_ctx_init(void)
+{
+	return (lib_aln_search_ctx_t*) calloc(1, sizeof(lib_aln_search_ctx_t));
+}
+
+void search_ctx_destroy(lib_aln_search_ctx_t* ctx)
+{
+	if (ctx == 0)
+		return;
+
+	destroy_stack(&ctx->stack);
+	free(ctx->seq.seq);
+	free(ctx->width);
+	kv_destroy(ctx->sa_pos);
+	kv_destroy(ctx->hit_code);
+	kv_destroy(ctx->hits);
+	kv_destroy(ctx->ref_pos);
+	kv_destroy(ctx->diff_pos);
+	kv_destroy(ctx->hit_str);
+	kv_destroy(ctx->counts);
+	kv_destroy(ctx->bridging);
+	kv_destroy(ctx->intervals);
+	kv_destroy(ctx->scheme_steps);
+	kv_destroy(ctx->scheme_stack);
+	kv_destroy(ctx->scheme_hits);
+	kv_destroy(ctx->seed_words);
+	kv_destroy(ctx->seed_cand);
+	kv_destroy(ctx->seed_hits);
+	kv_destroy(ctx->seed_str);
+	free(ctx->cache);
+	kv_destroy(ctx->sr);
+	kv_destroy(ctx->returnM);
+	kv_destroy(ctx->arena);
+	free(ctx);
+}
+
+//Store all information regard the search inside ctx->seq
+void search_ctx_prepare(lib_aln_search_ctx_t* ctx, const char* pattern_input, const size_t pattern_len, const uint8_t nmismatch,
+						const uint8_t type_search, const uint8_t type_output, const bool only_intervals)
+{
+	if (ctx->m_seq < pattern_len)
+	{
+		ctx->m_seq = pattern_len;
+		ctx->seq.seq = (ubyte_t*) realloc(ctx->seq.seq, ctx->m_seq);
+	}
+	if (ctx->m_width < pattern_len + 1)
+	{
+		ctx->m_width = pattern_len + 1;
+		ctx->width = (bwt_width_t*) realloc(ctx->width, ctx->m_width * sizeof(bwt_width_t));
+	}
+
+	/*
+	 * The pattern to be searched is the r.c. of the input string and each base is converted to integer.
+	 * A=0, C=1, G=2, T=3
+	 */
+	create_pattern_to_search(pattern_input, pattern_len, ctx->seq.seq);
+	ctx->seq.len = pattern_len;
+	ctx->seq.max_diff = nmismatch;
+	ctx->seq.type_search = type_search & ~ENGINE_FLAGS;
+	ctx->seq.search_scheme = (type_search & SEARCH_SCHEME) != 0;
+	ctx->seq.seed_verify = (type_search & SEED_AND_VERIFY) != 0;
+	ctx->seq.type_output = type_output;
+	ctx->seq.only_intervals = only_intervals;
+}
+
+/*
+ * Pass each hit found by the next searches to callback instead of storing it inside ctx,
+ * a NULL callback restores the default behaviour.
+ */
+void search_ctx_set_callback(lib_aln_search_ctx_t* ctx, lib_aln_hit_callback_t callback, void* data)
+{
+	ctx->callback = callback;
+	ctx->callback_data = data;
+}
+
+//Round up x to a multiple of 8 bytes
+#define align8(x) (((x) + 7) & ~(uint64_t) 7)
+
+//Fill sr with the hit h, whose arrays are inside pos, diff and str
+static inline void fill_search_result(const lib_aln_hit_t* h, search_result* sr, uint64_t* pos, uint32_t* diff, char* str)
+{
+	sr->hit = str + h->hit_offset;
+	sr->positions_to_ref = pos + h->pos_offset;
+	sr->num_occur = h->num_occur;
+	sr->different_positions = h->n_mismatches > 0 ? diff + h->diff_offset : NULL;
+	sr->n_mismatches = h->n_mismatches;
+	sr->is_rev_comp = h->is_rev_comp;
+}
+
+/*
+ * Fill sr and returnM with the hits found by the last search. The positions, the different positions and
+ * the characters of the hits are stored inside pos, diff and str (copies of the pools of the context).
+ */
+static void fill_results(const lib_aln_search_ctx_t* ctx, search_result* sr, search_result** returnM, uint64_t* pos, uint32_t* diff, char* str)
+{
+	for (size_t i = 0; i < ctx->hits.n; i++)
+	{
+		fill_search_result(&ctx->hits.a[i], &sr[i], pos, diff, str);
+		returnM[i] = &sr[i];
 	}
+}
 
-	//free memory
-	destroy_stack(stack);
-	free(width);
+//Copy n bytes from src to dst, src may be NULL if n is 0
+static inline void copy_pool(void* dst, const void* src, size_t n)
+{
+	if (n > 0)
+		memcpy(dst, src, n);
+}
+
+/*
+ * Return the hits found by the last search. The view is stored inside ctx: it's valid until
+ * the next search with the same context.
+ */
+search_result** search_ctx_results(lib_aln_search_ctx_t* ctx)
+{
+	size_t n = ctx->hits.n;
+
+	kv_reserve(search_result, ctx->sr, n);
+	kv_reserve(search_result*, ctx->returnM, n + 1);
+	fill_results(ctx, ctx->sr.a, ctx->returnM.a, ctx->ref_pos.a, ctx->diff_pos.a, ctx->hit_str.a);
+	ctx->sr.n = ctx->returnM.n = n;
+
+	return ctx->returnM.a;
+}
+
+/*
+ * Copy the hits found by the last search inside a single block of memory: the array of pointers
+ * is followed by the hits and by the arrays that they refer to, so free() of the returned value
+ * releases everything.
+ */
+search_result** search_ctx_copy_results(const lib_aln_search_ctx_t* ctx)
+{
+	size_t n = ctx->hits.n;
+	uint64_t off_sr = align8((n + 1) * sizeof(search_result*));
+	uint64_t off_pos = off_sr + align8(n * sizeof(search_result));
+	uint64_t off_diff = off_pos + align8(ctx->ref_pos.n * sizeof(uint64_t));
+	uint64_t off_str = off_diff + align8(ctx->diff_pos.n * sizeof(uint32_t));
+	uint8_t* block = (uint8_t*) malloc(off_str + ctx->hit_str.n);
+
+	copy_pool(block + off_pos, ctx->ref_pos.a, ctx->ref_pos.n * sizeof(uint64_t));
+	copy_pool(block + off_diff, ctx->diff_pos.a, ctx->diff_pos.n * sizeof(uint32_t));
+	copy_pool(block + off_str, ctx->hit_str.a, ctx->hit_str.n);
+	fill_results(ctx, (search_result*) (block + off_sr), (search_result**) block, (uint64_t*) (block + off_pos),
+					(uint32_t*) (block + off_diff), (char*) (block + off_str));
+
+	return (search_result**) block;
+}
 
-	return returnM;
+//Size in bytes of the result set of the last search
+uint64_t search_ctx_result_set_size(const lib_aln_search_ctx_t* ctx)
+{
+	uint64_t size = align8(sizeof(lib_aln_result_set_t));
+	size += align8(ctx->hits.n * sizeof(lib_aln_hit_t));
+	size += align8(ctx->ref_pos.n * sizeof(uint64_t));
+	size += align8(ctx->diff_pos.n * sizeof(uint32_t));
+	size += align8(ctx->hit_str.n);
+	size += align8(ctx->counts.n * sizeof(uint64_t));
+	size += align8(ctx->intervals.n * sizeof(lib_aln_sa_interval_t));
+	return size;
 }
 
-input_query* init_bwt_seq(uint8_t* pattern_to_search, const size_t pattern_len, const uint8_t nmismatch, const uint8_t type_search,
-							const uint8_t type_output)
+//Store the result set of the last search inside rs, it must have search_ctx_result_set_size(ctx) bytes
+void search_ctx_pack_result_set(const lib_aln_search_ctx_t* ctx, lib_aln_result_set_t* rs)
 {
-	input_query *seq = (input_query*) calloc(1, sizeof(input_query));
-	seq->seq = pattern_to_search;
-	seq->len = pattern_len;
-	seq->max_diff = nmismatch;
-	seq->type_search = type_search;
-	seq->type_output = type_output;
-	return seq;
+	uint8_t* base = (uint8_t*) rs;
+	uint64_t off = align8(sizeof(lib_aln_result_set_t));
+
+	rs->n_hits = ctx->hits.n;
+	rs->hits_offset = off;
+	copy_pool(base + off, ctx->hits.a, ctx->hits.n * sizeof(lib_aln_hit_t));
+	off += align8(ctx->hits.n * sizeof(lib_aln_hit_t));
+
+	rs->n_positions = ctx->ref_pos.n;
+	rs->positions_offset = off;
+	copy_pool(base + off, ctx->ref_pos.a, ctx->ref_pos.n * sizeof(uint64_t));
+	off += align8(ctx->ref_pos.n * sizeof(uint64_t));
+
+	rs->n_diff = ctx->diff_pos.n;
+	rs->diff_offset = off;
+	copy_pool(base + off, ctx->diff_pos.a, ctx->diff_pos.n * sizeof(uint32_t));
+	off += align8(ctx->diff_pos.n * sizeof(uint32_t));
+
+	rs->n_chars = ctx->hit_str.n;
+	rs->chars_offset = off;
+	copy_pool(base + off, ctx->hit_str.a, ctx->hit_str.n);
+	off += align8(ctx->hit_str.n);
+
+	rs->n_counts = ctx->counts.n;
+	rs->counts_offset = off;
+	copy_pool(base + off, ctx->counts.a, ctx->counts.n * sizeof(uint64_t));
+	off += align8(ctx->counts.n * sizeof(uint64_t));
+
+	rs->n_intervals = ctx->intervals.n;
+	rs->intervals_offset = off;
+	copy_pool(base + off, ctx->intervals.a, ctx->intervals.n * sizeof(lib_aln_sa_interval_t));
+	off += align8(ctx->intervals.n * sizeof(lib_aln_sa_interval_t));
+
+	rs->status = ctx->status;
+	rs->size = off;
 }
 
-uint8_t* create_pattern_to_search(const char* pattern_input, const size_t pattern_len)
+//Result set of the last search, stored inside ctx: it's valid until the next search with the same context
+const lib_aln_result_set_t* search_ctx_result_set(lib_aln_search_ctx_t* ctx)
 {
-	//Code pattern input
-	uint8_t* pattern_to_search = (uint8_t*) malloc(pattern_len * sizeof(int8_t));
+	uint64_t size = search_ctx_result_set_size(ctx);
 
-	uint8_t base_to_int[] =
+	kv_reserve(uint64_t, ctx->arena, size / sizeof(uint64_t));
+	search_ctx_pack_result_set(ctx, (lib_aln_result_set_t*) ctx->arena.a);
+
+	return (const lib_aln_result_set_t*) ctx->arena.a;
+}
+
+void create_pattern_to_search(const char* pattern_input, const size_t pattern_len, uint8_t* pattern_to_search)
+{
+	static const uint8_t base_to_int[] =
 
 	{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
 		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
@@ -344,7 +907,6 @@ uint8_t* create_pattern_to_search(const char* pattern_input, const size_t patter
 		pattern_to_search[j] = base_to_int[(size_t) pattern_input[pattern_len - j - 1]]; //reverse
 		pattern_to_search[j] = pattern_to_search[j] > 3 ? 4 : 3 - pattern_to_search[j]; //complement
 	}
-	return pattern_to_search;
 }
 
 /*
@@ -354,7 +916,7 @@ uint8_t* create_pattern_to_search(const char* pattern_input, const size_t patter
  *P_r is the reverse of the input pattern. This is useful for making the search space smaller.
  */
 //Derived from bwt_cal_width in bwtaln.c file
-static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t *width)
+int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t *width)
 {
 	if (verbose_bound_backtracking_search > 2)
 		fprintf(stderr, "\n->Inside bwt_cal_width\n");
@@ -371,6 +933,10 @@ static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t
 	k = 0;
 	l = bwt->seq_len;
 
+	//Number of bases matched since the last restart and their code inside the k-mer table
+	int d = 0;
+	uint32_t key = 0;
+
 	for (i = 0; i < len; ++i)
 	{
 		//Before i have complement
@@ -379,7 +945,12 @@ static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t
 		if (verbose_bound_backtracking_search > 2)
 			fprintf(stderr, "Current character considered: %c\n", "ACGTN"[c]);
 
-		if (c < 4)
+		if (c < 4 && d < bwt->kmi_q)
+		{
+			key |= (uint32_t) c << (d << 1);
+			kmi_get(bwt, ++d, key, &k, &l);
+		}
+		else if (c < 4)
 		{
 			//This method calculates the rank function(usually indicated with O) of c
 			bwt_2occ(bwt, k - 1, l, c, &ok, &ol);
@@ -403,6 +974,8 @@ static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t
 			k = 0;
 			l = bwt->seq_len;
 			++bid;
+			d = 0;
+			key = 0;
 		}
 		width[i].w = l - k + 1;
 		width[i].bid = bid;
@@ -419,30 +992,32 @@ static int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t
 	return bid;
 }
 
-//It's the same of gap_reset_stack in bwtgap.c file
-static void reset_stack(stack_t *stack)
+/*
+ * Derived from gap_reset_stack and init_stack2 in bwtgap.c file.
+ * The substacks allocated by a previous search are reused.
+ */
+static void reset_stack(stack_t *stack, int nmismatch)
 {
 	int i;
-	for (i = 0; i != stack->n_sub_stacks; ++i)
-		stack->stacks[i].n_entries_substack = 0;
-	stack->best = stack->n_sub_stacks;
-	stack->n_entries = 0;
-}
-
-//Derived from init_stack2 in bwtgap.c file
-static stack_t * init_stack(int nmismatch)
-{
-	stack_t *stack = (stack_t*) calloc(1, sizeof(stack_t));
 
 	//Each partial hit, based on the number of mismatch it contains, will be "clustered together",
 	//in substack(so we can have at most nmismatch + 1 substack)
 	stack->n_sub_stacks = nmismatch + 1;
-	stack->stacks = (substack_t*) calloc(stack->n_sub_stacks, sizeof(stack_t));
-	return stack;
+	if (stack->n_sub_stacks > stack->m_sub_stacks)
+	{
+		stack->stacks = (substack_t*) realloc(stack->stacks, stack->n_sub_stacks * sizeof(substack_t));
+		memset(stack->stacks + stack->m_sub_stacks, 0, (stack->n_sub_stacks - stack->m_sub_stacks) * sizeof(substack_t));
+		stack->m_sub_stacks = stack->n_sub_stacks;
+	}
+
+	for (i = 0; i != stack->n_sub_stacks; ++i)
+		stack->stacks[i].n_entries_substack = 0;
+	stack->best = stack->n_sub_stacks;
+	stack->n_entries = 0;
 }
 
 //Derived from gap_push in bwtgap.c file
-static inline void push(stack_t *stack, int i, uint64_t k, uint64_t l, int n_mm, int is_diff)
+static inline void push(stack_t *stack, int i, uint64_t k, uint64_t l, int n_mm, int last_diff_pos, uint32_t key)
 {
 	//Get pointer to substack relative to partial hit whith n_mm mismatch
 	substack_t *q = stack->stacks + n_mm;
@@ -459,7 +1034,8 @@ static inline void push(stack_t *stack, int i, uint64_t k, uint64_t l, int n_mm,
 	p->k = k;
 	p->l = l;
 	p->n_mm = n_mm;
-	p->last_diff_pos = is_diff ? i : 0;
+	p->last_diff_pos = last_diff_pos;
+	p->key = key;
 
 	//Increase the total number of entries whit n_mm mismatches
 	++(q->n_entries_substack);
@@ -553,13 +1129,31 @@ static inline void shadow(int x, int len, uint64_t max, int last_diff_pos, bwt_w
 }
 
 //It's the same of original, present in bwt.c
-static int bwt_match_exact_alt(const bwt_t *bwt, int len, const ubyte_t *str, uint64_t *k0, uint64_t *l0)
+int bwt_match_exact_alt(const bwt_t *bwt, int len, const ubyte_t *str, uint64_t *k0, uint64_t *l0)
 {
 	int i;
 	uint64_t k, l, ok, ol;
 	k = *k0;
 	l = *l0;
-	for (i = len - 1; i >= 0; --i)
+	i = len - 1;
+
+	//If the search starts from the whole SA, the SA interval of the first bases is read from the k-mer table
+	if (bwt->kmi_q > 0 && k == 0 && l == bwt->seq_len && len > 0)
+	{
+		const int d = len < bwt->kmi_q ? len : bwt->kmi_q;
+		uint32_t key = 0;
+		for (int j = 0; j < d; ++j, --i)
+		{
+			if (str[i] > 3)
+				return 0; // there is an N here. no match
+			key |= (uint32_t) str[i] << (j << 1);
+		}
+		kmi_get(bwt, d, key, &k, &l);
+		if (k > l)
+			return 0; // no match
+	}
+
+	for (; i >= 0; --i)
 	{
 		ubyte_t c = str[i];
 		if (c > 3)
@@ -575,19 +1169,11 @@ static int bwt_match_exact_alt(const bwt_t *bwt, int len, const ubyte_t *str, ui
 	return l - k + 1;
 }
 
-static char* convert_hit_to_string(const ubyte_t * seq, int len)
+static void get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint64_t l, lib_aln_search_ctx_t* ctx, uint64_t* numer_forward,
+										uint64_t* numer_rc)
 {
-	char* hit_pattern = calloc(len + 1, sizeof(char));
-	for (int j = 0; j < len; j++)
-		hit_pattern[j] = "ACGTN"[seq[j]];
-
-	hit_pattern[len] = '\0';
-	return hit_pattern;
-}
+	input_query* info_seq = &ctx->seq;
 
-static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint64_t l, input_query* info_seq, uint64_t* numer_forward,
-											uint64_t* numer_rc)
-{
 	//Current index of the SA, k<=t<=l
 	uint64_t t;
 
@@ -597,8 +1183,19 @@ static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint6
 	//Define if pos is the start position of the input patter inside the reference genome or the r.c of the input pattern
 	bool strand;
 
-	//Max number of occurrences of current hit found inside the reference
+	//Max number of occurrences of current hit found inside the reference, reduced by the limits of the query
 	uint64_t max_occ = l - k + 1;
+	uint32_t limit = 0;
+	if (ctx->limits.max_pos_per_hit && ctx->limits.max_pos_per_hit < max_occ)
+	{
+		max_occ = ctx->limits.max_pos_per_hit;
+		limit = LIMIT_POS_PER_HIT;
+	}
+	if (ctx->limits.max_total_pos && ctx->limits.max_total_pos - ctx->n_located < max_occ)
+	{
+		max_occ = ctx->limits.max_total_pos - ctx->n_located;
+		limit = LIMIT_TOTAL_POS;
+	}
 
 	//Same meaning of numer_forward and numer_rc
 	uint64_t n_f = 0;
@@ -608,38 +1205,51 @@ static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint6
 	 * Store all valid positions. The first n_f positions are relative to the forward of the current hit,
 	 * the last n_rc to the r.c.
 	 */
-	uint64_t* set_pos = (uint64_t*) malloc(max_occ * sizeof(uint64_t));
+	kv_reserve(uint64_t, ctx->sa_pos, max_occ);
+	uint64_t* set_pos = ctx->sa_pos.a;
 
 	if (verbose_bound_backtracking_search > 2)
 		fprintf(stderr, "Max_occ: %" PRIu64 "\n", max_occ);
 
-	for (t = k; t <= l; ++t)
+	//SA of the rows being analyzed, they are located together (see bwt_sa_batch)
+	uint64_t sa_rows[SA_BATCH_ROWS];
+
+	for (t = k; t <= l && n_f + n_rc < max_occ;)
 	{
-		//Calculate SA[t](base 1)
-		pos = bwa_sa2pos(idx->bns, idx->bwt, t, info_seq->len, &strand);
+		//Each row gives at most a position, so the rows after the max_occ-th position are not located
+		uint64_t n_rows = l - t + 1 < max_occ - n_f - n_rc ? l - t + 1 : max_occ - n_f - n_rc;
+		if (n_rows > SA_BATCH_ROWS)
+			n_rows = SA_BATCH_ROWS;
+		bwt_sa_batch(idx->bwt, t, t + n_rows - 1, sa_rows);
 
-		if (verbose_bound_backtracking_search > 2)
+		for (uint64_t j = 0; j < n_rows; ++j, ++t)
 		{
-			if (pos == ULLONG_MAX)
-				fprintf(stderr, "Position return by bwa_sa2pos is not valid\n");
-			else
-			{
-				fprintf(stderr, "Position return by bwa_sa2pos: %" PRIu64 "\n", pos);
-				fprintf(stderr, "Strand: %" PRIu8 "\n", strand);
-			}
-		}
-		//Check if pos is admissible
-		if (pos != ULLONG_MAX)
-		{
-			if (strand == 0)
+			//Calculate SA[t](base 1)
+			pos = bns_sa2pos(idx->bns, sa_rows[j], info_seq->len, &strand);
+
+			if (verbose_bound_backtracking_search > 2)
 			{
-				set_pos[n_f] = pos;
-				n_f++;
+				if (pos == ULLONG_MAX)
+					fprintf(stderr, "Position return by bwa_sa2pos is not valid\n");
+				else
+				{
+					fprintf(stderr, "Position return by bwa_sa2pos: %" PRIu64 "\n", pos);
+					fprintf(stderr, "Strand: %" PRIu8 "\n", strand);
+				}
 			}
-			else if ((strand == 1) && (info_seq->type_output == ALLOW_REV_COMP))
+			//Check if pos is admissible
+			if (pos != ULLONG_MAX)
 			{
-				set_pos[max_occ - n_rc - 1] = pos;
-				n_rc++;
+				if (strand == 0)
+				{
+					set_pos[n_f] = pos;
+					n_f++;
+				}
+				else if ((strand == 1) && (info_seq->type_output == ALLOW_REV_COMP))
+				{
+					set_pos[max_occ - n_rc - 1] = pos;
+					n_rc++;
+				}
 			}
 		}
 	}
@@ -647,23 +1257,30 @@ static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint6
 	//Number of valid positions found
 	uint64_t realSize = n_f + n_rc;
 
+	//Some index of the interval hasn't been analyzed
+	if (t <= l)
+		ctx->status |= limit;
+	ctx->n_located += realSize;
+
 	if (verbose_bound_backtracking_search > 2)
 	{
 		fprintf(stderr, "\nn_rc: %"PRIu64 "\n", n_rc);
 		fprintf(stderr, "n_f: %" PRIu64"\n", n_f);
 	}
+	*(numer_forward) = n_f;
+	*(numer_rc) = n_rc;
+
 	if ((n_rc == n_f) && (n_f == 0))
 	{
 		if (verbose_bound_backtracking_search > 2)
 			fprintf(stderr, "No hits have been added\n");
-		return 0;
+		return;
 	}
 	//Compact set_pos
 	if (n_f + n_rc < max_occ)
 	{
 		for (int i = 0; i < max_occ - realSize; i++)
 			set_pos[n_f + i] = set_pos[max_occ - i - 1];
-		set_pos = realloc(set_pos, realSize * sizeof(uint64_t));
 	}
 	if (verbose_bound_backtracking_search > 2)
 	{
@@ -671,58 +1288,96 @@ static uint64_t* get_pos_from_sa_interval(const bwaidx_t* idx, uint64_t k, uint6
 		for (int i = 0; i < realSize; i++)
 			printf("%" PRIu64 "\n", set_pos[i]);
 	}
+}
 
-	*(numer_forward) = n_f;
-	*(numer_rc) = n_rc;
+/*
+ * Store inside pos the next (at most n) valid positions of the SA interval of it, and inside is_rev_comp
+ * (if it's not NULL) their strand. The positions are checked as in get_pos_from_sa_interval, but they
+ * are returned in SA order (not sorted). Return the number of positions stored, 0 when the interval is ended.
+ */
+uint32_t pos_iter_next(lib_aln_pos_iter_t* it, uint64_t* pos, bool* is_rev_comp, uint32_t n)
+{
+	uint32_t n_pos = 0;
+	bool strand;
+	uint64_t sa_rows[SA_BATCH_ROWS];
+
+	while (it->t <= it->l && n_pos < n)
+	{
+		//Same of get_pos_from_sa_interval, the rows after the n-th position are not located
+		uint64_t n_rows = it->l - it->t + 1 < n - n_pos ? it->l - it->t + 1 : n - n_pos;
+		if (n_rows > SA_BATCH_ROWS)
+			n_rows = SA_BATCH_ROWS;
+		bwt_sa_batch(it->idx->bwt, it->t, it->t + n_rows - 1, sa_rows);
+
+		for (uint64_t j = 0; j < n_rows; ++j, ++it->t)
+		{
+			//Calculate SA[t](base 1)
+			uint64_t p = bns_sa2pos(it->idx->bns, sa_rows[j], it->len, &strand);
 
-	return set_pos;
+			//Check if p is admissible
+			if (p == ULLONG_MAX || (strand == 1 && it->type_output == NO_REV_COMP))
+				continue;
+
+			pos[n_pos] = p;
+			if (is_rev_comp)
+				is_rev_comp[n_pos] = strand;
+			n_pos++;
+		}
+	}
+	return n_pos;
 }
 
-//Same of gap_destroy_stack in bwtgap.c
+//Derived from gap_destroy_stack in bwtgap.c, the stack itself is part of the search context
 static void destroy_stack(stack_t *stack)
 {
 	int i;
-	for (i = 0; i != stack->n_sub_stacks; ++i)
+	for (i = 0; i != stack->m_sub_stacks; ++i)
 		free(stack->stacks[i].start_substack);
 	free(stack->stacks);
-	free(stack);
 }
 
-static void get_string_to_pos(const bwaidx_t *idx, input_query* info_seq, search_result* sr)
+static void get_string_to_pos(const bwaidx_t *idx, lib_aln_search_ctx_t* ctx, lib_aln_hit_t* h)
 {
+	input_query* info_seq = &ctx->seq;
+	uint64_t beg = ctx->ref_pos.a[h->pos_offset];
 	int64_t len = 0;
 
 	if (verbose_bound_backtracking_search > 2)
 	{
 		fprintf(stderr, "\nStart get_string_to_pos\n");
-		fprintf(stderr, "beg: %"PRIu64 "\n", sr->positions_to_ref[0]);
-		fprintf(stderr, "end: %"PRIu64 "\n", sr->positions_to_ref[0] + info_seq->len);
+		fprintf(stderr, "beg: %"PRIu64 "\n", beg);
+		fprintf(stderr, "end: %"PRIu64 "\n", beg + info_seq->len);
 	}
 
 	//Get string that start in position position_to_ref[0]
-	uint8_t* hit_code = bns_get_seq(idx->bns->l_pac, idx->pac, sr->positions_to_ref[0], sr->positions_to_ref[0] + info_seq->len, &len);
+	kv_reserve(uint8_t, ctx->hit_code, info_seq->len);
+	uint8_t* hit_code = ctx->hit_code.a;
+	len = bns_get_seq_core(idx->bns->l_pac, idx->pac, beg, beg + info_seq->len, hit_code);
 
-	if (sr->n_mismatches > 0)
+	h->diff_offset = ctx->diff_pos.n;
+	if (h->n_mismatches > 0)
 	{
+		kv_reserve(uint32_t, ctx->diff_pos, ctx->diff_pos.n + h->n_mismatches);
+		uint32_t* different_positions = ctx->diff_pos.a + ctx->diff_pos.n;
 		size_t num_different_pos_found = 0;
-		sr->different_positions = calloc(sr->n_mismatches, sizeof(uint32_t));
 
 		if (info_seq->len == len) //this must always be true..
 		{
 			//Check where the mismatches are
 			for (uint32_t j = 0; j < info_seq->len; ++j)
 			{
-				if ((sr->is_rev_comp == true) && (3 - hit_code[info_seq->len - j - 1] != 3 - info_seq->seq[info_seq->len - j - 1]))
+				if ((h->is_rev_comp == true) && (3 - hit_code[info_seq->len - j - 1] != 3 - info_seq->seq[info_seq->len - j - 1]))
 				{
-					sr->different_positions[num_different_pos_found] = j + 1; //base-1
+					different_positions[num_different_pos_found] = j + 1; //base-1
 					num_different_pos_found++;
 				}
-				else if ((sr->is_rev_comp == false) && (hit_code[j] != 3 - info_seq->seq[info_seq->len - j - 1]))
+				else if ((h->is_rev_comp == false) && (hit_code[j] != 3 - info_seq->seq[info_seq->len - j - 1]))
 				{
-					sr->different_positions[num_different_pos_found] = j + 1; //base-1
+					different_positions[num_different_pos_found] = j + 1; //base-1
 					num_different_pos_found++;
 				}
 			}
+			ctx->diff_pos.n += h->n_mismatches;
 		}
 		else //this must always be false..
 		{
@@ -730,15 +1385,54 @@ static void get_string_to_pos(const bwaidx_t *idx, input_query* info_seq, search
 			exit(EXIT_FAILURE);
 		}
 	}
-	else
-		sr->different_positions = NULL;
 
-	sr->hit = convert_hit_to_string(hit_code, len);
+	//Store the hit as a string terminated by '\0'
+	h->hit_offset = ctx->hit_str.n;
+	kv_reserve(char, ctx->hit_str, ctx->hit_str.n + len + 1);
+	for (int j = 0; j < len; j++)
+		ctx->hit_str.a[ctx->hit_str.n++] = "ACGTN"[hit_code[j]];
+	ctx->hit_str.a[ctx->hit_str.n++] = '\0';
 }
 
-//In the next version of software create a method for add a entry into rs.
-static void add_entry_to_result(const bwaidx_t* idx, search_result** rs, uint8_t n_mm, uint64_t n_f, uint64_t n_revC, uint64_t* pos,
-								input_query* info_seq, int* aln_n)
+//Add a hit in ctx->hits, pos are its n_pos positions
+static void add_hit(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint8_t n_mm, const uint64_t* pos, uint64_t n_pos, bool is_rev_comp)
+{
+	lib_aln_hit_t* h = kv_pushp(lib_aln_hit_t, ctx->hits);
+
+	h->pos_offset = ctx->ref_pos.n;
+	kv_reserve(uint64_t, ctx->ref_pos, ctx->ref_pos.n + n_pos);
+	memcpy(ctx->ref_pos.a + ctx->ref_pos.n, pos, n_pos * sizeof(uint64_t));
+	qsort(ctx->ref_pos.a + ctx->ref_pos.n, n_pos, sizeof(uint64_t), comp);
+	ctx->ref_pos.n += n_pos;
+
+	h->is_rev_comp = is_rev_comp;
+	h->num_occur = n_pos;
+	h->n_mismatches = n_mm;
+	ctx->counts.a[n_mm] += n_pos;
+	get_string_to_pos(idx, ctx, h);
+	ctx->n_hits_found++;
+
+	//The hit is passed to the callback and then removed, so the memory used doesn't grow with the number of hits
+	if (ctx->callback)
+	{
+		search_result sr;
+		fill_search_result(h, &sr, ctx->ref_pos.a, ctx->diff_pos.a, ctx->hit_str.a);
+
+		if (ctx->callback(&sr, ctx->callback_data) != 0)
+			ctx->stop_search = true;
+
+		ctx->ref_pos.n = h->pos_offset;
+		ctx->diff_pos.n = h->diff_offset;
+		ctx->hit_str.n = h->hit_offset;
+		ctx->hits.n--;
+	}
+}
+
+/*
+ * Add the hit(s) relative to the SA interval just analyzed: the first n_f positions inside ctx->sa_pos
+ * are relative to the forward, the next n_revC to the r.c.
+ */
+static void add_entry_to_result(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint8_t n_mm, uint64_t n_f, uint64_t n_revC)
 {
 	if (verbose_bound_backtracking_search > 2)
 		fprintf(stderr, "-> Inside add_entry_to_result\n");
@@ -748,19 +1442,9 @@ static void add_entry_to_result(const bwaidx_t* idx, search_result** rs, uint8_t
 		if (verbose_bound_backtracking_search > 2)
 			fprintf(stderr, "-Forward\n");
 
-		rs[*(aln_n)]->positions_to_ref = malloc(n_f * sizeof(uint64_t));
+		add_hit(idx, ctx, n_mm, ctx->sa_pos.a, n_f, false);
 
-		for (int i = 0; i < n_f; i++)
-			rs[*(aln_n)]->positions_to_ref[i] = pos[i];
-
-		qsort(rs[*(aln_n)]->positions_to_ref, n_f, sizeof(*rs[*(aln_n)]->positions_to_ref), comp);
-		rs[*(aln_n)]->is_rev_comp = false;
-		rs[*(aln_n)]->num_occur = n_f;
-		rs[*(aln_n)]->n_mismatches = n_mm;
-		get_string_to_pos(idx, info_seq, rs[*(aln_n)]);
-		*(aln_n) = *(aln_n) + 1;
-
-		if (info_seq->type_search == ARBITRARY_HIT)
+		if (ctx->seq.type_search == ARBITRARY_HIT || ctx->stop_search)
 			return;
 	}
 
@@ -769,17 +1453,117 @@ static void add_entry_to_result(const bwaidx_t* idx, search_result** rs, uint8_t
 		if (verbose_bound_backtracking_search > 2)
 			fprintf(stderr, "-Reverse complement\n");
 
-		rs[*(aln_n)]->positions_to_ref = malloc(n_revC * sizeof(uint64_t));
+		add_hit(idx, ctx, n_mm, ctx->sa_pos.a + n_f, n_revC, true);
+	}
+}
+
+/*
+ * Number of occurrences of the hit whose SA interval is [k,l], used by COUNT_ONLY.
+ * Each index of [k,l] is an occurrence inside the forward or inside the r.c. strand of the reference:
+ * with ALLOW_REV_COMP both are reported, so the SA is not used at all (the occurrences that
+ * bridge the two strands are found at the start of the search by find_bridging_occurrences).
+ * With NO_REV_COMP the strand of each occurrence is needed, so SA(j) is still calculated
+ * (like get_pos_from_sa_interval) under the same limits, but the positions are not stored.
+ */
+static uint64_t count_occurrences(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l)
+{
+	if (ctx->seq.type_output == ALLOW_REV_COMP)
+	{
+		uint64_t n = l - k + 1;
+		for (size_t i = 0; i < ctx->bridging.n; i++)
+			n -= ctx->bridging.a[i] == k;
+		return n;
+	}
+
+	//Max number of indexes of [k,l] located, each of them is counted as a located position
+	uint64_t max_rows = l - k + 1;
+	uint32_t limit = 0;
+	if (ctx->limits.max_pos_per_hit && ctx->limits.max_pos_per_hit < max_rows)
+	{
+		max_rows = ctx->limits.max_pos_per_hit;
+		limit = LIMIT_POS_PER_HIT;
+	}
+	if (ctx->limits.max_total_pos && ctx->limits.max_total_pos - ctx->n_located < max_rows)
+	{
+		max_rows = ctx->limits.max_total_pos - ctx->n_located;
+		limit = LIMIT_TOTAL_POS;
+	}
+
+	const uint64_t end = k + max_rows;
+	uint64_t n_f = 0, t;
+	bool strand;
+	uint64_t sa_rows[SA_BATCH_ROWS];
+	for (t = k; t < end;)
+	{
+		if (ctx->deadline > 0 && search_ctx_check_deadline(ctx))
+			break;
+
+		uint64_t n_rows = end - t < SA_BATCH_ROWS ? end - t : SA_BATCH_ROWS;
+		bwt_sa_batch(idx->bwt, t, t + n_rows - 1, sa_rows);
+		for (uint64_t j = 0; j < n_rows; ++j, ++t)
+			if (bns_sa2pos(idx->bns, sa_rows[j], ctx->seq.len, &strand) != ULLONG_MAX && strand == 0)
+				n_f++;
+	}
+
+	//Some index of the interval hasn't been analyzed
+	if (t == end && t <= l)
+		ctx->status |= limit;
+	ctx->n_located += t - k;
+
+	return n_f;
+}
+
+/*
+ * The FMD-index is built on the forward strand followed by the r.c. strand, so the SA interval of a hit
+ * also contains the occurrences that start inside the forward strand and end inside the r.c. one.
+ * bwa_sa2pos discards them, so COUNT_ONLY with ALLOW_REV_COMP must discard them too: they are the len - 1 strings
+ * that contain the end of the forward strand, so they are extracted from the last len - 1 bases of the reference
+ * (instead of calculating SA(j) for each index of the intervals). The ones that are hits are stored inside
+ * ctx->bridging as the first index of their SA interval, and count_occurrences removes them only from the interval
+ * that contains them, so the counts are right also when a limit stops the search before some interval.
+ */
+static void find_bridging_occurrences(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	input_query* info_seq = &ctx->seq;
+	int64_t l_pac = idx->bns->l_pac;
+	int64_t len = info_seq->len;
+
+	ctx->bridging.n = 0;
+	if (info_seq->type_search != COUNT_ONLY || info_seq->type_output != ALLOW_REV_COMP)
+		return;
+
+	//Last n_tail bases of the forward strand, the r.c. strand starts with their r.c.
+	int64_t n_tail = len - 1 < l_pac ? len - 1 : l_pac;
+	if (n_tail <= 0)
+		return;
+
+	kv_reserve(uint8_t, ctx->hit_code, n_tail + len);
+	uint8_t* tail = ctx->hit_code.a;
+	uint8_t* occ = ctx->hit_code.a + n_tail;
+	bns_get_seq_core(l_pac, idx->pac, l_pac - n_tail + 1, l_pac + 1, tail);
+
+	//Occurrence that starts o bases before the end of the forward strand
+	for (int64_t o = 1; o <= n_tail; o++)
+	{
+		//It must end inside the r.c. strand
+		if (len - o > n_tail)
+			continue;
 
-		for (int i = n_f; i < n_f + n_revC; i++)
-			rs[*(aln_n)]->positions_to_ref[i - n_f] = pos[i];
+		int n_mm = 0;
+		for (int64_t j = 0; j < len; j++)
+		{
+			occ[j] = j < o ? tail[n_tail - o + j] : 3 - tail[n_tail - 1 - (j - o)];
+			n_mm += (occ[j] != info_seq->seq[j]);
+		}
 
-		qsort(rs[*(aln_n)]->positions_to_ref, n_revC, sizeof(*rs[*(aln_n)]->positions_to_ref), comp);
-		rs[*(aln_n)]->is_rev_comp = true;
-		rs[*(aln_n)]->num_occur = n_revC;
-		rs[*(aln_n)]->n_mismatches = n_mm;
-		get_string_to_pos(idx, info_seq, rs[*(aln_n)]);
-		*(aln_n) = *(aln_n) + 1;
+		//It's a hit, so its SA interval will be counted by count_occurrences
+		uint64_t k = 0, l = idx->bwt->seq_len;
+		if (n_mm <= info_seq->max_diff && bwt_match_exact_alt(idx->bwt, len, occ, &k, &l))
+		{
+			if (verbose_bound_backtracking_search > 2)
+				fprintf(stderr, "Remove the occurrence that bridges the two strands at %" PRId64 "\n", l_pac - o);
+			kv_push(uint64_t, ctx->bridging, k);
+		}
 	}
 }
 
@@ -820,27 +1604,40 @@ static int comp(const void * elem1, const void * elem2)
 		return 0;
 	return *(uint64_t*) elem1 < *(uint64_t*) elem2 ? -1 : 1;
 }
-//To improve
-void controlParam(const bwaidx_t *idx, const char* pattern_input, const uint8_t type_search, const uint8_t type_output)
+/*
+ * Check that the input parameters are valid.
+ * It doesn't terminate the process, so it can be called concurrently by several threads:
+ * return 0 if the parameters are legal, -1 otherwise.
+ */
+int controlParam(const bwaidx_t *idx, const char* pattern_input, const uint8_t type_search, const uint8_t type_output)
 {
+	//The engine flags don't change the type of search
+	const uint8_t type = type_search & ~ENGINE_FLAGS;
+
 	if (idx == 0)
 	{
 		fprintf(stderr, "Miss index.\n");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 	else if (pattern_input == 0)
 	{
 		fprintf(stderr, "Miss pattern to search.\n");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
-	else if ((type_search != ARBITRARY_HIT) && (type_search != ALL_HITS))
+	else if ((type != ARBITRARY_HIT) && (type != ALL_HITS) && (type != COUNT_ONLY) && (type != ALL_BEST_HIT) && (type != UNIQUE_BEST_HIT))
 	{
 		fprintf(stderr, "type_search not legal.\n");
-		exit(EXIT_FAILURE);
+		return -1;
+	}
+	else if ((type_search & ENGINE_FLAGS) == ENGINE_FLAGS)
+	{
+		fprintf(stderr, "Only one engine can be selected.\n");
+		return -1;
 	}
 	else if ((type_output != ALLOW_REV_COMP) && (type_output != NO_REV_COMP))
 	{
-		fprintf(stderr, "type_search not legal.\n");
-		exit(EXIT_FAILURE);
+		fprintf(stderr, "type_output not legal.\n");
+		return -1;
 	}
+	return 0;
 }
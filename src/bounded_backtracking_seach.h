@@ -28,6 +28,10 @@
 
 #include "occ.h"
 #include "sa.h"
+#include "kvec.h"
+#include "search_scheme.h"
+#include "seed_verify.h"
+#include "trie_batch.h"
 
 #ifndef BWAIDX_T
 #define BWAIDX_T
@@ -37,6 +41,10 @@ typedef struct
 	bwt_t *bwt; // FM-index
 	bntseq_t *bns; // information on the reference sequences
 	uint8_t *pac; // the actual 2-bit encoded reference sequences with 'N' converted to a random base
+	uint64_t pac_map_len; // if it isn't 0, pac is the mapping of the .pac file
+	// if it isn't NULL, the arrays of the index are inside image (shared memory or packed index, see index_image.c)
+	void *image;
+	uint64_t image_len;
 } bwaidx_t;
 
 #endif
@@ -47,11 +55,22 @@ typedef struct
 
 #define ARBITRARY_HIT 0x0
 #define ALL_HITS 0x1
-//#define UNIQUE_BEST_HIT[TO DO]
-//#define ALL_BEST_HIT[TO DO]
+#define COUNT_ONLY 0x2
+#define ALL_BEST_HIT 0x3
+#define UNIQUE_BEST_HIT 0x4
+
+//Flags that can be added to the type of search to select the engine used instead of the backtracking (only one)
+#define SEARCH_SCHEME 0x80 //bidirectional search schemes
+#define SEED_AND_VERIFY 0x40 //exact seeds verified on the reference
 
 #endif
 
+//Flags that select the engine
+#define ENGINE_FLAGS (SEARCH_SCHEME | SEED_AND_VERIFY)
+
+//Limits that stop the search, the other ones only truncate a hit
+#define LIMIT_STOP_FLAGS (LIMIT_TOTAL_POS | LIMIT_EXPANSIONS | LIMIT_DEADLINE)
+
 //TYPE_OUTPUT
 #ifndef TYPE_OUTPUT_
 #define TYPE_OUTPUT_
@@ -64,7 +83,7 @@ typedef struct
 typedef struct
 {
 	ubyte_t *seq;
-	uint32_t len :20, type_search :1, type_output :1;
+	uint32_t len :20, type_search :3, type_output :1, only_intervals :1, search_scheme :1, seed_verify :1;
 	uint8_t max_diff;
 } input_query;
 
@@ -79,6 +98,7 @@ typedef struct
 	uint32_t info; //i
 	uint8_t n_mm :8;
 	int last_diff_pos;
+	uint32_t key; //code of [i,n-1] inside the k-mer table, only if it's shorter than the strings of the table
 	uint64_t k, l; // (k,l) is the SA region of [i,n-1]
 } entry_t;
 
@@ -91,6 +111,7 @@ typedef struct
 typedef struct
 {
 	int n_sub_stacks, best, n_entries;
+	int m_sub_stacks; //allocated substacks, they are kept between two searches
 	substack_t *stacks;
 } stack_t;
 
@@ -109,21 +130,271 @@ typedef struct
 
 #endif
 
+#ifndef LIB_ALN_HIT_CALLBACK_T
+#define LIB_ALN_HIT_CALLBACK_T
+
+/*
+ * Called for each hit as soon as it's found. The hit and its arrays are valid only during the call.
+ * Return 0 to continue the search, any other value to stop it.
+ */
+typedef int (*lib_aln_hit_callback_t)(const search_result* hit, void* data);
+
+#endif
+
+//Guarantee that the vector v can store at least s elements (see kvec.h)
+#define kv_reserve(type, v, s) do {									\
+		if ((v).m < (s)) {											\
+			(v).m = (s) + ((s) >> 1) + 4;							\
+			(v).a = (type*)realloc((v).a, sizeof(type) * (v).m);	\
+		}															\
+	} while (0)
+
+#ifndef LIB_ALN_HIT_T
+#define LIB_ALN_HIT_T
+
+//A hit inside a result set. The offsets refer to the arrays of the result set, so they don't depend on its address.
+typedef struct
+{
+	uint64_t pos_offset; //first position of the hit inside the positions of the set
+	uint64_t diff_offset; //first different position of the hit inside the different positions of the set
+	uint64_t hit_offset; //first character of the hit inside the characters of the set
+	uint32_t num_occur;
+	uint8_t n_mismatches;
+	bool is_rev_comp;
+} lib_aln_hit_t;
+
+#endif
+
+#ifndef LIB_ALN_SA_INTERVAL_T
+#define LIB_ALN_SA_INTERVAL_T
+
+/*
+ * SA interval [k,l] of a hit with n_mismatches mismatches. Its positions are not calculated:
+ * each index of [k,l] is an occurrence inside the forward or the r.c. strand of the reference,
+ * len and type_output are needed to locate it (see lib_aln_pos_iter_t).
+ */
+typedef struct
+{
+	uint64_t k, l;
+	uint32_t len; //length of the pattern
+	uint8_t n_mismatches;
+	uint8_t type_output; //ALLOW_REV_COMP or NO_REV_COMP, with NO_REV_COMP the occurrences inside the r.c. strand are skipped
+} lib_aln_sa_interval_t;
+
+#endif
+
+#ifndef LIB_ALN_POS_ITER_T
+#define LIB_ALN_POS_ITER_T
+
+//Calculate on demand the positions of a SA interval, see lib_aln_pos_iter_init
+typedef struct
+{
+	const bwaidx_t *idx;
+	uint64_t t, l; //[t,l] are the indexes of the interval not yet located
+	uint32_t len;
+	uint8_t type_output;
+} lib_aln_pos_iter_t;
+
+#endif
+
+#ifndef LIB_ALN_RESULT_SET_T
+#define LIB_ALN_RESULT_SET_T
+
+/*
+ * Results of a search stored inside a single contiguous block of memory of size bytes:
+ * the header is followed by the hits and by the arrays that they refer to.
+ * The block doesn't contain pointers, so it can be copied, written to file or shared with other processes.
+ */
+typedef struct
+{
+	uint64_t size; //size in bytes of the whole block
+	uint32_t n_hits;
+	uint32_t hits_offset; //offset in bytes of the array of n_hits lib_aln_hit_t
+	uint64_t n_positions, positions_offset; //array of uint64_t, positions of all hits
+	uint64_t n_diff, diff_offset; //array of uint32_t, different positions of all hits
+	uint64_t n_chars, chars_offset; //characters of all hits, each hit is terminated by '\0'
+	uint64_t n_counts, counts_offset; //array of uint64_t, counts[i] is the number of occurrences with i mismatches
+	uint64_t n_intervals, intervals_offset; //array of lib_aln_sa_interval_t, filled only by lib_aln_bound_backtracking_sa
+	uint32_t status; //limits reached by the search (LIMIT_* flags), 0 if the results are complete
+} lib_aln_result_set_t;
+
+#endif
+
+#ifndef LIB_ALN_LIMITS_T
+#define LIB_ALN_LIMITS_T
+
+//Limits of each query of a search context (0 means no limit), see lib_aln_search_ctx_set_limits
+typedef struct
+{
+	uint64_t max_pos_per_hit; //max positions located for each SA interval of a hit
+	uint64_t max_total_pos; //max positions located by the query
+	uint64_t max_expansions; //max partial hits extended by the query
+	double max_seconds; //max wall-clock time of the query
+} lib_aln_limits_t;
+
+//Status of a search: the limits reached, so the results are only a part of the hits
+#define LIMIT_POS_PER_HIT 0x1
+#define LIMIT_TOTAL_POS 0x2
+#define LIMIT_EXPANSIONS 0x4
+#define LIMIT_DEADLINE 0x8
+#define LIMIT_NO_CTX 0x10 //returned by lib_aln_search_ctx_status without a context
+
+#endif
+
+#ifndef LIB_ALN_SEARCH_CTX_T
+#define LIB_ALN_SEARCH_CTX_T
+
+typedef struct lib_aln_search_ctx_s lib_aln_search_ctx_t;
+
+#endif
+
+//Entry of the cache of the extensions: [ext_k[c],ext_l[c]] is the SA interval of c followed by the string of [k,l]
+typedef struct
+{
+	uint64_t k, l;
+	uint64_t ext_k[4], ext_l[4];
+} cache_entry_t;
+
+/*
+ * Everything a search needs. All the buffers only grow, so when the context is reused
+ * for queries of similar length the search does not allocate memory.
+ */
+struct lib_aln_search_ctx_s
+{
+	input_query seq; //seq.seq is the encoded pattern, it has m_seq elements
+	uint32_t m_seq;
+
+	stack_t stack;
+
+	bwt_width_t* width; //m_width elements
+	uint32_t m_width;
+
+	kvec_t(uint64_t) sa_pos; //positions of the SA interval currently analyzed
+	kvec_t(uint8_t) hit_code; //hit currently analyzed, extracted from the reference
+
+	//Results of the last search
+	kvec_t(lib_aln_hit_t) hits;
+	kvec_t(uint64_t) ref_pos;
+	kvec_t(uint32_t) diff_pos;
+	kvec_t(char) hit_str;
+	kvec_t(uint64_t) counts; //max_diff + 1 elements, occurrences found for each number of mismatches
+	kvec_t(uint64_t) bridging; //COUNT_ONLY with ALLOW_REV_COMP: k of the SA interval of each hit that bridges the two strands
+	kvec_t(lib_aln_sa_interval_t) intervals; //SA intervals of the hits, only if seq.only_intervals
+	uint32_t n_hits_found; //hits found by the last search, also the ones passed to callback
+	int best_mm; //mismatches of the best hits found by the last search (only ALL_BEST_HIT and UNIQUE_BEST_HIT), -1 if none
+
+	//If callback is set, each hit is passed to it and then discarded (see search_ctx_set_callback)
+	lib_aln_hit_callback_t callback;
+	void* callback_data;
+	bool stop_search; //callback asked to stop the search
+
+	//Used only by the search schemes, see search_scheme.c
+	kvec_t(scheme_step_t) scheme_steps;
+	kvec_t(scheme_entry_t) scheme_stack;
+	kvec_t(scheme_hit_t) scheme_hits;
+
+	//Used only by the seed and verify engine, see seed_verify.c
+	kvec_t(uint64_t) seed_words; //pattern and its r.c. packed as the pac, followed by the masks of their N
+	kvec_t(uint64_t) seed_cand; //candidate start positions of the hits
+	kvec_t(seed_hit_t) seed_hits;
+	kvec_t(uint8_t) seed_str; //strings of seed_hits
+
+	/*
+	 * Optional cache of the extensions calculated by the backtracking, it's kept between the searches
+	 * (see search_ctx_set_cache). It has cache_mask + 1 entries and it's valid only for the BWT cache_bwt.
+	 */
+	cache_entry_t* cache;
+	uint64_t cache_mask;
+	const bwt_t* cache_bwt;
+	uint64_t cache_hits, cache_misses;
+
+	//Limits of each query (see search_ctx_set_limits) and their state for the last search
+	lib_aln_limits_t limits;
+	uint32_t status; //LIMIT_* flags of the limits reached
+	uint64_t n_expansions, n_located;
+	double deadline; //see now_seconds, 0 if there isn't a deadline
+
+	//Views of the results returned to the user, see search_ctx_results and search_ctx_result_set
+	kvec_t(search_result) sr;
+	kvec_t(search_result*) returnM;
+	kvec_t(uint64_t) arena;
+};
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-	void controlParam(const bwaidx_t *idx, const char* pattern_input, const uint8_t type_search, const uint8_t type_output);
+	int controlParam(const bwaidx_t *idx, const char* pattern_input, const uint8_t type_search, const uint8_t type_output);
+
+	void create_pattern_to_search(const char* pattern_input, const size_t pattern_len, uint8_t* pattern_to_search);
+
+	lib_aln_search_ctx_t* search_ctx_init(void);
+
+	void search_ctx_destroy(lib_aln_search_ctx_t* ctx);
+
+	void search_ctx_prepare(lib_aln_search_ctx_t* ctx, const char* pattern_input, const size_t pattern_len, const uint8_t nmismatch,
+							const uint8_t type_search, const uint8_t type_output, const bool only_intervals);
+
+	uint32_t get_approximate_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+
+	void get_approximate_match_interleaved(const bwaidx_t* idx, lib_aln_search_ctx_t** ctx, int n);
+
+	search_result** search_ctx_results(lib_aln_search_ctx_t* ctx);
+
+	uint64_t search_ctx_result_set_size(const lib_aln_search_ctx_t* ctx);
+
+	void search_ctx_pack_result_set(const lib_aln_search_ctx_t* ctx, lib_aln_result_set_t* rs);
+
+	const lib_aln_result_set_t* search_ctx_result_set(lib_aln_search_ctx_t* ctx);
 
-	input_query* init_bwt_seq(uint8_t* pattern_to_search, const size_t pattern_len, const uint8_t nmismatch, const uint8_t type_search,
-								const uint8_t type_output);
+	search_result** search_ctx_copy_results(const lib_aln_search_ctx_t* ctx);
 
-	uint8_t* create_pattern_to_search(const char* pattern_input, const size_t pattern_len);
+	int search_ctx_set_cache(lib_aln_search_ctx_t* ctx, uint32_t n_entries);
+	void search_ctx_set_limits(lib_aln_search_ctx_t* ctx, const lib_aln_limits_t* limits);
+	bool search_ctx_check_deadline(lib_aln_search_ctx_t* ctx);
+	void search_ctx_set_callback(lib_aln_search_ctx_t* ctx, lib_aln_hit_callback_t callback, void* data);
 
-	search_result** get_approximate_match(const bwaidx_t* idx, input_query* info_seq, uint32_t* numHit);
+	uint32_t pos_iter_next(lib_aln_pos_iter_t* it, uint64_t* pos, bool* is_rev_comp, uint32_t n);
+
+	int cal_width(const bwt_t *bwt, int len, const ubyte_t *str, bwt_width_t *width);
+	int bwt_match_exact_alt(const bwt_t *bwt, int len, const ubyte_t *str, uint64_t *k0, uint64_t *l0);
+
+	bool search_ctx_report_hit(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint64_t k, uint64_t l, int n_mm);
+	uint32_t search_ctx_report_hits(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, const scheme_hit_t* hits, size_t n_hits);
+
+	//In search_scheme.c
+	void search_scheme_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+
+	//In seed_verify.c
+	void seed_verify_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+
+	//In trie_batch.c
+	trie_batch_t* trie_batch_init(const uint32_t n_patterns);
+	void trie_batch_destroy(trie_batch_t* t);
+	void trie_batch_add(trie_batch_t* t, const uint32_t id, const ubyte_t* seq, const uint32_t len, const bwt_width_t* width);
+	void trie_batch_match(const bwaidx_t* idx, trie_batch_t* t, const int max_diff);
+	const scheme_hit_t* trie_batch_hits(const trie_batch_t* t, const uint32_t id, size_t* n_hits);
 #ifdef __cplusplus
 }
 #endif
 
+/*
+ * Count an expansion of a partial hit of the current query. Return true if the query must be stopped: it reached
+ * a limit that stops the search, the max number of expansions or its deadline (checked every 256 expansions)
+ */
+static inline bool search_ctx_expand(lib_aln_search_ctx_t* ctx)
+{
+	if (ctx->status & LIMIT_STOP_FLAGS)
+		return true;
+
+	++ctx->n_expansions;
+	if (ctx->limits.max_expansions && ctx->n_expansions > ctx->limits.max_expansions)
+	{
+		ctx->status |= LIMIT_EXPANSIONS;
+		return true;
+	}
+	return ctx->deadline > 0 && (ctx->n_expansions & 255) == 0 && search_ctx_check_deadline(ctx);
+}
+
 #endif
@@ -53,7 +53,11 @@ static void bwt_bwtupdate_core(bwt_t *bwt);
 static int bwa_bwtupdate(int argc, char *argv[]);
 static int bwa_bwt2sa(int argc, char *argv[]);
 
-int fmd_idx_build(const char *fa, const char *prefix, int algo_type, int block_size)
+/*
+ * sa_intv is the interval of the samples of the suffix array (a power of 2): bwt_sa needs on average sa_intv - 1 steps
+ * of the LF-mapping for each position (at most sa_intv - 1 if sa_text, see bwt_cal_sa_text).
+ */
+int fmd_idx_build(const char *fa, const char *prefix, int algo_type, int block_size, int sa_intv, int sa_text)
 {
 	extern void bwa_pac_rev_core(const char *fn, const char *fn_rev);
 
@@ -110,7 +114,10 @@ int fmd_idx_build(const char *fa, const char *prefix, int algo_type, int block_s
 		strcpy(str3, prefix);
 		strcat(str3, ".sa");
 		bwt = bwt_restore_bwt(str);
-		bwt_cal_sa(bwt, 32);
+		if (sa_text)
+			bwt_cal_sa_text(bwt, sa_intv);
+		else
+			bwt_cal_sa(bwt, sa_intv);
 		bwt_dump_sa(str3, bwt);
 		bwt_destroy(bwt);
 	}
@@ -136,9 +143,16 @@ static void bwt_dump_sa(const char *fn, const bwt_t *bwt)
 	fp = xopen(fn, "wb");
 	err_fwrite(&bwt->primary, sizeof(uint64_t), 1, fp);
 	err_fwrite(bwt->L2 + 1, sizeof(uint64_t), 4, fp);
-	err_fwrite(&bwt->sa_intv, sizeof(uint64_t), 1, fp);
+	uint64_t sa_intv = bwt->sa_intv | (bwt->sa_rank ? SA_TEXT_ORDER : 0);
+	err_fwrite(&sa_intv, sizeof(uint64_t), 1, fp);
 	err_fwrite(&bwt->seq_len, sizeof(uint64_t), 1, fp);
-	err_fwrite(bwt->sa + 1, sizeof(uint64_t), bwt->n_sa - 1, fp);
+	if (bwt->sa_rank) // the marks of the rows and then the values (see bwt_cal_sa_text)
+	{
+		err_fwrite(bwt->sa_rank, sizeof(uint64_t), sa_rank_words(bwt->seq_len), fp);
+		err_fwrite(bwt->sa, sizeof(uint64_t), sa_val_words(bwt->n_sa, bwt->sa_width), fp);
+	}
+	else
+		err_fwrite(bwt->sa + 1, sizeof(uint64_t), bwt->n_sa - 1, fp);
 	err_fflush(fp);
 	err_fclose(fp);
 }
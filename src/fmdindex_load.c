@@ -24,9 +24,14 @@
  */
 
 #include "fmdindex_load.h"
+#include "sa.h"
 
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "kseq.h"
 KSEQ_DECLARE(gzFile)
@@ -34,8 +39,17 @@ KSEQ_DECLARE(gzFile)
 #include "khash.h"
 KHASH_MAP_INIT_STR(str, int)
 
-static void bwt_gen_cnt_table(bwt_t *bwt);
-static void bwt_restore_sa(const char *fn, bwt_t *bwt);
+#define PREAD_CHUNK 0x1000000 // 16M block
+
+//32-bit words of the BWT of seq_len bases with the occurrences every OCC_INTERVAL bases (see bwt_bwtupdate_core)
+#define bwt_file_words(seq_len) ((((seq_len) + 15) >> 4) + (((seq_len) + OCC_INTERVAL - 1) / OCC_INTERVAL + 1) * sizeof(uint64_t))
+
+//In kthread.c
+void kt_for(int n_threads, void (*func)(void*, long, int), void *data, long n);
+
+static int bwt_restore_sa(const char *fn, bwt_t *bwt, idx_read_t *rd);
+static int bwt_map_sa(const char *fn, bwt_t *bwt, int flags);
+static void bns_destroy(bntseq_t *bns);
 
 char *bwa_idx_infer_prefix(const char *hint)
 {
@@ -71,43 +85,109 @@ char *bwa_idx_infer_prefix(const char *hint)
 	}
 }
 
-uint64_t fread_fix(FILE *fp, uint64_t size, void *a)
-{ // Mac/Darwin has a bug when reading data longer than 2GB. This function fixes this issue by reading data in small chunks
-	const int bufsize = 0x1000000; // 16M block
-	uint64_t offset = 0;
-	while (size)
+typedef struct
+{
+	int fd;
+	uint64_t offset, size;
+	uint8_t *a;
+	idx_read_t *rd;
+	int err; // errno of the first failed read, -1 for the end of the file
+} pread_job_t;
+
+static void pread_worker(void *data, long i, int tid)
+{
+	pread_job_t *j = (pread_job_t*) data;
+	uint64_t beg = (uint64_t) i * PREAD_CHUNK;
+	uint64_t end = beg + PREAD_CHUNK < j->size ? beg + PREAD_CHUNK : j->size;
+	while (beg < end && j->err == 0)
 	{
-		int x = bufsize < size ? bufsize : size;
-		if ((x = err_fread_noeof(a + offset, 1, x, fp)) == 0)
+		ssize_t x = pread(j->fd, j->a + beg, end - beg, j->offset + beg);
+		if (x < 0 && errno == EINTR)
+			continue;
+		if (x <= 0)
+		{
+			j->err = x < 0 ? errno : -1;
 			break;
-		size -= x;
-		offset += x;
+		}
+		beg += x;
+		if (j->rd)
+			__atomic_fetch_add(&j->rd->n_read, (uint64_t) x, __ATOMIC_RELAXED);
 	}
-	return offset;
+}
+
+/*
+ * Read size bytes of the file fd starting from offset, in blocks like fread_fix of bwt.c, but the blocks are read with pread
+ * by rd->n_threads threads (one thread if rd is NULL): a single thread doesn't use all the bandwidth of the NVMe disks.
+ * The bytes read are added to rd->n_read while the reading goes on. Return 0 on success, -1 if the file can't be read.
+ */
+int pread_fix(int fd, uint64_t offset, uint64_t size, void *a, idx_read_t *rd)
+{
+	pread_job_t j = { fd, offset, size, (uint8_t*) a, rd, 0 };
+	int n_threads = rd && rd->n_threads > 1 ? rd->n_threads : 1;
+	long n_blocks = (size + PREAD_CHUNK - 1) / PREAD_CHUNK;
+	kt_for(n_threads < n_blocks ? n_threads : n_blocks, pread_worker, &j, n_blocks);
+	if (j.err != 0)
+	{
+		fprintf(stderr, "[E::%s] %s\n", __func__, j.err < 0 ? "Unexpected end of file" : strerror(j.err));
+		return -1;
+	}
+	return 0;
 }
 
 bwt_t *bwt_restore_bwt(const char *fn)
+{
+	bwt_t *bwt = bwt_restore_bwt_par(fn, 0);
+	if (bwt == 0)
+		err_fatal(__func__, "fail to read %s", fn);
+	return bwt;
+}
+
+/*
+ * Same of bwt_restore_bwt, the BWT is read by rd->n_threads threads (see pread_fix).
+ * Return NULL if the file can't be read, instead of terminating the process.
+ */
+bwt_t *bwt_restore_bwt_par(const char *fn, idx_read_t *rd)
 {
 	bwt_t *bwt;
 	FILE *fp;
+	struct stat st;
 
+	if ((fp = fopen(fn, "rb")) == 0 || fstat(fileno(fp), &st) != 0)
+	{
+		fprintf(stderr, "[E::%s] fail to open %s: %s\n", __func__, fn, strerror(errno));
+		if (fp)
+			fclose(fp);
+		return 0;
+	}
 	bwt = (bwt_t*) calloc(1, sizeof(bwt_t));
-	fp = xopen(fn, "rb");
-	err_fseek(fp, 0, SEEK_END);
-	bwt->bwt_size = (err_ftell(fp) - sizeof(uint64_t) * 5) >> 2;
+	bwt->bwt_size = (uint64_t) st.st_size < sizeof(uint64_t) * 5 ? 0 : (st.st_size - sizeof(uint64_t) * 5) >> 2;
 	bwt->bwt = (uint32_t*) calloc(bwt->bwt_size, 4);
-	err_fseek(fp, 0, SEEK_SET);
-	err_fread_noeof(&bwt->primary, sizeof(uint64_t), 1, fp);
-	err_fread_noeof(bwt->L2 + 1, sizeof(uint64_t), 4, fp);
-	fread_fix(fp, bwt->bwt_size << 2, bwt->bwt);
+	if (fread(&bwt->primary, sizeof(uint64_t), 1, fp) != 1 || fread(bwt->L2 + 1, sizeof(uint64_t), 4, fp) != 4)
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, fn);
+		fclose(fp);
+		bwt_destroy(bwt);
+		return 0;
+	}
+	if (pread_fix(fileno(fp), sizeof(uint64_t) * 5, bwt->bwt_size << 2, bwt->bwt, rd) != 0)
+	{
+		fclose(fp);
+		bwt_destroy(bwt);
+		return 0;
+	}
 	bwt->seq_len = bwt->L2[4];
-	err_fclose(fp);
+	fclose(fp);
 	bwt_gen_cnt_table(bwt);
 
 	return bwt;
 }
 
-bwt_t *bwa_idx_load_bwt(const char *hint)
+/*
+ * If flags contains IDX_LAZY_SA, the .sa file is mapped (see bwt_map_sa) instead of read: its pages are read
+ * by the first calls of bwt_sa that use them, so the searches that don't locate the hits never read it.
+ * The files are read by rd->n_threads threads (see pread_fix).
+ */
+bwt_t *bwa_idx_load_bwt(const char *hint, int flags, idx_read_t *rd)
 {
 	char *tmp, *prefix;
 	bwt_t *bwt;
@@ -119,13 +199,120 @@ bwt_t *bwa_idx_load_bwt(const char *hint)
 	}
 	tmp = calloc(strlen(prefix) + 5, 1);
 	strcat(strcpy(tmp, prefix), ".bwt"); // FM-index
-	bwt = bwt_restore_bwt(tmp);
+	bwt = bwt_restore_bwt_par(tmp, rd);
+	if (bwt != 0 && bwt->bwt_size < bwt_file_words(bwt->seq_len)) // the occurrences are read by bwt_occ_align
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, tmp);
+		bwt_destroy(bwt);
+		bwt = 0;
+	}
+	strcat(strcpy(tmp, prefix), ".sa");  // partial suffix array (SA)
+	if (bwt != 0 && (flags & IDX_LAZY_SA ? bwt_map_sa(tmp, bwt, 0) : bwt_restore_sa(tmp, bwt, rd)) != 0)
+	{
+		bwt_destroy(bwt);
+		bwt = 0;
+	}
+	free(tmp);
+	free(prefix);
+	return bwt;
+}
+/*
+ * Same of bwa_idx_load_bwt, but the .bwt and .sa files are mapped read-only instead of read (see map_file):
+ * the occurrences keep the blocks of OCC_INTERVAL bases of the .bwt file.
+ */
+bwt_t *bwa_idx_map_bwt(const char *hint, int flags)
+{
+	char *tmp, *prefix;
+	bwt_t *bwt;
+	prefix = bwa_idx_infer_prefix(hint);
+	if (prefix == 0)
+	{
+		fprintf(stderr, "[E::%s] fail to locate the index files\n", __func__);
+		return 0;
+	}
+	tmp = calloc(strlen(prefix) + 5, 1);
+	strcat(strcpy(tmp, prefix), ".bwt"); // FM-index
+	bwt = bwt_map_bwt(tmp, flags);
 	strcat(strcpy(tmp, prefix), ".sa");  // partial suffix array (SA)
-	bwt_restore_sa(tmp, bwt);
+	if (bwt != 0 && bwt_map_sa(tmp, bwt, flags) != 0)
+	{
+		bwt_destroy(bwt);
+		bwt = 0;
+	}
 	free(tmp);
 	free(prefix);
 	return bwt;
 }
+
+/*
+ * Map read-only the whole file fn, its length is stored inside len. The pages are shared with the page cache,
+ * so the processes that map the same index use the same memory. flags are the IDX_MMAP_* flags.
+ * Return NULL if the file can't be mapped.
+ */
+void *map_file(const char *fn, uint64_t *len, int flags)
+{
+	struct stat st;
+	int fd = open(fn, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		fprintf(stderr, "[E::%s] fail to open %s: %s\n", __func__, fn, fd < 0 ? strerror(errno) : "empty file");
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if (flags & IDX_MMAP_POPULATE)
+		map_flags |= MAP_POPULATE;
+#endif
+	void *p = mmap(0, st.st_size, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr, "[E::%s] fail to map %s: %s\n", __func__, fn, strerror(errno));
+		return 0;
+	}
+	if (flags & IDX_MMAP_WILLNEED)
+		madvise(p, st.st_size, MADV_WILLNEED);
+
+	*len = st.st_size;
+	return p;
+}
+
+//Same of bwt_restore_bwt, the BWT is inside the mapping of fn (see map_file)
+bwt_t *bwt_map_bwt(const char *fn, int flags)
+{
+	uint64_t len;
+	uint64_t *p = (uint64_t*) map_file(fn, &len, flags);
+	if (p == 0)
+		return 0;
+	if (len < sizeof(uint64_t) * 5)
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, fn);
+		munmap(p, len);
+		return 0;
+	}
+
+	bwt_t *bwt = (bwt_t*) calloc(1, sizeof(bwt_t));
+	bwt->bwt_map = p;
+	bwt->bwt_map_len = len;
+	bwt->primary = p[0];
+	memcpy(bwt->L2 + 1, p + 1, 4 * sizeof(uint64_t));
+	bwt->bwt_size = (len - sizeof(uint64_t) * 5) >> 2;
+	bwt->bwt = (uint32_t*) (p + 5);
+	bwt->seq_len = bwt->L2[4];
+	bwt_gen_cnt_table(bwt);
+	if (bwt->bwt_size < bwt_file_words(bwt->seq_len))
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, fn);
+		bwt_destroy(bwt);
+		return 0;
+	}
+
+	return bwt;
+}
+
 bntseq_t *bns_restore(const char *prefix)
 {
 	char ann_filename[1024], amb_filename[1024], pac_filename[1024], alt_filename[1024];
@@ -186,7 +373,8 @@ bntseq_t *bns_restore_core(const char *ann_filename, const char* amb_filename, c
 	int scanres;
 	bns = (bntseq_t*) calloc(1, sizeof(bntseq_t));
 	{ // read .ann
-		fp = xopen(fname = ann_filename, "r");
+		if ((fp = fopen(fname = ann_filename, "r")) == 0)
+			goto badopen;
 		scanres = fscanf(fp, "%lld%d%u", &xx, &bns->n_seqs, &bns->seed);
 		if (scanres != 3)
 			goto badread;
@@ -223,17 +411,24 @@ bntseq_t *bns_restore_core(const char *ann_filename, const char* amb_filename, c
 				goto badread;
 			p->offset = xx;
 		}
-		err_fclose(fp);
+		fclose(fp);
 	}
 	{ // read .amb
 		int64_t l_pac;
 		int32_t n_seqs;
-		fp = xopen(fname = amb_filename, "r");
+		if ((fp = fopen(fname = amb_filename, "r")) == 0)
+			goto badopen;
 		scanres = fscanf(fp, "%lld%d%d", &xx, &n_seqs, &bns->n_holes);
 		if (scanres != 3)
 			goto badread;
 		l_pac = xx;
-		xassert(l_pac == bns->l_pac && n_seqs == bns->n_seqs, "inconsistent .ann and .amb files.");
+		if (l_pac != bns->l_pac || n_seqs != bns->n_seqs)
+		{
+			fprintf(stderr, "[E::%s] inconsistent .ann and .amb files.\n", __func__);
+			fclose(fp);
+			bns_destroy(bns);
+			return 0;
+		}
 		bns->ambs = bns->n_holes ? (bntamb1_t*) calloc(bns->n_holes, sizeof(bntamb1_t)) : 0;
 		for (i = 0; i < bns->n_holes; ++i)
 		{
@@ -244,30 +439,67 @@ bntseq_t *bns_restore_core(const char *ann_filename, const char* amb_filename, c
 			p->offset = xx;
 			p->amb = str[0];
 		}
-		err_fclose(fp);
+		fclose(fp);
 	}
 	{ // open .pac
-		bns->fp_pac = xopen(pac_filename, "rb");
+		if ((bns->fp_pac = fopen(fname = pac_filename, "rb")) == 0)
+			goto badopen;
 	}
 	return bns;
 
+	//The errors are returned instead of terminating the process (see lib_aln_idx_load_async)
+	badopen:
+	fprintf(stderr, "[E::%s] fail to open file '%s' : %s\n", __func__, fname, strerror(errno));
+	bns_destroy(bns);
+	return 0;
+
 	badread: if (EOF == scanres)
+		fprintf(stderr, "[E::%s] Error reading %s : %s\n", __func__, fname, ferror(fp) ? strerror(errno) : "Unexpected end of file");
+	else
+		fprintf(stderr, "[E::%s] Parse error reading %s\n", __func__, fname);
+	fclose(fp);
+	bns_destroy(bns);
+	return 0;
+}
+
+//Derived from bns_destroy in bntseq.c, bns can be partially read by bns_restore_core
+static void bns_destroy(bntseq_t *bns)
+{
+	int i;
+	if (bns->fp_pac)
+		fclose(bns->fp_pac);
+	free(bns->ambs);
+	for (i = 0; bns->anns && i < bns->n_seqs; ++i)
 	{
-		err_fatal(__func__, "Error reading %s : %s\n", fname, ferror(fp) ? strerror(errno) : "Unexpected end of file");
+		free(bns->anns[i].name);
+		free(bns->anns[i].anno);
 	}
-	err_fatal(__func__, "Parse error reading %s\n", fname);
+	free(bns->anns);
+	free(bns);
 }
 
 void bwt_destroy(bwt_t *bwt)
 {
 	if (bwt == 0)
 		return;
-	free(bwt->sa);
-	free(bwt->bwt);
+	if (bwt->sa_map)
+		munmap(bwt->sa_map, bwt->sa_map_len);
+	else
+	{
+		free(bwt->sa);
+		free(bwt->sa_rank);
+	}
+	if (bwt->bwt_map)
+		munmap(bwt->bwt_map, bwt->bwt_map_len);
+	else
+		free(bwt->bwt);
+	free(bwt->occ_line);
+	free(bwt->occ_super);
+	free(bwt->kmi);
 	free(bwt);
 }
 
-static void bwt_gen_cnt_table(bwt_t *bwt)
+void bwt_gen_cnt_table(bwt_t *bwt)
 {
 	int i, j;
 	for (i = 0; i != 256; ++i)
@@ -280,24 +512,101 @@ static void bwt_gen_cnt_table(bwt_t *bwt)
 	}
 }
 
-static void bwt_restore_sa(const char *fn, bwt_t *bwt)
+//Return -1 if fn can't be read or it doesn't belong to bwt, instead of terminating the process
+static int bwt_restore_sa(const char *fn, bwt_t *bwt, idx_read_t *rd)
 {
-	char skipped[256];
 	FILE *fp;
-	uint64_t primary;
+	uint64_t h[7]; // primary, L2[1..4], interval, seq_len
+	int ret;
 
-	fp = xopen(fn, "rb");
-	err_fread_noeof(&primary, sizeof(uint64_t), 1, fp);
-	xassert(primary == bwt->primary, "SA-BWT inconsistency: primary is not the same.");
-	err_fread_noeof(skipped, sizeof(uint64_t), 4, fp); // skip
-	err_fread_noeof(&bwt->sa_intv, sizeof(uint64_t), 1, fp);
-	err_fread_noeof(&primary, sizeof(uint64_t), 1, fp);
-	xassert(primary == bwt->seq_len, "SA-BWT inconsistency: seq_len is not the same.");
+	if ((fp = fopen(fn, "rb")) == 0)
+	{
+		fprintf(stderr, "[E::%s] fail to open %s: %s\n", __func__, fn, strerror(errno));
+		return -1;
+	}
+	if (fread(h, sizeof(uint64_t), 7, fp) != 7)
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, fn);
+		fclose(fp);
+		return -1;
+	}
+	bwt->sa_intv = h[5] & (SA_TEXT_ORDER - 1);
+	if (h[0] != bwt->primary || h[6] != bwt->seq_len)
+	{
+		fprintf(stderr, "[E::%s] SA-BWT inconsistency: %s doesn't belong to the index\n", __func__, fn);
+		fclose(fp);
+		return -1;
+	}
+	if (bwt->sa_intv <= 0 || (bwt->sa_intv & (bwt->sa_intv - 1)) != 0) // see bwt_sa
+	{
+		fprintf(stderr, "[E::%s] SA sample interval is not a power of 2.\n", __func__);
+		fclose(fp);
+		return -1;
+	}
 
+	if (h[5] & SA_TEXT_ORDER) // see bwt_cal_sa_text
+	{
+		bwt->n_sa = sa_text_n(bwt->seq_len, bwt->sa_intv);
+		bwt->sa_width = sa_text_width(bwt->n_sa);
+		bwt->sa_rank = (uint64_t*) malloc(sa_rank_words(bwt->seq_len) * sizeof(uint64_t));
+		bwt->sa = (uint64_t*) malloc(sa_val_words(bwt->n_sa, bwt->sa_width) * sizeof(uint64_t));
+		ret = pread_fix(fileno(fp), sizeof(uint64_t) * 7, sa_rank_words(bwt->seq_len) * sizeof(uint64_t), bwt->sa_rank, rd);
+		if (ret == 0)
+			ret = pread_fix(fileno(fp), sizeof(uint64_t) * (7 + sa_rank_words(bwt->seq_len)),
+							sa_val_words(bwt->n_sa, bwt->sa_width) * sizeof(uint64_t), bwt->sa, rd);
+		fclose(fp);
+		return ret;
+	}
 	bwt->n_sa = (bwt->seq_len + bwt->sa_intv) / bwt->sa_intv;
 	bwt->sa = (uint64_t*) calloc(bwt->n_sa, sizeof(uint64_t));
 	bwt->sa[0] = -1;
 
-	fread_fix(fp, sizeof(uint64_t) * (bwt->n_sa - 1), bwt->sa + 1);
-	err_fclose(fp);
+	ret = pread_fix(fileno(fp), sizeof(uint64_t) * 7, sizeof(uint64_t) * (bwt->n_sa - 1), bwt->sa + 1, rd);
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Same of bwt_restore_sa, the SA is inside the mapping of fn (see map_file): sa[0] is the length of the sequence
+ * instead of -1 (see bwt_sa), the text-order samples are used as they are. Return -1 if the file doesn't belong to bwt.
+ */
+static int bwt_map_sa(const char *fn, bwt_t *bwt, int flags)
+{
+	uint64_t len;
+	uint64_t *p = (uint64_t*) map_file(fn, &len, flags);
+	if (p == 0)
+		return -1;
+	uint64_t intv = len < sizeof(uint64_t) * 7 ? 0 : p[5] & (SA_TEXT_ORDER - 1);
+	if (intv == 0 || (intv & (intv - 1)) != 0 || p[0] != bwt->primary || p[6] != bwt->seq_len)
+	{
+		fprintf(stderr, "[E::%s] SA-BWT inconsistency: %s doesn't belong to the index\n", __func__, fn);
+		munmap(p, len);
+		return -1;
+	}
+
+	bwt->sa_intv = intv;
+	if (p[5] & SA_TEXT_ORDER) // see bwt_cal_sa_text
+	{
+		bwt->n_sa = sa_text_n(bwt->seq_len, intv);
+		bwt->sa_width = sa_text_width(bwt->n_sa);
+	}
+	else
+		bwt->n_sa = (bwt->seq_len + bwt->sa_intv) / bwt->sa_intv;
+	uint64_t n_words = p[5] & SA_TEXT_ORDER ? 7 + sa_rank_words(bwt->seq_len) + sa_val_words(bwt->n_sa, bwt->sa_width) : 6 + bwt->n_sa;
+	if (len < sizeof(uint64_t) * n_words)
+	{
+		fprintf(stderr, "[E::%s] %s is truncated\n", __func__, fn);
+		munmap(p, len);
+		return -1;
+	}
+	bwt->sa_map = p;
+	bwt->sa_map_len = len;
+	if (p[5] & SA_TEXT_ORDER)
+	{
+		bwt->sa_rank = p + 7;
+		bwt->sa = p + 7 + sa_rank_words(bwt->seq_len);
+	}
+	else
+		bwt->sa = p + 6;
+	return 0;
 }
@@ -22,8 +22,8 @@
  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  SOFTWARE.
  */
-#ifndef AC_KVEC_H
-#define AC_KVEC_H
+#ifndef FMDINDEX_LOAD_H
+#define FMDINDEX_LOAD_H
 
 #include <inttypes.h>
 #include <stdio.h>
@@ -31,6 +31,25 @@
 #include <stdint.h>
 #include "utils.h"
 
+//LOAD FLAGS (see lib_aln_idx_load_mmap and lib_aln_idx_load_lazy)
+#ifndef IDX_MMAP_FLAGS_
+#define IDX_MMAP_FLAGS_
+
+#define IDX_MMAP_POPULATE 0x1 //read all the pages of the index files during the loading (MAP_POPULATE)
+#define IDX_MMAP_WILLNEED 0x2 //the pages of the index files are read in background (MADV_WILLNEED)
+#define IDX_LAZY_SA 0x4 //the .sa file is mapped, its pages are read only when the hits are located
+#define IDX_LAZY_PAC 0x8 //the .pac file is mapped, its pages are read only when the reference is accessed
+
+#endif
+
+//Reading of the index files with more threads (see pread_fix)
+typedef struct
+{
+	int n_threads;
+	uint64_t n_bytes; // bytes of the index files to read
+	uint64_t n_read; // bytes already read, updated atomically by the threads
+} idx_read_t;
+
 #ifndef BNTANN1_T
 #define BNTANN1_T
 
@@ -90,6 +109,20 @@ typedef struct
 	int sa_intv;
 	uint64_t n_sa;
 	uint64_t *sa;
+	// text-order samples (see bwt_cal_sa_text): if sa_rank isn't NULL, sa has n_sa values of sa_width bits, one for each row marked in sa_rank
+	uint64_t *sa_rank;
+	int sa_width;
+	// SA intervals of all the strings of length 1..kmi_q, optional (see kmer_index.c)
+	int kmi_q;
+	uint64_t *kmi;
+	// cache-line layout of the occurrences (see bwt_occ_align in occ.c), if it's not NULL bwt is NULL; occ_line_type is the size of its lines
+	uint32_t *occ_line;
+	uint64_t *occ_super;
+	int occ_line_type;
+	const struct occ_line_ops_s *occ_ops; // functions of the kernel for occ_line_type, NULL without occ_line (see bwt_occ_resolve)
+	// if they aren't NULL, bwt and sa are inside the mappings of the .bwt and .sa files (see bwa_idx_map_bwt)
+	void *bwt_map, *sa_map;
+	uint64_t bwt_map_len, sa_map_len;
 } bwt_t;
 
 #endif
@@ -100,11 +133,17 @@ extern "C"
 #endif
 
 	char *bwa_idx_infer_prefix(const char *hint);
-	bwt_t *bwa_idx_load_bwt(const char *hint);
+	bwt_t *bwa_idx_load_bwt(const char *hint, int flags, idx_read_t *rd);
+	bwt_t *bwa_idx_map_bwt(const char *hint, int flags);
+	void *map_file(const char *fn, uint64_t *len, int flags);
 	bntseq_t *bns_restore(const char *prefix);
 	bntseq_t *bns_restore_core(const char *ann_filename, const char* amb_filename, const char* pac_filename);
 	bwt_t *bwt_restore_bwt(const char *fn);
+	bwt_t *bwt_restore_bwt_par(const char *fn, idx_read_t *rd);
+	int pread_fix(int fd, uint64_t offset, uint64_t size, void *a, idx_read_t *rd);
+	bwt_t *bwt_map_bwt(const char *fn, int flags);
 	void bwt_destroy(bwt_t *bwt);
+	void bwt_gen_cnt_table(bwt_t *bwt);
 #ifdef __cplusplus
 }
 #endif
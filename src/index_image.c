@@ -0,0 +1,320 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "index_image.h"
+#include "occ.h"
+#include "sa.h"
+#include "kmer_index.h"
+
+/*
+ * Image of a loaded index (see index_image.h): the packed index files (idx_pack, idx_load_packed) and the index inside the
+ * shared memory (index_shm.c) are images, so they are loaded with one mapping and their arrays aren't copied.
+ */
+
+//Length of the sections of idx and the scalar fields of the header, return the size of the image
+uint64_t idx_image_layout(const bwaidx_t *idx, idx_image_header_t *h)
+{
+	const bwt_t *bwt = idx->bwt;
+	const bntseq_t *bns = idx->bns;
+
+	memset(h, 0, sizeof(idx_image_header_t));
+	memcpy(h->magic, IDX_IMAGE_MAGIC, sizeof(h->magic));
+	h->version = IDX_IMAGE_VERSION;
+	h->n_sections = IDX_N_SECTIONS;
+	h->primary = bwt->primary;
+	memcpy(h->L2, bwt->L2, sizeof(h->L2));
+	h->seq_len = bwt->seq_len;
+	h->bwt_size = bwt->bwt_size;
+	h->sa_intv = bwt->sa_intv | (bwt->sa_rank ? SA_TEXT_ORDER : 0);
+	h->n_sa = bwt->n_sa;
+	h->kmi_q = bwt->kmi ? bwt->kmi_q : 0;
+	h->occ_line_type = bwt->occ_line ? bwt->occ_line_type : -1;
+	h->l_pac = bns->l_pac;
+	h->n_seqs = bns->n_seqs;
+	h->n_holes = bns->n_holes;
+	h->seed = bns->seed;
+
+	if (bwt->occ_line)
+	{
+		uint64_t n_lines = bwt->seq_len / occ_line_bases(bwt->occ_line_type) + 1;
+		h->sec[IDX_SEC_OCC_LINE].len = n_lines * occ_line_words(bwt->occ_line_type) * sizeof(uint32_t);
+		h->sec[IDX_SEC_OCC_SUPER].len = (((n_lines - 1) >> OCC_SUPER_SHIFT) + 1) * 4 * sizeof(uint64_t);
+	}
+	else
+		h->sec[IDX_SEC_BWT].len = bwt->bwt_size * sizeof(uint32_t);
+	if (bwt->sa_rank)
+	{
+		h->sec[IDX_SEC_SA].len = sa_val_words(bwt->n_sa, bwt->sa_width) * sizeof(uint64_t);
+		h->sec[IDX_SEC_SA_RANK].len = sa_rank_words(bwt->seq_len) * sizeof(uint64_t);
+	}
+	else
+		h->sec[IDX_SEC_SA].len = bwt->n_sa * sizeof(uint64_t);
+	h->sec[IDX_SEC_KMI].len = bwt->kmi ? kmi_offset(bwt->kmi_q + 1, 0) * sizeof(uint64_t) : 0;
+	h->sec[IDX_SEC_ANNS].len = bns->n_seqs * sizeof(idx_image_ann_t);
+	h->sec[IDX_SEC_AMBS].len = bns->n_holes * sizeof(bntamb1_t);
+	for (int i = 0; i < bns->n_seqs; ++i)
+		h->sec[IDX_SEC_NAMES].len += strlen(bns->anns[i].name) + strlen(bns->anns[i].anno) + 2;
+	h->sec[IDX_SEC_PAC].len = bns->l_pac / 4 + 1;
+
+	h->size = (sizeof(idx_image_header_t) + IDX_IMAGE_ALIGN - 1) & ~(uint64_t) (IDX_IMAGE_ALIGN - 1);
+	for (int i = 0; i < IDX_N_SECTIONS; ++i)
+	{
+		h->sec[i].off = h->size;
+		h->size += (h->sec[i].len + IDX_IMAGE_ALIGN - 1) & ~(uint64_t) (IDX_IMAGE_ALIGN - 1);
+	}
+	return h->size;
+}
+
+//Source of each section of idx, the annotations are converted by write_anns
+static const void *section_data(const bwaidx_t *idx, int i)
+{
+	switch (i)
+	{
+	case IDX_SEC_BWT:
+		return idx->bwt->bwt;
+	case IDX_SEC_OCC_LINE:
+		return idx->bwt->occ_line;
+	case IDX_SEC_OCC_SUPER:
+		return idx->bwt->occ_super;
+	case IDX_SEC_SA:
+		return idx->bwt->sa;
+	case IDX_SEC_KMI:
+		return idx->bwt->kmi;
+	case IDX_SEC_AMBS:
+		return idx->bns->ambs;
+	case IDX_SEC_PAC:
+		return idx->pac;
+	case IDX_SEC_SA_RANK:
+		return idx->bwt->sa_rank;
+	default:
+		return 0;
+	}
+}
+
+//Annotations and names of the sequences of bns, inside the sections IDX_SEC_ANNS and IDX_SEC_NAMES
+static void write_anns(const bntseq_t *bns, idx_image_ann_t *anns, char *names)
+{
+	uint64_t l = 0;
+	for (int i = 0; i < bns->n_seqs; ++i)
+	{
+		const bntann1_t *a = bns->anns + i;
+		anns[i].offset = a->offset;
+		anns[i].len = a->len;
+		anns[i].n_ambs = a->n_ambs;
+		anns[i].gi = a->gi;
+		anns[i].is_alt = a->is_alt;
+		anns[i].name = l;
+		strcpy(names + l, a->name);
+		l += strlen(a->name) + 1;
+		anns[i].anno = l;
+		strcpy(names + l, a->anno);
+		l += strlen(a->anno) + 1;
+	}
+}
+
+/*
+ * Write the image of idx inside base (h->size bytes, see idx_image_layout). The magic is stored last, after a release
+ * fence: a process mapping base while the image is written sees a zero magic (see idx_image_open) and never a partial image.
+ */
+void idx_image_write(const bwaidx_t *idx, const idx_image_header_t *h, char *base)
+{
+	uint64_t magic;
+	memset(base, 0, h->sec[0].off);
+	memcpy(base, h, sizeof(idx_image_header_t));
+	memset(base, 0, sizeof(h->magic));
+	for (int i = 0; i < IDX_N_SECTIONS; ++i)
+		if (section_data(idx, i))
+			memcpy(base + h->sec[i].off, section_data(idx, i), h->sec[i].len);
+	write_anns(idx->bns, (idx_image_ann_t*) (base + h->sec[IDX_SEC_ANNS].off), base + h->sec[IDX_SEC_NAMES].off);
+	memcpy(&magic, h->magic, sizeof(magic));
+	__atomic_store_n((uint64_t*) base, magic, __ATOMIC_RELEASE);
+}
+
+//Return -1 if the header of the image of len bytes is wrong
+static int check_header(const idx_image_header_t *h, uint64_t len)
+{
+	if (len < sizeof(idx_image_header_t) || memcmp(h->magic, IDX_IMAGE_MAGIC, sizeof(h->magic)) != 0)
+		return -1;
+	if (h->version != IDX_IMAGE_VERSION || h->n_sections < IDX_N_SECTIONS_V1 || h->size > len)
+		return -1;
+	for (int i = 0; i < IDX_N_SECTIONS && i < h->n_sections; ++i)
+		if (h->sec[i].off > h->size || h->sec[i].len > h->size - h->sec[i].off)
+			return -1;
+	uint64_t sa_intv = h->sa_intv & (SA_TEXT_ORDER - 1);
+	if (h->occ_line_type >= OCC_LINE_TYPES || sa_intv == 0 || (sa_intv & (sa_intv - 1)) != 0)
+		return -1;
+	if (!(h->sa_intv & SA_TEXT_ORDER) ? h->sec[IDX_SEC_SA].len != h->n_sa * sizeof(uint64_t) :
+			h->n_sections <= IDX_SEC_SA_RANK || h->n_sa != sa_text_n(h->seq_len, sa_intv)
+			|| h->sec[IDX_SEC_SA].len != sa_val_words(h->n_sa, sa_text_width(h->n_sa)) * sizeof(uint64_t)
+			|| h->sec[IDX_SEC_SA_RANK].len != sa_rank_words(h->seq_len) * sizeof(uint64_t))
+		return -1;
+	if (h->occ_line_type < 0 ? h->sec[IDX_SEC_BWT].len != h->bwt_size * sizeof(uint32_t) : h->sec[IDX_SEC_OCC_LINE].len == 0)
+		return -1;
+	if (h->kmi_q < 0 || h->kmi_q > KMI_MAX_Q || h->sec[IDX_SEC_KMI].len != (h->kmi_q ? kmi_offset(h->kmi_q + 1, 0) * sizeof(uint64_t) : 0))
+		return -1;
+	if (h->sec[IDX_SEC_ANNS].len != h->n_seqs * sizeof(idx_image_ann_t) || h->sec[IDX_SEC_AMBS].len != h->n_holes * sizeof(bntamb1_t))
+		return -1;
+	return h->sec[IDX_SEC_PAC].len < h->l_pac / 4 + 1 ? -1 : 0;
+}
+
+/*
+ * Index of the image inside base (len bytes): its arrays are inside the image, only bwt, bns and the annotations are
+ * allocated. name is used by the messages. Return NULL if base doesn't contain an image, or if its magic isn't stored
+ * yet (image still written by idx_image_write).
+ */
+bwaidx_t *idx_image_open(char *base, uint64_t len, const char *name)
+{
+	const idx_image_header_t *h = (const idx_image_header_t*) base;
+	//acquire: pairs with the release store of the magic, the sections are read after it
+	if (len >= sizeof(idx_image_header_t) && __atomic_load_n((const uint64_t*) base, __ATOMIC_ACQUIRE) == 0)
+	{
+		fprintf(stderr, "[E::%s] %s is still being written\n", __func__, name);
+		return 0;
+	}
+	if (check_header(h, len) != 0)
+	{
+		fprintf(stderr, "[E::%s] %s isn't an index of version %d\n", __func__, name, IDX_IMAGE_VERSION);
+		return 0;
+	}
+
+	bwaidx_t *idx = (bwaidx_t*) calloc(1, sizeof(bwaidx_t));
+	idx->image = base;
+	idx->image_len = len;
+
+	bwt_t *bwt = idx->bwt = (bwt_t*) calloc(1, sizeof(bwt_t));
+	bwt->primary = h->primary;
+	memcpy(bwt->L2, h->L2, sizeof(bwt->L2));
+	bwt->seq_len = h->seq_len;
+	bwt->bwt_size = h->bwt_size;
+	bwt->sa_intv = h->sa_intv & (SA_TEXT_ORDER - 1);
+	bwt->n_sa = h->n_sa;
+	bwt->sa = (uint64_t*) (base + h->sec[IDX_SEC_SA].off);
+	if (h->sa_intv & SA_TEXT_ORDER)
+	{
+		bwt->sa_rank = (uint64_t*) (base + h->sec[IDX_SEC_SA_RANK].off);
+		bwt->sa_width = sa_text_width(h->n_sa);
+	}
+	bwt_gen_cnt_table(bwt);
+	if (h->occ_line_type >= 0)
+	{
+		bwt->occ_line = (uint32_t*) (base + h->sec[IDX_SEC_OCC_LINE].off);
+		bwt->occ_super = (uint64_t*) (base + h->sec[IDX_SEC_OCC_SUPER].off);
+		bwt->occ_line_type = h->occ_line_type;
+		bwt_occ_resolve(bwt);
+	}
+	else
+		bwt->bwt = (uint32_t*) (base + h->sec[IDX_SEC_BWT].off);
+	if (h->kmi_q)
+	{
+		bwt->kmi = (uint64_t*) (base + h->sec[IDX_SEC_KMI].off);
+		bwt->kmi_q = h->kmi_q;
+	}
+
+	bntseq_t *bns = idx->bns = (bntseq_t*) calloc(1, sizeof(bntseq_t));
+	bns->l_pac = h->l_pac;
+	bns->n_seqs = h->n_seqs;
+	bns->n_holes = h->n_holes;
+	bns->seed = h->seed;
+	bns->ambs = (bntamb1_t*) (base + h->sec[IDX_SEC_AMBS].off);
+	bns->anns = (bntann1_t*) calloc(h->n_seqs + 1, sizeof(bntann1_t));
+	const idx_image_ann_t *anns = (const idx_image_ann_t*) (base + h->sec[IDX_SEC_ANNS].off);
+	char *names = base + h->sec[IDX_SEC_NAMES].off;
+	for (int i = 0; i < h->n_seqs; ++i)
+	{
+		bntann1_t *a = bns->anns + i;
+		a->offset = anns[i].offset;
+		a->len = anns[i].len;
+		a->n_ambs = anns[i].n_ambs;
+		a->gi = anns[i].gi;
+		a->is_alt = anns[i].is_alt;
+		a->name = names + anns[i].name;
+		a->anno = names + anns[i].anno;
+	}
+	idx->pac = (uint8_t*) (base + h->sec[IDX_SEC_PAC].off);
+
+	return idx;
+}
+
+//Release an index returned by idx_image_open and unmap its image
+void idx_image_close(bwaidx_t *idx)
+{
+	free(idx->bwt);
+	free(idx->bns->anns);
+	free(idx->bns);
+	munmap(idx->image, idx->image_len);
+	free(idx);
+}
+
+//Write the image of idx into the file fn (packed index), return -1 if the file can't be written
+int idx_pack(const bwaidx_t *idx, const char *fn)
+{
+	FILE *fp;
+	idx_image_header_t h;
+	idx_image_layout(idx, &h);
+	if ((fp = fopen(fn, "wb")) == 0)
+	{
+		fprintf(stderr, "Unable to write %s.\n", fn);
+		return -1;
+	}
+
+	//The header and the annotations are written from a buffer, the other sections directly
+	char *buf = (char*) calloc(IDX_IMAGE_ALIGN + h.sec[IDX_SEC_ANNS].len + h.sec[IDX_SEC_NAMES].len, 1);
+	memcpy(buf, &h, sizeof(h));
+	err_fwrite(buf, 1, h.sec[0].off, fp);
+	write_anns(idx->bns, (idx_image_ann_t*) (buf + IDX_IMAGE_ALIGN), buf + IDX_IMAGE_ALIGN + h.sec[IDX_SEC_ANNS].len);
+	for (int i = 0; i < IDX_N_SECTIONS; ++i)
+	{
+		uint64_t pad = (i + 1 < IDX_N_SECTIONS ? h.sec[i + 1].off : h.size) - h.sec[i].off - h.sec[i].len;
+		if (i == IDX_SEC_ANNS)
+			err_fwrite(buf + IDX_IMAGE_ALIGN, 1, h.sec[i].len, fp);
+		else if (i == IDX_SEC_NAMES)
+			err_fwrite(buf + IDX_IMAGE_ALIGN + h.sec[IDX_SEC_ANNS].len, 1, h.sec[i].len, fp);
+		else if (h.sec[i].len)
+			err_fwrite(section_data(idx, i), 1, h.sec[i].len, fp);
+		memset(buf, 0, IDX_IMAGE_ALIGN);
+		err_fwrite(buf, 1, pad, fp);
+	}
+	free(buf);
+	err_fflush(fp);
+	err_fclose(fp);
+
+	return 0;
+}
+
+//Index of the packed file fn, mapped read-only with the IDX_MMAP_* flags (see map_file)
+bwaidx_t *idx_load_packed(const char *fn, int flags)
+{
+	uint64_t len;
+	char *base = (char*) map_file(fn, &len, flags);
+	if (base == 0)
+		return 0;
+	bwaidx_t *idx = idx_image_open(base, len, fn);
+	if (idx == 0)
+		munmap(base, len);
+	return idx;
+}
@@ -0,0 +1,120 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef INDEX_IMAGE_H
+#define INDEX_IMAGE_H
+
+#include <inttypes.h>
+#include "fmdindex_load.h"
+
+#ifndef BWAIDX_T
+#define BWAIDX_T
+
+typedef struct
+{
+	bwt_t *bwt; // FM-index
+	bntseq_t *bns; // information on the reference sequences
+	uint8_t *pac; // the actual 2-bit encoded reference sequences with 'N' converted to a random base
+	uint64_t pac_map_len; // if it isn't 0, pac is the mapping of the .pac file
+	// if it isn't NULL, the arrays of the index are inside image (shared memory or packed index, see index_image.c)
+	void *image;
+	uint64_t image_len;
+} bwaidx_t;
+
+#endif
+
+/*
+ * Image of a loaded index: a header followed by its arrays (sections), each one aligned to IDX_IMAGE_ALIGN bytes.
+ * It's the format of the packed index files and of the index inside the shared memory.
+ */
+#define IDX_IMAGE_MAGIC "LIBALNIX"
+#define IDX_IMAGE_VERSION 1
+#define IDX_IMAGE_ALIGN 4096
+
+//Sections of the image, new ones can be added at the end: the readers ignore the ones they don't know
+enum
+{
+	IDX_SEC_BWT, // blocks of OCC_INTERVAL bases of the .bwt file, if the occurrences don't have the cache-line layout
+	IDX_SEC_OCC_LINE, // cache-line layout of the occurrences (see bwt_occ_align)
+	IDX_SEC_OCC_SUPER,
+	IDX_SEC_SA,
+	IDX_SEC_KMI, // k-mer table, optional
+	IDX_SEC_ANNS, // n_seqs idx_image_ann_t
+	IDX_SEC_AMBS, // n_holes bntamb1_t
+	IDX_SEC_NAMES, // names and annotations of the sequences, ended by 0
+	IDX_SEC_PAC,
+	IDX_SEC_SA_RANK, // marks of the sampled rows, only for the text-order samples (see bwt_cal_sa_text)
+	IDX_N_SECTIONS
+};
+
+#define IDX_N_SECTIONS_V1 IDX_SEC_SA_RANK // sections of the first images, the following ones can be missing
+
+typedef struct
+{
+	uint64_t off, len; // in bytes from the start of the image, len is 0 if the section is missing
+} idx_image_section_t;
+
+//Annotation of a sequence (bntann1_t without pointers): name and anno are offsets inside IDX_SEC_NAMES
+typedef struct
+{
+	int64_t offset;
+	int32_t len;
+	int32_t n_ambs;
+	uint32_t gi;
+	int32_t is_alt;
+	uint64_t name, anno;
+} idx_image_ann_t;
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t n_sections;
+	uint64_t size; // of the image
+	// bwt_t
+	uint64_t primary, L2[5], seq_len, bwt_size, sa_intv, n_sa;
+	int32_t kmi_q, occ_line_type;
+	// bntseq_t
+	int64_t l_pac;
+	int32_t n_seqs, n_holes;
+	uint32_t seed;
+	uint32_t reserved;
+	idx_image_section_t sec[IDX_N_SECTIONS];
+} idx_image_header_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	uint64_t idx_image_layout(const bwaidx_t *idx, idx_image_header_t *h);
+	void idx_image_write(const bwaidx_t *idx, const idx_image_header_t *h, char *base);
+	bwaidx_t *idx_image_open(char *base, uint64_t len, const char *name);
+	void idx_image_close(bwaidx_t *idx);
+	int idx_pack(const bwaidx_t *idx, const char *fn);
+	bwaidx_t *idx_load_packed(const char *fn, int flags);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "index_shm.h"
+
+/*
+ * Index inside the POSIX shared memory, like bwa shm: idx_shm_stage copies the image of a loaded index (see index_image.c)
+ * into a segment once, then the processes attach it (idx_shm_attach) without reading the index files or copying its arrays.
+ */
+
+/*
+ * Name of the segment of the index: the absolute path of hint with '_' instead of '/'.
+ * Return -1 if it's too long.
+ */
+static int shm_name(const char *hint, char name[NAME_MAX])
+{
+	char cwd[PATH_MAX];
+	int n;
+	if (hint[0] == '/')
+		n = snprintf(name, NAME_MAX, "/lib_aln%s", hint);
+	else if (getcwd(cwd, sizeof(cwd)) != 0)
+		n = snprintf(name, NAME_MAX, "/lib_aln%s/%s", cwd, hint);
+	else
+		return -1;
+	if (n >= NAME_MAX)
+	{
+		fprintf(stderr, "[E::%s] the path %s is too long for the shared memory\n", __func__, hint);
+		return -1;
+	}
+	for (char *p = name + 1; *p; ++p)
+		if (*p == '/')
+			*p = '_';
+	return 0;
+}
+
+int idx_shm_stage(const bwaidx_t *idx, const char *hint)
+{
+	char name[NAME_MAX];
+	idx_image_header_t h;
+	if (shm_name(hint, name) != 0)
+		return -1;
+	idx_image_layout(idx, &h);
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		if (errno == EEXIST)
+			fprintf(stderr, "[E::%s] the index %s is already in the shared memory\n", __func__, hint);
+		else
+			fprintf(stderr, "[E::%s] fail to create the shared memory %s: %s\n", __func__, name, strerror(errno));
+		return -1;
+	}
+	char *base = 0;
+	if (ftruncate(fd, h.size) != 0 || (base = mmap(0, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "[E::%s] fail to allocate %" PRIu64 " bytes of shared memory: %s\n", __func__, h.size, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	close(fd);
+
+	idx_image_write(idx, &h, base);
+	munmap(base, h.size);
+	return 0;
+}
+
+/*
+ * Index of the segment of hint (see idx_image_open), NULL if the index isn't in the shared memory or if idx_shm_stage
+ * is still writing it (its magic is stored last).
+ */
+bwaidx_t *idx_shm_attach(const char *hint)
+{
+	char name[NAME_MAX];
+	struct stat st;
+	if (shm_name(hint, name) != 0)
+		return 0;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		fprintf(stderr, "[E::%s] the index %s isn't in the shared memory\n", __func__, hint);
+		return 0;
+	}
+	char *base = MAP_FAILED;
+	if (fstat(fd, &st) != 0)
+		st.st_size = -1;
+	if (st.st_size == 0)
+	{
+		//created by idx_shm_stage but not allocated yet
+		fprintf(stderr, "[E::%s] the index %s is still being staged into the shared memory\n", __func__, hint);
+		close(fd);
+		return 0;
+	}
+	if (st.st_size > 0)
+		base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "[E::%s] fail to attach the shared memory %s\n", __func__, name);
+		return 0;
+	}
+
+	bwaidx_t *idx = idx_image_open(base, st.st_size, name);
+	if (idx == 0)
+		munmap(base, st.st_size);
+	return idx;
+}
+
+//Remove the index of hint from the shared memory, the processes that attached it can use it until they release it
+int idx_shm_drop(const char *hint)
+{
+	char name[NAME_MAX];
+	if (shm_name(hint, name) != 0)
+		return -1;
+	if (shm_unlink(name) != 0)
+	{
+		fprintf(stderr, "[E::%s] the index %s isn't in the shared memory\n", __func__, hint);
+		return -1;
+	}
+	return 0;
+}
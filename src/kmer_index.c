@@ -0,0 +1,169 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "kmer_index.h"
+#include "utils.h"
+
+//In kthread.c
+void kt_for(int n_threads, void (*func)(void*, long, int), void *data, long n);
+
+typedef struct
+{
+	bwt_t *bwt;
+	int d; //length of the strings calculated
+} kmi_worker_t;
+
+/*
+ * Table of the SA intervals of all the strings of length 1..q (.kmi file). Every search starts from the whole SA and
+ * its first levels depend only on the first bases searched, so with the table the first q backward extensions of a
+ * partial hit are a lookup instead of a calculation of the occurrences (see bound_backtracking, cal_width and
+ * bwt_match_exact_alt). The intervals of every length are stored, so the mismatches can be added also inside the
+ * first q bases without changing the search.
+ */
+
+//Calculate the 4 strings of length w->d obtained adding a base to the string of length w->d - 1 with code key
+static void kmi_worker(void *data, long key, int tid)
+{
+	kmi_worker_t *w = (kmi_worker_t*) data;
+	const bwt_t *bwt = w->bwt;
+	uint64_t k, l, cnt_k[4], cnt_l[4];
+
+	if (w->d == 1)
+	{
+		k = 0;
+		l = bwt->seq_len;
+	}
+	else
+		kmi_get(bwt, w->d - 1, key, &k, &l);
+
+	uint64_t *p = bwt->kmi + kmi_offset(w->d, key);
+	const uint64_t step = (uint64_t) 2 << ((w->d - 1) << 1);
+
+	if (k > l)
+	{
+		for (int c = 0; c < 4; c++, p += step)
+		{
+			p[0] = 1;
+			p[1] = 0;
+		}
+		return;
+	}
+
+	bwt_2occ4(bwt, k - 1, l, cnt_k, cnt_l);
+	for (int c = 0; c < 4; c++, p += step)
+	{
+		p[0] = bwt->L2[c] + cnt_k[c] + 1;
+		p[1] = bwt->L2[c] + cnt_l[c];
+	}
+}
+
+//Build the table of the strings of length 1..q, a previous table is replaced. Return -1 if q isn't legal
+int kmi_build(bwt_t* bwt, int q, int n_threads)
+{
+	kmi_worker_t w;
+
+	if (q < 1 || q > KMI_MAX_Q)
+	{
+		fprintf(stderr, "The length of the strings of the k-mer table must be between 1 and %d.\n", KMI_MAX_Q);
+		return -1;
+	}
+
+	free(bwt->kmi);
+	bwt->kmi_q = 0;
+	bwt->kmi = (uint64_t*) malloc(kmi_offset(q + 1, 0) * sizeof(uint64_t));
+
+	//The strings of length d are calculated from the ones of length d - 1
+	w.bwt = bwt;
+	for (w.d = 1; w.d <= q; w.d++)
+		kt_for(n_threads < 1 ? 1 : n_threads, kmi_worker, &w, 1L << ((w.d - 1) << 1));
+
+	bwt->kmi_q = q;
+	return 0;
+}
+
+/*
+ * Format of the .kmi file: seq_len and primary of the BWT (to recognize a table of another index), q and the table.
+ * Return -1 if the file can't be written.
+ */
+int kmi_dump(const bwt_t* bwt, const char* fn)
+{
+	FILE *fp;
+	int32_t q = bwt->kmi_q;
+
+	if (bwt->kmi == 0)
+		return -1;
+	if ((fp = fopen(fn, "wb")) == 0)
+	{
+		fprintf(stderr, "Unable to write %s.\n", fn);
+		return -1;
+	}
+
+	err_fwrite(&bwt->seq_len, sizeof(uint64_t), 1, fp);
+	err_fwrite(&bwt->primary, sizeof(uint64_t), 1, fp);
+	err_fwrite(&q, sizeof(int32_t), 1, fp);
+	err_fwrite(bwt->kmi, sizeof(uint64_t), kmi_offset(q + 1, 0), fp);
+	err_fflush(fp);
+	err_fclose(fp);
+
+	return 0;
+}
+
+//Load the table written by kmi_dump. Return -1 if the file doesn't exist or it belongs to another index
+int kmi_restore(bwt_t* bwt, const char* fn)
+{
+	FILE *fp;
+	uint64_t seq_len, primary;
+	int32_t q;
+
+	if ((fp = fopen(fn, "rb")) == 0)
+		return -1;
+
+	if (fread(&seq_len, sizeof(uint64_t), 1, fp) != 1 || fread(&primary, sizeof(uint64_t), 1, fp) != 1
+		|| fread(&q, sizeof(int32_t), 1, fp) != 1 || seq_len != bwt->seq_len || primary != bwt->primary || q < 1 || q > KMI_MAX_Q)
+	{
+		fprintf(stderr, "%s doesn't belong to the index, it's ignored.\n", fn);
+		fclose(fp);
+		return -1;
+	}
+
+	free(bwt->kmi);
+	bwt->kmi = (uint64_t*) malloc(kmi_offset(q + 1, 0) * sizeof(uint64_t));
+	if (fread(bwt->kmi, sizeof(uint64_t), kmi_offset(q + 1, 0), fp) != kmi_offset(q + 1, 0))
+	{
+		fprintf(stderr, "%s is truncated, it's ignored.\n", fn);
+		free(bwt->kmi);
+		bwt->kmi = 0;
+		bwt->kmi_q = 0;
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	bwt->kmi_q = q;
+
+	return 0;
+}
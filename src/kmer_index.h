@@ -0,0 +1,60 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef KMER_INDEX_H
+#define KMER_INDEX_H
+
+#include <inttypes.h>
+#include "occ.h"
+
+//Max length of the strings of the table, it needs 32 * 4^q / 3 bytes
+#define KMI_MAX_Q 15
+
+/*
+ * Position inside bwt->kmi of the string of length d with code key. The code of a string is built in the order of the
+ * backward search: the first base searched is the least significant, so adding the base c after d bases gives
+ * key | c << 2d. For each length the strings are stored in order of code, each one with its k and l.
+ */
+#define kmi_offset(d, key) (((((uint64_t) 1 << ((d) << 1)) - 4) / 3 + (key)) << 1)
+
+//[k,l] is the SA interval of the string of length d (1 <= d <= bwt->kmi_q) with code key, k > l if it doesn't occur
+static inline void kmi_get(const bwt_t* bwt, int d, uint32_t key, uint64_t* k, uint64_t* l)
+{
+	const uint64_t* p = bwt->kmi + kmi_offset(d, key);
+	*k = p[0];
+	*l = p[1];
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	int kmi_build(bwt_t* bwt, int q, int n_threads);
+	int kmi_dump(const bwt_t* bwt, const char* fn);
+	int kmi_restore(bwt_t* bwt, const char* fn);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
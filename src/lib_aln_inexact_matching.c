@@ -27,15 +27,159 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lib_aln_inexact_matching.h"
 #include "bounded_backtracking_seach.h"
 #include "fmdindex_load.h"
+#include "kmer_index.h"
+#include "index_shm.h"
 
 //Necessary only for GPLv3 version
-int fmd_idx_build(const char *fa, const char *prefix, int algo_type, int block_size);
+int fmd_idx_build(const char *fa, const char *prefix, int algo_type, int block_size, int sa_intv, int sa_text);
+
+//In kthread.c
+void kt_for(int n_threads, void (*func)(void*, long, int), void *data, long n);
+
+//Shared by all the threads that run lib_aln_bound_backtracking_batch
+typedef struct
+{
+	const bwaidx_t *idx;
+	const char** patterns;
+	uint8_t max_mismatches, type_search, type_output;
+	lib_aln_result_set_t** results;
+	lib_aln_search_ctx_t** ctx; //one for each thread
+	const trie_batch_t* trie; //only for lib_aln_bound_backtracking_batch_trie
+	const uint8_t* is_legal;
+	uint32_t n_patterns; //only for lib_aln_bound_backtracking_batch_interleaved
+	int n_interleaved; //queries solved together by each thread, it has a context for each one
+} batch_worker_t;
+
+//Threads that read the index files of lib_aln_idx_load (see pread_fix)
+#define IDX_LOAD_THREADS 4
+
+//Loading in background of lib_aln_idx_load_async
+struct lib_aln_idx_loader_s
+{
+	pthread_t tid;
+	char *path_genome;
+	int occ_intv;
+	idx_read_t rd;
+	bwaidx_t *idx;
+	int done; //set when idx is ready, or it's NULL because the loading failed
+};
+
+static int run_search(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches,
+						const uint8_t type_search, const uint8_t type_output, const bool only_intervals);
+static int control_type_search_sr(const uint8_t type_search);
+static bwaidx_t* idx_load(const char *path_genome, int occ_intv, bool map, int flags, idx_read_t *rd);
 
-//Derived from bwa_idx_load_from_disk in bwa.c
 bwaidx_t* lib_aln_idx_load(const char *path_genome)
+{
+	idx_read_t rd = { IDX_LOAD_THREADS, 0, 0 };
+	return idx_load(path_genome, OCC_LINE_DEFAULT, false, 0, &rd);
+}
+
+bwaidx_t* lib_aln_idx_load_occ(const char *path_genome, int occ_intv)
+{
+	if (occ_intv_type(occ_intv) < 0)
+	{
+		fprintf(stderr, "Unsupported occurrence interval %d: it must be 64, 192, 448 or 960.\n", occ_intv);
+		return 0;
+	}
+	idx_read_t rd = { IDX_LOAD_THREADS, 0, 0 };
+	return idx_load(path_genome, occ_intv, false, 0, &rd);
+}
+
+bwaidx_t* lib_aln_idx_load_mmap(const char *path_genome, int flags)
+{
+	return idx_load(path_genome, 0, true, flags, 0);
+}
+
+bwaidx_t* lib_aln_idx_load_lazy(const char *path_genome, int occ_intv, int flags)
+{
+	if (occ_intv_type(occ_intv) < 0)
+	{
+		fprintf(stderr, "Unsupported occurrence interval %d: it must be 64, 192, 448 or 960.\n", occ_intv);
+		return 0;
+	}
+	idx_read_t rd = { IDX_LOAD_THREADS, 0, 0 };
+	return idx_load(path_genome, occ_intv, false, flags & (IDX_LAZY_SA | IDX_LAZY_PAC), &rd);
+}
+
+static void* idx_loader_worker(void *data)
+{
+	lib_aln_idx_loader_t *ld = (lib_aln_idx_loader_t*) data;
+	ld->idx = idx_load(ld->path_genome, ld->occ_intv, false, 0, &ld->rd);
+	__atomic_store_n(&ld->done, 1, __ATOMIC_RELEASE); // idx is visible before done
+	return 0;
+}
+
+lib_aln_idx_loader_t* lib_aln_idx_load_async(const char *path_genome, int occ_intv, int n_threads)
+{
+	if (occ_intv_type(occ_intv) < 0)
+	{
+		fprintf(stderr, "Unsupported occurrence interval %d: it must be 64, 192, 448 or 960.\n", occ_intv);
+		return 0;
+	}
+	lib_aln_idx_loader_t *ld = calloc(1, sizeof(lib_aln_idx_loader_t));
+	ld->path_genome = strdup(path_genome);
+	ld->occ_intv = occ_intv;
+	ld->rd.n_threads = n_threads < 1 ? 1 : n_threads;
+	if (pthread_create(&ld->tid, 0, idx_loader_worker, ld) != 0)
+	{
+		fprintf(stderr, "Impossible to start the loading of the index.\n");
+		free(ld->path_genome);
+		free(ld);
+		return 0;
+	}
+	return ld;
+}
+
+int lib_aln_idx_loader_poll(const lib_aln_idx_loader_t *ld, double *progress)
+{
+	int done = __atomic_load_n(&ld->done, __ATOMIC_ACQUIRE);
+	if (progress)
+	{
+		uint64_t n_bytes = __atomic_load_n(&ld->rd.n_bytes, __ATOMIC_RELAXED);
+		uint64_t n_read = __atomic_load_n(&ld->rd.n_read, __ATOMIC_RELAXED);
+		*progress = done ? 1.0 : n_bytes ? (double) n_read / n_bytes : 0.0;
+		if (!done && *progress > 0.99) // the occurrences are still being rearranged
+			*progress = 0.99;
+	}
+	return done;
+}
+
+bwaidx_t* lib_aln_idx_loader_wait(lib_aln_idx_loader_t *ld)
+{
+	if (ld == 0)
+		return 0;
+	pthread_join(ld->tid, 0);
+	bwaidx_t *idx = ld->idx;
+	free(ld->path_genome);
+	free(ld);
+	return idx;
+}
+
+//Size of the index file prefix + ext, 0 if it doesn't exist
+static uint64_t idx_file_size(const char *prefix, const char *ext)
+{
+	struct stat st;
+	char *fn = (char*) calloc(strlen(prefix) + strlen(ext) + 1, 1);
+	strcat(strcpy(fn, prefix), ext);
+	int ret = stat(fn, &st);
+	free(fn);
+	return ret == 0 ? st.st_size : 0;
+}
+
+/*
+ * Derived from bwa_idx_load_from_disk in bwa.c. If map, the .bwt, .sa and .pac files are mapped with the IDX_MMAP_*
+ * flags (see map_file), otherwise they are read and the occurrences get lines of occ_intv bases (see bwt_occ_align):
+ * only the .sa and .pac files selected by the IDX_LAZY_* flags are mapped, without reading their pages.
+ * The files that are read are split in blocks read by rd->n_threads threads, rd->n_read counts the bytes read.
+ */
+static bwaidx_t* idx_load(const char *path_genome, int occ_intv, bool map, int flags, idx_read_t *rd)
 {
 	bwaidx_t *idx;
 	char *prefix;
@@ -43,45 +187,242 @@ bwaidx_t* lib_aln_idx_load(const char *path_genome)
 	if (prefix == 0)
 		return 0;
 
+	if (rd && !map)
+		__atomic_store_n(&rd->n_bytes, idx_file_size(prefix, ".bwt") + (flags & IDX_LAZY_SA ? 0 : idx_file_size(prefix, ".sa"))
+						+ (flags & IDX_LAZY_PAC ? 0 : idx_file_size(prefix, ".pac")), __ATOMIC_RELAXED); // see lib_aln_idx_loader_poll
 	idx = calloc(1, sizeof(bwaidx_t));
-	idx->bwt = bwa_idx_load_bwt(path_genome);
+	idx->bwt = map ? bwa_idx_map_bwt(path_genome, flags) : bwa_idx_load_bwt(path_genome, flags, rd);
 	if (idx->bwt == 0)
+	{
+		free(idx);
+		free(prefix);
 		return 0;
+	}
+	if (!map)
+		bwt_occ_align(idx->bwt, occ_intv); // if it fails, the original layout is kept
 	int i, c;
 
 	idx->bns = bns_restore(prefix);
 	if (idx->bns == 0)
+	{
+		lib_aln_idx_destroy(idx);
+		free(prefix);
 		return 0;
+	}
 	for (i = c = 0; i < idx->bns->n_seqs; ++i)
 		if (idx->bns->anns[i].is_alt)
 			++c;
 
-	idx->pac = calloc(idx->bns->l_pac / 4 + 1, 1);
-	err_fread_noeof(idx->pac, 1, idx->bns->l_pac / 4 + 1, idx->bns->fp_pac); // concatenated 2-bit encoded sequence
+	if (map || (flags & IDX_LAZY_PAC))
+	{
+		char *pac_fn = (char*) calloc(strlen(prefix) + 5, 1);
+		strcat(strcpy(pac_fn, prefix), ".pac");
+		idx->pac = (uint8_t*) map_file(pac_fn, &idx->pac_map_len, map ? flags : 0);
+		free(pac_fn);
+		if (idx->pac == 0 || idx->pac_map_len < idx->bns->l_pac / 4 + 1)
+		{
+			fprintf(stderr, "Impossible to map the .pac file of the index.\n");
+			if (idx->pac)
+				munmap(idx->pac, idx->pac_map_len);
+			idx->pac = 0;
+			idx->pac_map_len = 0;
+			err_fclose(idx->bns->fp_pac);
+			lib_aln_idx_destroy(idx);
+			free(prefix);
+			return 0;
+		}
+	}
+	else
+	{
+		idx->pac = calloc(idx->bns->l_pac / 4 + 1, 1);
+		if (pread_fix(fileno(idx->bns->fp_pac), 0, idx->bns->l_pac / 4 + 1, idx->pac, rd) != 0) // concatenated 2-bit encoded sequence
+		{
+			err_fclose(idx->bns->fp_pac);
+			lib_aln_idx_destroy(idx);
+			free(prefix);
+			return 0;
+		}
+	}
 	err_fclose(idx->bns->fp_pac);
 	idx->bns->fp_pac = 0;
 
+	//The k-mer table is optional
+	char *kmi_fn = (char*) calloc(strlen(prefix) + 5, 1);
+	strcat(strcpy(kmi_fn, prefix), ".kmi");
+	kmi_restore(idx->bwt, kmi_fn);
+	free(kmi_fn);
+
 	free(prefix);
 	return idx;
 }
 
+int lib_aln_idx_pack(const char *path_genome, const char *fn, int occ_intv)
+{
+	bwaidx_t *idx = lib_aln_idx_load_occ(path_genome, occ_intv);
+	if (idx == 0)
+		return -1;
+	int ret = idx_pack(idx, fn);
+	lib_aln_idx_destroy(idx);
+	return ret;
+}
+
+bwaidx_t* lib_aln_idx_load_packed(const char *fn, int flags)
+{
+	return idx_load_packed(fn, flags);
+}
+
+int lib_aln_idx_shm_stage(const char *path_genome)
+{
+	bwaidx_t *idx = lib_aln_idx_load(path_genome);
+	if (idx == 0)
+		return -1;
+	int ret = idx_shm_stage(idx, path_genome);
+	lib_aln_idx_destroy(idx);
+	return ret;
+}
+
+bwaidx_t* lib_aln_idx_shm_attach(const char *path_genome)
+{
+	return idx_shm_attach(path_genome);
+}
+
+int lib_aln_idx_shm_drop(const char *path_genome)
+{
+	return idx_shm_drop(path_genome);
+}
+
+int lib_aln_kmi_build(bwaidx_t *idx, const char *path_genome, const int q, int n_threads)
+{
+	if (idx == 0)
+	{
+		fprintf(stderr, "Miss index.\n");
+		return -1;
+	}
+	if (idx->image)
+	{
+		fprintf(stderr, "The index is an image (shared memory or packed index), its k-mer table must be built before it.\n");
+		return -1;
+	}
+	if (kmi_build(idx->bwt, q, n_threads) != 0)
+		return -1;
+	if (path_genome == 0)
+		return 0;
+
+	char *prefix = bwa_idx_infer_prefix(path_genome);
+	if (prefix == 0)
+		return -1;
+
+	char *kmi_fn = (char*) calloc(strlen(prefix) + 5, 1);
+	strcat(strcpy(kmi_fn, prefix), ".kmi");
+	int ret = kmi_dump(idx->bwt, kmi_fn);
+	free(kmi_fn);
+	free(prefix);
+
+	return ret;
+}
+
 //Derived from bwa_idx_destroy in bwa.c
 void lib_aln_idx_destroy(bwaidx_t *idx)
 {
 	if (idx == 0)
 		return;
+	if (idx->image)
+	{
+		idx_image_close(idx);
+		return;
+	}
 
-	free(idx->bwt);
-	free(idx->bns->anns);
-	free(idx->bns);
+	bwt_destroy(idx->bwt);
+	if (idx->pac_map_len)
+		munmap(idx->pac, idx->pac_map_len);
+	else
+		free(idx->pac);
+	if (idx->bns) // NULL if the loading failed
+	{
+		for (int i = 0; i < idx->bns->n_seqs; ++i)
+		{
+			free(idx->bns->anns[i].name);
+			free(idx->bns->anns[i].anno);
+		}
+		free(idx->bns->anns);
+		free(idx->bns->ambs);
+		free(idx->bns);
+	}
 	free(idx);
 }
 
-search_result** lib_aln_bound_backtracking(const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches, uint32_t* numHit,
-											const uint8_t type_search, const uint8_t type_output)
+lib_aln_search_ctx_t* lib_aln_search_ctx_init(void)
+{
+	return search_ctx_init();
+}
+
+void lib_aln_search_ctx_destroy(lib_aln_search_ctx_t* ctx)
+{
+	search_ctx_destroy(ctx);
+}
+
+int lib_aln_search_ctx_set_cache(lib_aln_search_ctx_t* ctx, const uint32_t n_entries)
+{
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return -1;
+	}
+
+	return search_ctx_set_cache(ctx, n_entries);
+}
+
+void lib_aln_search_ctx_cache_stats(const lib_aln_search_ctx_t* ctx, uint64_t* hits, uint64_t* misses)
+{
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		*hits = *misses = 0;
+		return;
+	}
+
+	*hits = ctx->cache_hits;
+	*misses = ctx->cache_misses;
+}
+
+int lib_aln_search_ctx_set_limits(lib_aln_search_ctx_t* ctx, const lib_aln_limits_t* limits)
+{
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return -1;
+	}
+
+	search_ctx_set_limits(ctx, limits);
+	return 0;
+}
+
+uint32_t lib_aln_search_ctx_status(const lib_aln_search_ctx_t* ctx)
+{
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return LIMIT_NO_CTX;
+	}
+
+	return ctx->status;
+}
+
+/*
+ * Solve the query using the memory of ctx, the hits (or only their SA intervals) are stored inside ctx.
+ * Return -1 if the input parameters are not legal, otherwise the number of hits found.
+ */
+static int run_search(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches,
+						const uint8_t type_search, const uint8_t type_output, const bool only_intervals)
 {
 	//Check that the input parameters are valid
-	controlParam(idx, pattern_input, type_search, type_output);
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return -1;
+	}
+	if (controlParam(idx, pattern_input, type_search, type_output) != 0)
+		return -1;
 
 	//Size of pattern input
 	size_t pattern_len = strlen(pattern_input);
@@ -89,41 +430,428 @@ search_result** lib_aln_bound_backtracking(const bwaidx_t *idx, const char* patt
 	if (pattern_len < max_mismatches)
 		max_mismatches = pattern_len;
 
-	/*
-	 * The pattern to be searched is the r.c. of the input string and each base is converted to integer.
-	 * A=0, C=1, G=2, T=3
-	 */
-	uint8_t* pattern_to_search = create_pattern_to_search(pattern_input, pattern_len);
-
-	//Store all information regard the search in seq
-	input_query* seq = init_bwt_seq(pattern_to_search, pattern_len, max_mismatches, type_search, type_output);
+	//Store all information regard the search in ctx
+	search_ctx_prepare(ctx, pattern_input, pattern_len, max_mismatches, type_search, type_output, only_intervals);
 
 	//Core method that solves the approximate pattern matching problem
-	search_result** returnM = get_approximate_match(idx, seq, numHit);
+	return get_approximate_match(idx, ctx);
+}
+
+/*
+ * COUNT_ONLY doesn't store any hit, the number of occurrences is available only inside the result set.
+ * Return 0 if type_search can be used by the methods that return search_result, -1 otherwise.
+ */
+static int control_type_search_sr(const uint8_t type_search)
+{
+	if ((type_search & ~ENGINE_FLAGS) == COUNT_ONLY)
+	{
+		fprintf(stderr, "COUNT_ONLY is available only with lib_aln_bound_backtracking_rs and lib_aln_bound_backtracking_batch.\n");
+		return -1;
+	}
+	return 0;
+}
 
-	free(pattern_to_search);
-	free(seq);
+search_result** lib_aln_bound_backtracking_ctx(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches,
+												uint32_t* numHit, const uint8_t type_search, const uint8_t type_output)
+{
+	int n = control_type_search_sr(type_search);
+	if (n == 0)
+		n = run_search(ctx, idx, pattern_input, max_mismatches, type_search, type_output, false);
+
+	*(numHit) = n < 0 ? 0 : n;
+
+	return n < 0 ? 0 : search_ctx_results(ctx);
+}
+
+search_result** lib_aln_bound_backtracking(const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches, uint32_t* numHit,
+											const uint8_t type_search, const uint8_t type_output)
+{
+	int n = control_type_search_sr(type_search);
+	if (n < 0)
+	{
+		*(numHit) = 0;
+		return 0;
+	}
+
+	lib_aln_search_ctx_t* ctx = search_ctx_init();
+
+	n = run_search(ctx, idx, pattern_input, max_mismatches, type_search, type_output, false);
+
+	//The results are copied outside the context inside a single block, so they are owned by the caller
+	search_result** returnM = n < 0 ? 0 : search_ctx_copy_results(ctx);
+	*(numHit) = n < 0 ? 0 : n;
+
+	search_ctx_destroy(ctx);
 
 	return returnM;
 }
 
-void lib_aln_sr_destroy(search_result** result, uint32_t numHit)
+int lib_aln_bound_backtracking_cb(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input, uint8_t max_mismatches,
+									const uint8_t type_search, const uint8_t type_output, lib_aln_hit_callback_t callback, void* data)
+{
+	if (callback == 0)
+	{
+		fprintf(stderr, "Miss callback.\n");
+		return -1;
+	}
+	if (ctx == 0)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return -1;
+	}
+	if (control_type_search_sr(type_search) != 0)
+		return -1;
+	if ((type_search & ~ENGINE_FLAGS) == UNIQUE_BEST_HIT)
+	{
+		//The hits passed to the callback can't be removed if a second one is found
+		fprintf(stderr, "UNIQUE_BEST_HIT is not available with a callback.\n");
+		return -1;
+	}
+
+	//The callback is used only by this search
+	search_ctx_set_callback(ctx, callback, data);
+	int n = run_search(ctx, idx, pattern_input, max_mismatches, type_search, type_output, false);
+	search_ctx_set_callback(ctx, 0, 0);
+
+	return n;
+}
+
+const lib_aln_result_set_t* lib_aln_bound_backtracking_rs(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+															uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output)
+{
+	if (run_search(ctx, idx, pattern_input, max_mismatches, type_search, type_output, false) < 0)
+		return 0;
+
+	return search_ctx_result_set(ctx);
+}
+
+lib_aln_result_set_t* lib_aln_rs_copy(const lib_aln_result_set_t* rs)
+{
+	if (rs == 0)
+		return 0;
+
+	lib_aln_result_set_t* copy = (lib_aln_result_set_t*) malloc(rs->size);
+	memcpy(copy, rs, rs->size);
+	return copy;
+}
+
+void lib_aln_rs_destroy(lib_aln_result_set_t* rs)
+{
+	free(rs);
+}
+
+const lib_aln_result_set_t* lib_aln_bound_backtracking_sa(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+															uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output)
+{
+	if ((type_search & ~ENGINE_FLAGS) == UNIQUE_BEST_HIT)
+	{
+		//The occurrences of the intervals aren't located, so they can't be checked
+		fprintf(stderr, "UNIQUE_BEST_HIT is not available with lib_aln_bound_backtracking_sa.\n");
+		return 0;
+	}
+	if (run_search(ctx, idx, pattern_input, max_mismatches, type_search, type_output, true) < 0)
+		return 0;
+
+	return search_ctx_result_set(ctx);
+}
+
+void lib_aln_pos_iter_init(lib_aln_pos_iter_t* it, const bwaidx_t *idx, const lib_aln_sa_interval_t* interval)
+{
+	it->idx = idx;
+	it->t = interval->k;
+	it->l = interval->l;
+	it->len = interval->len;
+	it->type_output = interval->type_output;
+}
+
+uint32_t lib_aln_pos_iter_next(lib_aln_pos_iter_t* it, uint64_t* positions, bool* is_rev_comp, const uint32_t n)
+{
+	return pos_iter_next(it, positions, is_rev_comp, n);
+}
+
+//Each query is solved by exactly one thread, the index is only read
+static void batch_worker(void *data, long i, int tid)
+{
+	batch_worker_t *w = (batch_worker_t*) data;
+
+	//The context of the thread is reused by all the queries that it solves
+	if (w->ctx[tid] == 0)
+		w->ctx[tid] = search_ctx_init();
+
+	if (run_search(w->ctx[tid], w->idx, w->patterns[i], w->max_mismatches, w->type_search, w->type_output, false) < 0)
+		return;
+
+	//The result set is copied outside the context, so it's owned by the caller
+	w->results[i] = (lib_aln_result_set_t*) malloc(search_ctx_result_set_size(w->ctx[tid]));
+	search_ctx_pack_result_set(w->ctx[tid], w->results[i]);
+}
+
+//The thread tid uses ctx[tid], if it's NULL a new context is created and stored inside ctx
+static lib_aln_result_set_t** run_batch(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns, const uint8_t max_mismatches,
+										const uint8_t type_search, const uint8_t type_output, int n_threads, lib_aln_search_ctx_t** ctx)
+{
+	batch_worker_t w;
+
+	w.idx = idx;
+	w.patterns = patterns;
+	w.max_mismatches = max_mismatches;
+	w.type_search = type_search;
+	w.type_output = type_output;
+	w.results = (lib_aln_result_set_t**) calloc(n_patterns, sizeof(lib_aln_result_set_t*));
+	w.ctx = ctx;
+
+	kt_for(n_threads, batch_worker, &w, n_patterns);
+
+	return w.results;
+}
+
+lib_aln_result_set_t** lib_aln_bound_backtracking_batch(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+														const uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output,
+														int n_threads)
+{
+	if (patterns == 0)
+	{
+		fprintf(stderr, "Miss patterns to search.\n");
+		return 0;
+	}
+
+	if (n_threads > n_patterns)
+		n_threads = n_patterns;
+	if (n_threads < 1)
+		n_threads = 1;
+	lib_aln_search_ctx_t** ctx = (lib_aln_search_ctx_t**) calloc(n_threads, sizeof(lib_aln_search_ctx_t*));
+
+	lib_aln_result_set_t** results = run_batch(idx, patterns, n_patterns, max_mismatches, type_search, type_output, n_threads, ctx);
+
+	for (int i = 0; i < n_threads; i++)
+		search_ctx_destroy(ctx[i]);
+	free(ctx);
+
+	return results;
+}
+
+lib_aln_result_set_t** lib_aln_bound_backtracking_batch_ctx(lib_aln_search_ctx_t** ctx, int n_ctx, const bwaidx_t *idx, const char** patterns,
+															const uint32_t n_patterns, const uint8_t max_mismatches, const uint8_t type_search,
+															const uint8_t type_output)
+{
+	if (patterns == 0)
+	{
+		fprintf(stderr, "Miss patterns to search.\n");
+		return 0;
+	}
+	if (ctx == 0 || n_ctx < 1)
+	{
+		fprintf(stderr, "Miss search context.\n");
+		return 0;
+	}
+	for (int i = 0; i < n_ctx; i++)
+		if (ctx[i] == 0)
+		{
+			fprintf(stderr, "Miss search context.\n");
+			return 0;
+		}
+
+	//One thread for each context
+	return run_batch(idx, patterns, n_patterns, max_mismatches, type_search, type_output, n_ctx, ctx);
+}
+
+//The thread solves together the queries of the group i, the j-th one with the j-th context of the thread
+static void batch_interleaved_worker(void *data, long i, int tid)
+{
+	batch_worker_t *w = (batch_worker_t*) data;
+	lib_aln_search_ctx_t** ctx = w->ctx + (long) tid * w->n_interleaved;
+	const char** patterns = w->patterns + i * w->n_interleaved;
+	int n_group = w->n_patterns - i * w->n_interleaved < w->n_interleaved ? w->n_patterns - i * w->n_interleaved : w->n_interleaved;
+
+	//Contexts of the legal queries, their order is changed by get_approximate_match_interleaved
+	lib_aln_search_ctx_t* group[n_group];
+	bool is_legal[n_group];
+	int n = 0;
+
+	for (int j = 0; j < n_group; j++)
+	{
+		is_legal[j] = controlParam(w->idx, patterns[j], w->type_search, w->type_output) == 0;
+		if (!is_legal[j])
+			continue;
+
+		if (ctx[j] == 0)
+			ctx[j] = search_ctx_init();
+
+		size_t pattern_len = strlen(patterns[j]);
+		uint8_t max_mismatches = pattern_len < w->max_mismatches ? pattern_len : w->max_mismatches;
+		search_ctx_prepare(ctx[j], patterns[j], pattern_len, max_mismatches, w->type_search, w->type_output, false);
+		group[n++] = ctx[j];
+	}
+
+	get_approximate_match_interleaved(w->idx, group, n);
+
+	for (int j = 0; j < n_group; j++)
+	{
+		if (!is_legal[j])
+			continue;
+
+		lib_aln_result_set_t** rs = w->results + i * w->n_interleaved + j;
+		*rs = (lib_aln_result_set_t*) malloc(search_ctx_result_set_size(ctx[j]));
+		search_ctx_pack_result_set(ctx[j], *rs);
+	}
+}
+
+//The hits of the query have already been found by the visit of the trie, so the thread builds only its result set
+static void batch_trie_worker(void *data, long i, int tid)
+{
+	batch_worker_t *w = (batch_worker_t*) data;
+
+	if (!w->is_legal[i])
+		return;
+
+	if (w->ctx[tid] == 0)
+		w->ctx[tid] = search_ctx_init();
+
+	size_t pattern_len = strlen(w->patterns[i]);
+	uint8_t max_mismatches = pattern_len < w->max_mismatches ? pattern_len : w->max_mismatches;
+	search_ctx_prepare(w->ctx[tid], w->patterns[i], pattern_len, max_mismatches, w->type_search, w->type_output, false);
+
+	size_t n_hits;
+	const scheme_hit_t* hits = trie_batch_hits(w->trie, i, &n_hits);
+	search_ctx_report_hits(w->idx, w->ctx[tid], hits, n_hits);
+
+	w->results[i] = (lib_aln_result_set_t*) malloc(search_ctx_result_set_size(w->ctx[tid]));
+	search_ctx_pack_result_set(w->ctx[tid], w->results[i]);
+}
+
+lib_aln_result_set_t** lib_aln_bound_backtracking_batch_trie(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+															const uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output,
+															int n_threads)
+{
+	batch_worker_t w;
+
+	if (patterns == 0)
+	{
+		fprintf(stderr, "Miss patterns to search.\n");
+		return 0;
+	}
+
+	//The encoded patterns and their widths are calculated inside ctx, then they are inserted in the trie
+	lib_aln_search_ctx_t* ctx = search_ctx_init();
+	trie_batch_t* trie = trie_batch_init(n_patterns);
+	uint8_t* is_legal = (uint8_t*) calloc(n_patterns, 1);
+
+	for (uint32_t i = 0; i < n_patterns; i++)
+	{
+		if (controlParam(idx, patterns[i], type_search, type_output) != 0)
+			continue;
+
+		size_t pattern_len = strlen(patterns[i]);
+		uint8_t mm = pattern_len < max_mismatches ? pattern_len : max_mismatches;
+		search_ctx_prepare(ctx, patterns[i], pattern_len, mm, type_search, type_output, false);
+		cal_width(idx->bwt, pattern_len, ctx->seq.seq, ctx->width);
+		trie_batch_add(trie, i, ctx->seq.seq, pattern_len, ctx->width);
+		is_legal[i] = 1;
+	}
+	search_ctx_destroy(ctx);
+
+	//A pattern shorter than max_mismatches can't have hits with more mismatches than its length
+	trie_batch_match(idx, trie, max_mismatches);
+
+	w.idx = idx;
+	w.patterns = patterns;
+	w.max_mismatches = max_mismatches;
+	w.type_search = type_search;
+	w.type_output = type_output;
+	w.results = (lib_aln_result_set_t**) calloc(n_patterns, sizeof(lib_aln_result_set_t*));
+	w.trie = trie;
+	w.is_legal = is_legal;
+
+	if (n_threads > n_patterns)
+		n_threads = n_patterns;
+	if (n_threads < 1)
+		n_threads = 1;
+	w.ctx = (lib_aln_search_ctx_t**) calloc(n_threads, sizeof(lib_aln_search_ctx_t*));
+
+	kt_for(n_threads, batch_trie_worker, &w, n_patterns);
+
+	for (int i = 0; i < n_threads; i++)
+		search_ctx_destroy(w.ctx[i]);
+	free(w.ctx);
+	free(is_legal);
+	trie_batch_destroy(trie);
+
+	return w.results;
+}
+
+lib_aln_result_set_t** lib_aln_bound_backtracking_batch_interleaved(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+																	const uint8_t max_mismatches, const uint8_t type_search,
+																	const uint8_t type_output, int n_threads, int n_interleaved)
 {
-	for (int i = 0; i < numHit; i++)
-		free(result[i]);
+	batch_worker_t w;
 
+	if (patterns == 0)
+	{
+		fprintf(stderr, "Miss patterns to search.\n");
+		return 0;
+	}
+	if (n_interleaved < 1)
+		n_interleaved = 1;
+	if (n_interleaved > MAX_INTERLEAVED) // the contexts of a group are on the stack of the thread
+		n_interleaved = MAX_INTERLEAVED;
+
+	//The patterns are split in groups of n_interleaved consecutive patterns, each one solved by a thread
+	uint32_t n_groups = (n_patterns + n_interleaved - 1) / n_interleaved;
+	if (n_threads > n_groups)
+		n_threads = n_groups;
+	if (n_threads < 1)
+		n_threads = 1;
+
+	w.idx = idx;
+	w.patterns = patterns;
+	w.n_patterns = n_patterns;
+	w.max_mismatches = max_mismatches;
+	w.type_search = type_search;
+	w.type_output = type_output;
+	w.results = (lib_aln_result_set_t**) calloc(n_patterns, sizeof(lib_aln_result_set_t*));
+	w.ctx = (lib_aln_search_ctx_t**) calloc((size_t) n_threads * n_interleaved, sizeof(lib_aln_search_ctx_t*));
+	w.n_interleaved = n_interleaved;
+
+	kt_for(n_threads, batch_interleaved_worker, &w, n_groups);
+
+	for (long i = 0; i < (long) n_threads * n_interleaved; i++)
+		search_ctx_destroy(w.ctx[i]);
+	free(w.ctx);
+
+	return w.results;
+}
+
+void lib_aln_batch_destroy(lib_aln_result_set_t** results, const uint32_t n_patterns)
+{
+	if (results == 0)
+		return;
+
+	for (uint32_t i = 0; i < n_patterns; i++)
+		lib_aln_rs_destroy(results[i]);
+
+	free(results);
+}
+
+//The hits and everything they refer to are stored inside the same block of result
+void lib_aln_sr_destroy(search_result** result, uint32_t numHit)
+{
 	free(result);
 }
 
 //To improve and only for  GPLv3 version..
 void lib_aln_index(const char* path_genome, const char* prefix, int algo_type)
+{
+	lib_aln_index_sa(path_genome, prefix, algo_type, SA_INTV_DEFAULT, SA_SAMPLE_ROW);
+}
+
+void lib_aln_index_sa(const char* path_genome, const char* prefix, int algo_type, int sa_intv, int sa_sample)
 {
 	if (path_genome == 0)
 	{
 		fprintf(stderr, "Miss pattern to search.\n");
 		exit(EXIT_FAILURE);
 	}
-	else if (path_genome == 0)
+	else if (prefix == 0)
 	{
 		fprintf(stderr, "Miss prefix.\n");
 		exit(EXIT_FAILURE);
@@ -133,7 +861,17 @@ void lib_aln_index(const char* path_genome, const char* prefix, int algo_type)
 		fprintf(stderr, "Miss type of algorithm to apply.\n");
 		exit(EXIT_FAILURE);
 	}
+	else if (sa_intv < 1 || sa_intv > 256 || (sa_intv & (sa_intv - 1)) != 0)
+	{
+		fprintf(stderr, "Unsupported SA interval %d: it must be a power of 2 between 1 and 256.\n", sa_intv);
+		exit(EXIT_FAILURE);
+	}
+	else if (sa_sample != SA_SAMPLE_ROW && sa_sample != SA_SAMPLE_TEXT)
+	{
+		fprintf(stderr, "Miss type of sampling of the suffix array.\n");
+		exit(EXIT_FAILURE);
+	}
 
-	fmd_idx_build(path_genome, prefix, algo_type, 10000000); //10000000 is block_size
+	fmd_idx_build(path_genome, prefix, algo_type, 10000000, sa_intv, sa_sample == SA_SAMPLE_TEXT); //10000000 is block_size
 }
 
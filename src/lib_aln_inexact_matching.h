@@ -38,6 +38,16 @@
 
 #define ARBITRARY_HIT 0x0
 #define ALL_HITS 0x1
+#define COUNT_ONLY 0x2
+#define ALL_BEST_HIT 0x3
+#define UNIQUE_BEST_HIT 0x4 //if the best hit isn't unique, no hit is returned and the count of its mismatches is 2
+
+//Flags that can be added to the type of search to select the engine used instead of the backtracking (only one)
+#define SEARCH_SCHEME 0x80 //bidirectional search schemes
+#define SEED_AND_VERIFY 0x40 //exact seeds verified on the reference
+
+//Max number of patterns solved together by a thread of lib_aln_bound_backtracking_batch_interleaved
+#define MAX_INTERLEAVED 64
 
 #endif
 
@@ -59,6 +69,22 @@
 #define BWTALGO_BWTSW 2
 #define BWTALGO_IS    3
 
+#define SA_INTV_DEFAULT 32 //interval of the samples of the suffix array of lib_aln_index
+
+#define SA_SAMPLE_ROW  0 //the rows of the suffix array multiple of the interval are sampled (default)
+#define SA_SAMPLE_TEXT 1 //the rows of the positions multiple of the interval are sampled (see lib_aln_index_sa)
+
+#endif
+
+//LOAD FLAGS (see lib_aln_idx_load_mmap and lib_aln_idx_load_lazy)
+#ifndef IDX_MMAP_FLAGS_
+#define IDX_MMAP_FLAGS_
+
+#define IDX_MMAP_POPULATE 0x1 //read all the pages of the index files during the loading (MAP_POPULATE)
+#define IDX_MMAP_WILLNEED 0x2 //the pages of the index files are read in background (MADV_WILLNEED)
+#define IDX_LAZY_SA 0x4 //the .sa file is mapped, its pages are read only when the hits are located
+#define IDX_LAZY_PAC 0x8 //the .pac file is mapped, its pages are read only when the reference is accessed
+
 #endif
 
 #ifndef BNTANN1_T
@@ -118,6 +144,20 @@ typedef struct
 	int sa_intv;
 	uint64_t n_sa;
 	uint64_t *sa;
+	// text-order samples (see bwt_cal_sa_text): if sa_rank isn't NULL, sa has n_sa values of sa_width bits, one for each row marked in sa_rank
+	uint64_t *sa_rank;
+	int sa_width;
+	// SA intervals of all the strings of length 1..kmi_q, optional (see kmer_index.c)
+	int kmi_q;
+	uint64_t *kmi;
+	// cache-line layout of the occurrences (see bwt_occ_align in occ.c), if it's not NULL bwt is NULL; occ_line_type is the size of its lines
+	uint32_t *occ_line;
+	uint64_t *occ_super;
+	int occ_line_type;
+	const struct occ_line_ops_s *occ_ops; // functions of the kernel for occ_line_type, NULL without occ_line (see bwt_occ_resolve)
+	// if they aren't NULL, bwt and sa are inside the mappings of the .bwt and .sa files (see bwa_idx_map_bwt)
+	void *bwt_map, *sa_map;
+	uint64_t bwt_map_len, sa_map_len;
 } bwt_t;
 
 #endif
@@ -130,6 +170,10 @@ typedef struct
 	bwt_t *bwt; // FM-index
 	bntseq_t *bns; // information on the reference sequences
 	uint8_t *pac; // the actual 2-bit encoded reference sequences with 'N' converted to a random base
+	uint64_t pac_map_len; // if it isn't 0, pac is the mapping of the .pac file
+	// if it isn't NULL, the arrays of the index are inside image (shared memory or packed index, see index_image.c)
+	void *image;
+	uint64_t image_len;
 } bwaidx_t;
 
 #endif
@@ -149,6 +193,125 @@ typedef struct
 
 #endif
 
+#ifndef LIB_ALN_HIT_CALLBACK_T
+#define LIB_ALN_HIT_CALLBACK_T
+
+/*
+ * Called for each hit as soon as it's found. The hit and its arrays are valid only during the call.
+ * Return 0 to continue the search, any other value to stop it.
+ */
+typedef int (*lib_aln_hit_callback_t)(const search_result* hit, void* data);
+
+#endif
+
+#ifndef LIB_ALN_HIT_T
+#define LIB_ALN_HIT_T
+
+//A hit inside a result set. The offsets refer to the arrays of the result set, so they don't depend on its address.
+typedef struct
+{
+	uint64_t pos_offset; //first position of the hit inside the positions of the set
+	uint64_t diff_offset; //first different position of the hit inside the different positions of the set
+	uint64_t hit_offset; //first character of the hit inside the characters of the set
+	uint32_t num_occur;
+	uint8_t n_mismatches;
+	bool is_rev_comp;
+} lib_aln_hit_t;
+
+#endif
+
+#ifndef LIB_ALN_SA_INTERVAL_T
+#define LIB_ALN_SA_INTERVAL_T
+
+/*
+ * SA interval [k,l] of a hit with n_mismatches mismatches. Its positions are not calculated:
+ * each index of [k,l] is an occurrence inside the forward or the r.c. strand of the reference,
+ * len and type_output are needed to locate it (see lib_aln_pos_iter_t).
+ */
+typedef struct
+{
+	uint64_t k, l;
+	uint32_t len; //length of the pattern
+	uint8_t n_mismatches;
+	uint8_t type_output; //ALLOW_REV_COMP or NO_REV_COMP, with NO_REV_COMP the occurrences inside the r.c. strand are skipped
+} lib_aln_sa_interval_t;
+
+#endif
+
+#ifndef LIB_ALN_POS_ITER_T
+#define LIB_ALN_POS_ITER_T
+
+//Calculate on demand the positions of a SA interval, see lib_aln_pos_iter_init
+typedef struct
+{
+	const bwaidx_t *idx;
+	uint64_t t, l; //[t,l] are the indexes of the interval not yet located
+	uint32_t len;
+	uint8_t type_output;
+} lib_aln_pos_iter_t;
+
+#endif
+
+#ifndef LIB_ALN_RESULT_SET_T
+#define LIB_ALN_RESULT_SET_T
+
+/*
+ * Results of a search stored inside a single contiguous block of memory of size bytes:
+ * the header is followed by the hits and by the arrays that they refer to.
+ * The block doesn't contain pointers, so it can be copied, written to file or shared with other processes.
+ */
+typedef struct
+{
+	uint64_t size; //size in bytes of the whole block
+	uint32_t n_hits;
+	uint32_t hits_offset; //offset in bytes of the array of n_hits lib_aln_hit_t
+	uint64_t n_positions, positions_offset; //array of uint64_t, positions of all hits
+	uint64_t n_diff, diff_offset; //array of uint32_t, different positions of all hits
+	uint64_t n_chars, chars_offset; //characters of all hits, each hit is terminated by '\0'
+	uint64_t n_counts, counts_offset; //array of uint64_t, counts[i] is the number of occurrences with i mismatches
+	uint64_t n_intervals, intervals_offset; //array of lib_aln_sa_interval_t, filled only by lib_aln_bound_backtracking_sa
+	uint32_t status; //limits reached by the search (LIMIT_* flags), 0 if the results are complete
+} lib_aln_result_set_t;
+
+#endif
+
+#ifndef LIB_ALN_LIMITS_T
+#define LIB_ALN_LIMITS_T
+
+//Limits of each query of a search context (0 means no limit), see lib_aln_search_ctx_set_limits
+typedef struct
+{
+	uint64_t max_pos_per_hit; //max positions located for each SA interval of a hit
+	uint64_t max_total_pos; //max positions located by the query
+	uint64_t max_expansions; //max partial hits extended by the query
+	double max_seconds; //max wall-clock time of the query
+} lib_aln_limits_t;
+
+//Status of a search: the limits reached, so the results are only a part of the hits
+#define LIMIT_POS_PER_HIT 0x1
+#define LIMIT_TOTAL_POS 0x2
+#define LIMIT_EXPANSIONS 0x4
+#define LIMIT_DEADLINE 0x8
+#define LIMIT_NO_CTX 0x10 //returned by lib_aln_search_ctx_status without a context
+
+#endif
+
+#ifndef LIB_ALN_SEARCH_CTX_T
+#define LIB_ALN_SEARCH_CTX_T
+
+//Opaque search context, see lib_aln_search_ctx_init
+typedef struct lib_aln_search_ctx_s lib_aln_search_ctx_t;
+
+#endif
+
+#ifndef LIB_ALN_IDX_LOADER_T
+#define LIB_ALN_IDX_LOADER_T
+
+//Opaque loading in background of the index, see lib_aln_idx_load_async
+typedef struct lib_aln_idx_loader_s lib_aln_idx_loader_t;
+
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -164,12 +327,149 @@ extern "C"
 	void lib_aln_index(const char* path_genome, const char* prefix, int algo_type);
 
 	/**
-	 *Method that load index in memory.
+	 *Same of lib_aln_index, with a sample of the suffix array every sa_intv positions (lib_aln_index uses SA_INTV_DEFAULT
+	 *and SA_SAMPLE_ROW). With SA_SAMPLE_ROW each located hit needs on average sa_intv - 1 steps on the BWT and the suffix
+	 *array needs 8 bytes every sa_intv bases of the reference and its reverse complement: 1 keeps the whole suffix array,
+	 *256 uses the least memory. With SA_SAMPLE_TEXT the samples are the positions multiple of sa_intv, so each located hit
+	 *needs at most sa_intv - 1 steps; the sampled rows are marked in a bitvector (about 1.1 bits every base) and each
+	 *sample needs only the bits of the number of samples, so it uses less memory for sa_intv up to 32.
+	 *
+	 *@param path_genome: Path where is locate database sequences in the FASTA format
+	 *@param prefix: Prefix of the output database
+	 *@param algo_type: Index construction algorithm
+	 *@param sa_intv: Interval of the samples of the suffix array, a power of 2 between 1 and 256
+	 *@param sa_sample: SA_SAMPLE_ROW or SA_SAMPLE_TEXT
+	 */
+	void lib_aln_index_sa(const char* path_genome, const char* prefix, int algo_type, int sa_intv, int sa_sample);
+
+	/**
+	 *Method that load index in memory. If the k-mer table of the index (.kmi file) exists, it's loaded too.
+	 *The index files are read by 4 threads, in blocks of 16 MB.
 	 *
 	 *@param path_genome:  Path where is locate database sequences in the FASTA format
 	 */
 	bwaidx_t* lib_aln_idx_load(const char *path_genome);
 
+	/**
+	 *Same of lib_aln_idx_load, with occ_intv bases for each line of the occurrences in memory: 64 (lines of 32 bytes),
+	 *192 (64 bytes, the default of lib_aln_idx_load), 448 (128 bytes) or 960 (256 bytes). The bigger lines use less memory
+	 *and are slower. It returns NULL if occ_intv isn't one of them.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 *@param occ_intv: Bases for each line of the occurrences
+	 */
+	bwaidx_t* lib_aln_idx_load_occ(const char *path_genome, int occ_intv);
+
+	/**
+	 *Same of lib_aln_idx_load, but the .bwt, .sa and .pac files are mapped read-only instead of copied in memory: the loading
+	 *doesn't read them and the processes that map the same index share its pages. The occurrences keep the layout of the .bwt
+	 *file (blocks of 128 bases), so lib_aln_idx_load_occ is faster when the index is loaded once.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 *@param flags: 0 or IDX_MMAP_POPULATE (all the pages are read during the loading) and/or IDX_MMAP_WILLNEED (the pages are read
+	 *in background)
+	 */
+	bwaidx_t* lib_aln_idx_load_mmap(const char *path_genome, int flags);
+
+	/**
+	 *Same of lib_aln_idx_load_occ, but the suffix array and/or the reference selected by flags are mapped read-only instead of
+	 *read: their pages are read only when they are used for the first time. The searches that don't locate the hits
+	 *(COUNT_ONLY, lib_aln_bound_backtracking_sa) never read the suffix array and at most the last page of the reference.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 *@param occ_intv: Bases for each line of the occurrences (see lib_aln_idx_load_occ)
+	 *@param flags: IDX_LAZY_SA and/or IDX_LAZY_PAC
+	 *
+	 * Return NULL if a file selected by flags can't be mapped or doesn't belong to the index.
+	 */
+	bwaidx_t* lib_aln_idx_load_lazy(const char *path_genome, int occ_intv, int flags);
+
+	/**
+	 *Starts the loading of the index (see lib_aln_idx_load_occ) in background and returns immediately: the caller can do
+	 *something else and check the loading with lib_aln_idx_loader_poll. lib_aln_idx_loader_wait returns the index.
+	 *It returns NULL if occ_intv isn't supported or the loading can't start. The errors of the index files (missing, truncated
+	 *or of another index) don't terminate the process: the loading fails and lib_aln_idx_loader_wait returns NULL.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 *@param occ_intv: Bases for each line of the occurrences (see lib_aln_idx_load_occ)
+	 *@param n_threads: Number of threads that read the index files
+	 */
+	lib_aln_idx_loader_t* lib_aln_idx_load_async(const char *path_genome, int occ_intv, int n_threads);
+
+	/**
+	 *Returns 1 if the loading started by lib_aln_idx_load_async is finished (lib_aln_idx_loader_wait doesn't wait), 0 otherwise.
+	 *
+	 *@param ld: Loading returned by lib_aln_idx_load_async
+	 *@param progress: If it isn't NULL, it's set to the fraction of the index files already read (between 0 and 1)
+	 */
+	int lib_aln_idx_loader_poll(const lib_aln_idx_loader_t *ld, double *progress);
+
+	/**
+	 *Waits for the end of the loading started by lib_aln_idx_load_async, releases ld and returns the index
+	 *(NULL if the loading failed).
+	 *
+	 *@param ld: Loading returned by lib_aln_idx_load_async
+	 */
+	bwaidx_t* lib_aln_idx_loader_wait(lib_aln_idx_loader_t *ld);
+
+	/**
+	 *Converts the index files (.bwt, .sa, .pac, .ann, .amb and the optional .kmi) into a single packed file: a versioned header
+	 *followed by binary sections aligned to 4 KB, with the occurrences already in the cache-line layout of occ_intv bases
+	 *(see lib_aln_idx_load_occ). It returns -1 if the index can't be loaded or the file can't be written.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 *@param fn: Path of the packed file
+	 *@param occ_intv: Bases for each line of the occurrences
+	 */
+	int lib_aln_idx_pack(const char *path_genome, const char *fn, int occ_intv);
+
+	/**
+	 *Loads a packed index (see lib_aln_idx_pack) with one mapping of the file, its arrays aren't copied (see lib_aln_idx_load_mmap).
+	 *It returns NULL if the file isn't a packed index of the supported version. lib_aln_idx_destroy releases it.
+	 *
+	 *@param fn: Path of the packed file
+	 *@param flags: 0 or IDX_MMAP_POPULATE and/or IDX_MMAP_WILLNEED (see lib_aln_idx_load_mmap)
+	 */
+	bwaidx_t* lib_aln_idx_load_packed(const char *fn, int flags);
+
+	/**
+	 *Loads the index (see lib_aln_idx_load) and copies it into the POSIX shared memory, where it remains until lib_aln_idx_shm_drop
+	 *is called (or the host restarts). It returns -1 if the index is already there or the shared memory isn't enough.
+	 *
+	 *@param path_genome:  Path where is locate database sequences in the FASTA format
+	 */
+	int lib_aln_idx_shm_stage(const char *path_genome);
+
+	/**
+	 *Returns the index copied into the shared memory by lib_aln_idx_shm_stage, without reading the index files or copying it:
+	 *all the processes that attach it use the same memory. It returns NULL if the index isn't in the shared memory.
+	 *lib_aln_idx_destroy releases it.
+	 *
+	 *@param path_genome:  Path of the index, the same given to lib_aln_idx_shm_stage
+	 */
+	bwaidx_t* lib_aln_idx_shm_attach(const char *path_genome);
+
+	/**
+	 *Removes the index from the shared memory: the processes that attached it can use it until they release it.
+	 *It returns -1 if the index isn't in the shared memory.
+	 *
+	 *@param path_genome:  Path of the index, the same given to lib_aln_idx_shm_stage
+	 */
+	int lib_aln_idx_shm_drop(const char *path_genome);
+
+	/**
+	 *Builds the table of the SA intervals of all the strings of length 1..q and attaches it to the index: the searches
+	 *read the first q levels from the table instead of calculating them. The table needs 32 * 4^q / 3 bytes.
+	 *
+	 *@param idx: FMD-Index
+	 *@param path_genome: Path of the index, the table is saved in the .kmi file. It can be NULL, then the table is only in memory
+	 *@param q: Length of the strings of the table, between 1 and 15
+	 *@param n_threads: Number of threads
+	 *
+	 * Return 0 on success, -1 otherwise.
+	 */
+	int lib_aln_kmi_build(bwaidx_t *idx, const char *path_genome, const int q, int n_threads);
+
 	/**
 	 *Method that free memory by index.
 	 *
@@ -180,19 +480,277 @@ extern "C"
 	/**
 	 *Method that solve approximate pattern matching problem.
 	 *
-	 * This function dynamically allocates memory. You need to free the memory by
-	 * libbwa_bt_sr_destroy().
+	 * This function dynamically allocates memory (a single block). You need to free the memory by
+	 * lib_aln_sr_destroy().
 	 *
 	 *@param idx: FMD-Index
 	 *@param pattern_input: Input string
 	 *@param max_mismatches: Max number of mismatch between hit and reference
 	 *@param num_hits: Number of admissible hit found
-	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT and ALL_HITS
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, ALL_BEST_HIT and UNIQUE_BEST_HIT
 	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 *
+	 * Return NULL (and num_hits is set to 0) if the input parameters are not legal.
 	 */
 	search_result** lib_aln_bound_backtracking(const bwaidx_t *idx, const char* pattern_input, const uint8_t max_mismatches, uint32_t* num_hits,
 											const uint8_t type_search, const uint8_t type_output);
 
+	/**
+	 *Create a search context. It keeps alive the memory used by a search, so that it can be
+	 *reused by the next searches. A context can't be used by two threads at the same time.
+	 *
+	 * You need to free the memory by lib_aln_search_ctx_destroy().
+	 */
+	lib_aln_search_ctx_t* lib_aln_search_ctx_init(void);
+
+	/**
+	 *Free memory used by a search context (also the results of its last search).
+	 *
+	 *@param ctx: Search context
+	 */
+	void lib_aln_search_ctx_destroy(lib_aln_search_ctx_t* ctx);
+
+	/**
+	 *Give to the context a cache of the SA intervals calculated by the backtracking. The cache is kept between the
+	 *searches of the context, so the queries that share a suffix (for example overlapping k-mers of the same read)
+	 *reuse the work of the previous ones. The old entries are replaced when the cache is full.
+	 *
+	 *@param ctx: Search context
+	 *@param n_entries: Min number of entries (80 bytes each, rounded up to a power of 2), 0 removes the cache
+	 *
+	 * Return 0 on success, -1 otherwise. The counters of lib_aln_search_ctx_cache_stats are reset.
+	 */
+	int lib_aln_search_ctx_set_cache(lib_aln_search_ctx_t* ctx, const uint32_t n_entries);
+
+	/**
+	 *Get the number of lookups of the cache of the context that found the SA intervals (hits) and that calculated
+	 *them (misses), since the last call to lib_aln_search_ctx_set_cache.
+	 *
+	 *@param ctx: Search context
+	 *@param hits: Number of lookups found inside the cache
+	 *@param misses: Number of lookups not found inside the cache
+	 *
+	 * Without a context both counters are 0.
+	 */
+	void lib_aln_search_ctx_cache_stats(const lib_aln_search_ctx_t* ctx, uint64_t* hits, uint64_t* misses);
+
+	/**
+	 *Bound the work of each query solved by the context. When a limit is reached the search stops (or, for the
+	 *limit of the positions of a hit, it skips the other positions of the hit) and the hits found so far are
+	 *returned, with the reached limits inside the status of the result set. The limits are kept between the searches.
+	 *
+	 *@param ctx: Search context
+	 *@param limits: Limits of each query (0 fields mean no limit), NULL removes all limits
+	 *
+	 * Return 0 on success, -1 otherwise.
+	 */
+	int lib_aln_search_ctx_set_limits(lib_aln_search_ctx_t* ctx, const lib_aln_limits_t* limits);
+
+	/**
+	 *Get the limits reached by the last search of the context (LIMIT_* flags), 0 if its results are complete,
+	 *LIMIT_NO_CTX without a context.
+	 *
+	 *@param ctx: Search context
+	 */
+	uint32_t lib_aln_search_ctx_status(const lib_aln_search_ctx_t* ctx);
+
+	/**
+	 *Same of lib_aln_bound_backtracking, but the search uses the memory of ctx.
+	 *
+	 * The results are owned by ctx: they are valid until the next search with the same context and
+	 * must NOT be freed by lib_aln_sr_destroy().
+	 *
+	 *@param ctx: Search context
+	 *@param idx: FMD-Index
+	 *@param pattern_input: Input string
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param num_hits: Number of admissible hit found
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 */
+	search_result** lib_aln_bound_backtracking_ctx(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+													const uint8_t max_mismatches, uint32_t* num_hits, const uint8_t type_search,
+													const uint8_t type_output);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_ctx, but each hit is passed to callback as soon as it's found, instead of
+	 *being stored: the memory used doesn't depend on the number of hits. The hit passed to callback is valid only
+	 *during the call. If callback returns a value different from 0, the search is stopped.
+	 *
+	 *@param ctx: Search context
+	 *@param idx: FMD-Index
+	 *@param pattern_input: Input string
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS and ALL_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 *@param callback: Function called for each hit
+	 *@param data: Passed to callback
+	 *
+	 * Return the number of hits passed to callback, -1 if the input parameters are not legal.
+	 */
+	int lib_aln_bound_backtracking_cb(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+										const uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output,
+										lib_aln_hit_callback_t callback, void* data);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_ctx, but the hits are returned as a result set.
+	 *
+	 * The result set is owned by ctx: it's valid until the next search with the same context.
+	 * Use lib_aln_rs_copy() to keep it. Return NULL if the input parameters are not legal.
+	 *
+	 *@param ctx: Search context
+	 *@param idx: FMD-Index
+	 *@param pattern_input: Input string
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, COUNT_ONLY, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 */
+	const lib_aln_result_set_t* lib_aln_bound_backtracking_rs(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+																const uint8_t max_mismatches, const uint8_t type_search,
+																const uint8_t type_output);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_rs, but the positions of the hits are not calculated: the result set contains
+	 *only their SA intervals (see lib_aln_rs_intervals), whose positions can be calculated on demand by lib_aln_pos_iter_next.
+	 *
+	 * With ARBITRARY_HIT and ALL_BEST_HIT an interval is returned only if the iterator doesn't discard all its positions
+	 * (they bridge the two strands, or they are r.c. with NO_REV_COMP), so the positions of the intervals shorter than the
+	 * pattern (all of them with NO_REV_COMP) are calculated until the first valid one. The counts of the result set are not calculated.
+	 *
+	 *@param ctx: Search context
+	 *@param idx: FMD-Index
+	 *@param pattern_input: Input string
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS and ALL_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 */
+	const lib_aln_result_set_t* lib_aln_bound_backtracking_sa(lib_aln_search_ctx_t* ctx, const bwaidx_t *idx, const char* pattern_input,
+																const uint8_t max_mismatches, const uint8_t type_search,
+																const uint8_t type_output);
+
+	/**
+	 *Start to calculate the positions of a SA interval. The iterator doesn't allocate memory.
+	 *
+	 *@param it: Iterator
+	 *@param idx: FMD-Index used by the search
+	 *@param interval: SA interval of a hit
+	 */
+	void lib_aln_pos_iter_init(lib_aln_pos_iter_t* it, const bwaidx_t *idx, const lib_aln_sa_interval_t* interval);
+
+	/**
+	 *Calculate the next (at most n) positions of the interval of the iterator. The positions are base 1 and they are
+	 *in SA order (not sorted). Only the returned positions are calculated, so the cost is proportional to them.
+	 *
+	 *@param it: Iterator
+	 *@param positions: Array of at least n elements that receives the positions
+	 *@param is_rev_comp: Array of at least n elements that receives the strand of the positions, it can be NULL
+	 *@param n: Max number of positions to calculate
+	 *
+	 * Return the number of positions stored, 0 if all the positions of the interval have been returned.
+	 */
+	uint32_t lib_aln_pos_iter_next(lib_aln_pos_iter_t* it, uint64_t* positions, bool* is_rev_comp, const uint32_t n);
+
+	/**
+	 *Copy a result set. You need to free the memory by lib_aln_rs_destroy().
+	 *
+	 *@param rs: Result set
+	 */
+	lib_aln_result_set_t* lib_aln_rs_copy(const lib_aln_result_set_t* rs);
+
+	/**
+	 *Free memory used by a result set (a single block).
+	 *
+	 *@param rs: Result set returned by lib_aln_rs_copy or lib_aln_bound_backtracking_batch
+	 */
+	void lib_aln_rs_destroy(lib_aln_result_set_t* rs);
+
+	/**
+	 *Method that solve approximate pattern matching problem for a set of patterns.
+	 *
+	 * The patterns are distributed over a pool of n_threads threads that share the index.
+	 * The i-th element of the output is the result set of patterns[i] (NULL if patterns[i] is not legal).
+	 * You need to free the memory by lib_aln_batch_destroy().
+	 *
+	 *@param idx: FMD-Index
+	 *@param patterns: Input strings
+	 *@param n_patterns: Number of input strings
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, COUNT_ONLY, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 *@param n_threads: Number of threads
+	 */
+	lib_aln_result_set_t** lib_aln_bound_backtracking_batch(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+															const uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output,
+															int n_threads);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_batch, but the threads use the given contexts (one thread for each context),
+	 *so their settings (see lib_aln_search_ctx_set_cache) are used and their counters can be read after the search.
+	 * You need to free the memory by lib_aln_batch_destroy().
+	 *
+	 *@param ctx: Search contexts
+	 *@param n_ctx: Number of contexts, that is the number of threads
+	 *@param idx: FMD-Index
+	 *@param patterns: Input strings
+	 *@param n_patterns: Number of input strings
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, COUNT_ONLY, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 */
+	lib_aln_result_set_t** lib_aln_bound_backtracking_batch_ctx(lib_aln_search_ctx_t** ctx, int n_ctx, const bwaidx_t *idx, const char** patterns,
+																const uint32_t n_patterns, const uint8_t max_mismatches, const uint8_t type_search,
+																const uint8_t type_output);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_batch, but the patterns are inserted in a trie and the FMD-index is visited
+	 *once for the whole batch: the patterns that share a suffix share the work on its bases. It's useful when the batch
+	 *contains many similar patterns (for example the k-mers of a read). The hits are the same of the backtracking, the
+	 *engine flags of type_search are ignored.
+	 *
+	 * The visit of the trie is done by a single thread, then the result sets are built by n_threads threads.
+	 * You need to free the memory by lib_aln_batch_destroy().
+	 *
+	 *@param idx: FMD-Index
+	 *@param patterns: Input strings
+	 *@param n_patterns: Number of input strings
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, COUNT_ONLY, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 *@param n_threads: Number of threads
+	 */
+	lib_aln_result_set_t** lib_aln_bound_backtracking_batch_trie(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+																const uint8_t max_mismatches, const uint8_t type_search, const uint8_t type_output,
+																int n_threads);
+
+	/**
+	 *Same of lib_aln_bound_backtracking_batch, but each thread solves together groups of n_interleaved consecutive patterns:
+	 *their backtracking is advanced in round-robin and the occurrences needed by each pattern are prefetched while the
+	 *other ones are advanced, so the accesses to the BWT overlap. It's useful on large references, where each access
+	 *to the BWT is a cache miss. The patterns searched with the engine flags of type_search are solved one at a time.
+	 * You need to free the memory by lib_aln_batch_destroy().
+	 *
+	 *@param idx: FMD-Index
+	 *@param patterns: Input strings
+	 *@param n_patterns: Number of input strings
+	 *@param max_mismatches: Max number of mismatch between hit and reference
+	 *@param type_search: Defines the type of search. Permissible value are ARBITRARY_HIT, ALL_HITS, COUNT_ONLY, ALL_BEST_HIT and UNIQUE_BEST_HIT
+	 *@param type_output: Defines the type of output: Permissible value are ALLOW_REV_COMP and NO_REV_COMP
+	 *@param n_threads: Number of threads
+	 *@param n_interleaved: Number of patterns solved together by a thread (for example 16), at most MAX_INTERLEAVED
+	 */
+	lib_aln_result_set_t** lib_aln_bound_backtracking_batch_interleaved(const bwaidx_t *idx, const char** patterns, const uint32_t n_patterns,
+																		const uint8_t max_mismatches, const uint8_t type_search,
+																		const uint8_t type_output, int n_threads, int n_interleaved);
+
+	/**
+	 *Free memory allocate for store the results of lib_aln_bound_backtracking_batch or lib_aln_bound_backtracking_batch_trie
+	 *
+	 *@param results: Output of method lib_aln_bound_backtracking_batch, lib_aln_bound_backtracking_batch_ctx, lib_aln_bound_backtracking_batch_trie
+	 * or lib_aln_bound_backtracking_batch_interleaved
+	 *@param n_patterns: Number of patterns searched
+	 */
+	void lib_aln_batch_destroy(lib_aln_result_set_t** results, const uint32_t n_patterns);
+
 	/**
 	 *Free memory allocate for store the results of the search
 	 *
@@ -205,4 +763,40 @@ extern "C"
 }
 #endif
 
+//Hits of a result set
+static inline const lib_aln_hit_t* lib_aln_rs_hits(const lib_aln_result_set_t* rs)
+{
+	return (const lib_aln_hit_t*) ((const char*) rs + rs->hits_offset);
+}
+
+//Positions (base 1) of the occurrences of a hit of rs
+static inline const uint64_t* lib_aln_rs_positions(const lib_aln_result_set_t* rs, const lib_aln_hit_t* h)
+{
+	return (const uint64_t*) ((const char*) rs + rs->positions_offset) + h->pos_offset;
+}
+
+//Positions (base 1) where a hit of rs and the input pattern differ, h->n_mismatches elements
+static inline const uint32_t* lib_aln_rs_different_positions(const lib_aln_result_set_t* rs, const lib_aln_hit_t* h)
+{
+	return (const uint32_t*) ((const char*) rs + rs->diff_offset) + h->diff_offset;
+}
+
+//String of a hit of rs, terminated by '\0'
+static inline const char* lib_aln_rs_hit_string(const lib_aln_result_set_t* rs, const lib_aln_hit_t* h)
+{
+	return (const char*) rs + rs->chars_offset + h->hit_offset;
+}
+
+//SA intervals of the hits (rs->n_intervals elements), only for lib_aln_bound_backtracking_sa
+static inline const lib_aln_sa_interval_t* lib_aln_rs_intervals(const lib_aln_result_set_t* rs)
+{
+	return (const lib_aln_sa_interval_t*) ((const char*) rs + rs->intervals_offset);
+}
+
+//Number of occurrences for each number of mismatches (rs->n_counts elements), the only output of COUNT_ONLY
+static inline const uint64_t* lib_aln_rs_counts(const lib_aln_result_set_t* rs)
+{
+	return (const uint64_t*) ((const char*) rs + rs->counts_offset);
+}
+
 #endif
@@ -23,11 +23,357 @@
  SOFTWARE.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "occ.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define OCC_X86_KERNELS
+#endif
+
+/*
+ * Functions of the occurrences with the cache-line layout of one size (see occ.h): k of occ and occ4 is without the
+ * primary (occ2 and occ24 are the same of bwt_2occ and bwt_2occ4) and b0 returns the base at k (same of bwt_B0). They are generated for each kernel and each size of the lines by
+ * OCC_LINE_KERNEL, so the size of the lines is a constant inside them.
+ */
+typedef struct occ_line_ops_s
+{
+	uint64_t (*occ)(const bwt_t *bwt, uint64_t k, ubyte_t c);
+	void (*occ4)(const bwt_t *bwt, uint64_t k, uint64_t cnt[4]);
+	void (*occ2)(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok, uint64_t *ol);
+	void (*occ24)(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4], uint64_t cntl[4]);
+	ubyte_t (*b0)(const bwt_t *bwt, uint64_t k);
+} occ_line_ops_t;
+
+/*
+ * Kernels that count the bases inside the first n (0..OCC_INTERVAL) cells of the BWT of an occurrence block,
+ * p is the first cell. The kernel used is selected when the library is loaded, on the features of the CPU
+ * (see occ_init): NULL functions (the scalar kernel) mean the original code of bwt.c, based on cnt_table.
+ * line are the functions of the kernel for each size of the cache-line layout (OCC_LINE_TYPES).
+ */
+typedef struct
+{
+	const char *name;
+	void (*count4)(const uint32_t *p, uint32_t n, uint64_t cnt[4]); //add the occurrences of each base to cnt
+	uint64_t (*count)(const uint32_t *p, uint32_t n, ubyte_t c); //occurrences of c
+	const occ_line_ops_t *line;
+} occ_kernel_t;
+
 static void bwt_occ4(const bwt_t *bwt, uint64_t k, uint64_t cnt[4]);
 static inline int __occ_aux(uint64_t y, int c);
+static void occ_init(void);
+
+//Bit 0 of each 2-bit cell of y is set if the cell is the base c (see __occ_aux)
+#define occ_match64(y, c) (((c) & 2 ? (y) : ~(y)) >> 1 & ((c) & 1 ? (y) : ~(y)) & 0x5555555555555555ull)
+
+//The first m bases (1..31) of a pair of cells: the first base of a cell is stored inside its highest bits
+#define occ_mask64(m) (~(~0ull >> ((m) << 1)))
+
+/*
+ * Portable kernels, used by the cache-line layout with the scalar kernel (the blocks of OCC_INTERVAL bases use
+ * instead the original code). The masked bases are A, so they are subtracted.
+ */
+static inline uint64_t occ_count_scalar(const uint32_t *p, uint32_t n, ubyte_t c)
+{
+	uint64_t m = 0;
+	for (; n >= 32; n -= 32, p += 2)
+		m += __occ_aux((uint64_t) p[0] << 32 | p[1], c);
+	if (n)
+	{
+		m += __occ_aux(((uint64_t) p[0] << 32 | p[1]) & occ_mask64(n), c);
+		if (c == 0)
+			m -= 32 - n;
+	}
+	return m;
+}
+
+static inline void occ_count4_scalar(const uint32_t *p, uint32_t n, uint64_t cnt[4])
+{
+	uint64_t m1 = occ_count_scalar(p, n, 1), m2 = occ_count_scalar(p, n, 2), m3 = occ_count_scalar(p, n, 3);
+	cnt[0] += n - m1 - m2 - m3;
+	cnt[1] += m1;
+	cnt[2] += m2;
+	cnt[3] += m3;
+}
+
+#ifdef OCC_X86_KERNELS
+
+//Hardware POPCNT on two cells at a time
+__attribute__((target("popcnt")))
+static inline uint64_t occ_count_popcnt(const uint32_t *p, uint32_t n, ubyte_t c)
+{
+	uint64_t m = 0, y;
+	for (; n >= 32; n -= 32, p += 2)
+	{
+		y = (uint64_t) p[0] << 32 | p[1];
+		m += __builtin_popcountll(occ_match64(y, c));
+	}
+	if (n)
+	{
+		y = (uint64_t) p[0] << 32 | p[1];
+		m += __builtin_popcountll(occ_match64(y, c) & occ_mask64(n));
+	}
+	return m;
+}
+
+//The bases are only A, C, G and T ($ isn't stored), so the occurrences of A are the remaining ones
+__attribute__((target("popcnt")))
+static inline void occ_count4_popcnt(const uint32_t *p, uint32_t n, uint64_t cnt[4])
+{
+	uint64_t m1 = 0, m2 = 0, m3 = 0, y, mask = ~0ull;
+	for (uint32_t i = 0; i < n; i += 32, p += 2)
+	{
+		y = (uint64_t) p[0] << 32 | p[1];
+		if (n - i < 32)
+			mask = occ_mask64(n - i);
+		m1 += __builtin_popcountll(occ_match64(y, 1) & mask);
+		m2 += __builtin_popcountll(occ_match64(y, 2) & mask);
+		m3 += __builtin_popcountll(occ_match64(y, 3) & mask);
+	}
+	cnt[0] += n - m1 - m2 - m3;
+	cnt[1] += m1;
+	cnt[2] += m2;
+	cnt[3] += m3;
+}
+
+/*
+ * The 8 cells of a block are a 256-bit vector, one cell for each 32-bit lane: the lane j keeps its
+ * first min(max(n - 16j, 0), 16) bases
+ */
+__attribute__((target("avx2")))
+static inline __m256i occ_mask_avx2(int n)
+{
+	const __m256i first = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+	__m256i m = _mm256_sub_epi32(_mm256_set1_epi32(n), first);
+	m = _mm256_min_epi32(_mm256_max_epi32(m, _mm256_setzero_si256()), _mm256_set1_epi32(16));
+	//A shift of 32 bits clears the lane
+	m = _mm256_sub_epi32(_mm256_set1_epi32(32), _mm256_slli_epi32(m, 1));
+	return _mm256_and_si256(_mm256_sllv_epi32(_mm256_set1_epi32(-1), m), _mm256_set1_epi32(0x55555555));
+}
+
+//Same of occ_match64 on the 8 cells of v
+__attribute__((target("avx2")))
+static inline __m256i occ_match_avx2(__m256i v, int c)
+{
+	__m256i h = _mm256_srli_epi32(v, 1);
+	switch (c)
+	{
+	case 0:
+		return _mm256_andnot_si256(_mm256_or_si256(h, v), _mm256_set1_epi32(-1));
+	case 1:
+		return _mm256_andnot_si256(h, v);
+	case 2:
+		return _mm256_andnot_si256(v, h);
+	default:
+		return _mm256_and_si256(h, v);
+	}
+}
+
+//Number of bits set inside each 64-bit lane of v (AVX2 hasn't a popcount instruction: a table of 16 nibbles is used)
+__attribute__((target("avx2")))
+static inline __m256i occ_popcnt_avx2(__m256i v)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+	__m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t occ_hsum_avx2(__m256i v)
+{
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+}
+
+/*
+ * Vector kernels on the first n bases of n_vec vectors of 8 cells (a block of OCC_INTERVAL bases is one vector).
+ * The vectors after the first n bases aren't read. The counts of C, G and T of a lane are at most 256 (8 vectors):
+ * count4 sums them in different 16-bit fields.
+ */
+#define OCC_VEC_KERNEL(kern, isa, popcnt)																		\
+	__attribute__((target(isa)))																				\
+	static inline uint64_t occ_vcount_##kern(const uint32_t *p, uint32_t n, ubyte_t c, int n_vec)				\
+	{																											\
+		__m256i m = _mm256_setzero_si256();																		\
+		for (int j = 0; j < n_vec && (int) n > j << 7; ++j)														\
+		{																										\
+			__m256i v = occ_match_avx2(_mm256_loadu_si256((const __m256i*) (p + (j << 3))), c);				\
+			m = _mm256_add_epi64(m, popcnt(_mm256_and_si256(v, occ_mask_avx2(n - (j << 7)))));				\
+		}																										\
+		return occ_hsum_avx2(m);																				\
+	}																											\
+																												\
+	__attribute__((target(isa)))																				\
+	static inline void occ_vcount4_##kern(const uint32_t *p, uint32_t n, uint64_t cnt[4], int n_vec)			\
+	{																											\
+		__m256i m = _mm256_setzero_si256();																		\
+		for (int j = 0; j < n_vec && (int) n > j << 7; ++j)														\
+		{																										\
+			__m256i v = _mm256_loadu_si256((const __m256i*) (p + (j << 3)));									\
+			__m256i mask = occ_mask_avx2(n - (j << 7));															\
+			m = _mm256_add_epi64(m, popcnt(_mm256_and_si256(occ_match_avx2(v, 1), mask)));					\
+			m = _mm256_add_epi64(m, _mm256_slli_epi64(popcnt(_mm256_and_si256(occ_match_avx2(v, 2), mask)), 16));\
+			m = _mm256_add_epi64(m, _mm256_slli_epi64(popcnt(_mm256_and_si256(occ_match_avx2(v, 3), mask)), 32));\
+		}																										\
+		uint64_t x = occ_hsum_avx2(m);																			\
+		cnt[0] += n - (x & 0xffff) - (x >> 16 & 0xffff) - (x >> 32);											\
+		cnt[1] += x & 0xffff;																					\
+		cnt[2] += x >> 16 & 0xffff;																				\
+		cnt[3] += x >> 32;																						\
+	}																											\
+																												\
+	__attribute__((target(isa)))																				\
+	static uint64_t occ_count_##kern(const uint32_t *p, uint32_t n, ubyte_t c)									\
+	{																											\
+		return occ_vcount_##kern(p, n, c, 1);																	\
+	}																											\
+																												\
+	__attribute__((target(isa)))																				\
+	static void occ_count4_##kern(const uint32_t *p, uint32_t n, uint64_t cnt[4])								\
+	{																											\
+		occ_vcount4_##kern(p, n, cnt, 1);																		\
+	}
+
+OCC_VEC_KERNEL(avx2, "avx2", occ_popcnt_avx2)
+
+//Same of the AVX2 kernels, with the popcount instruction of AVX-512 (VPOPCNTQ) on 256-bit vectors
+OCC_VEC_KERNEL(avx512, "avx2,avx512vl,avx512vpopcntdq", _mm256_popcnt_epi64)
+
+#endif
+
+/*
+ * Functions of the cache-line layout for the kernel kern and the lines of type t (see occ_line_ops_t), inlining the
+ * kernel with the size of the lines (occ_line_count_kern and occ_line_count4_kern): each kernel has the attribute
+ * OCC_ATTR_kern of its instruction set.
+ */
+#define OCC_ATTR_scalar
+#define occ_line_count_scalar(p, n, c, t) occ_count_scalar(p, n, c)
+#define occ_line_count4_scalar(p, n, cnt, t) occ_count4_scalar(p, n, cnt)
+#ifdef OCC_X86_KERNELS
+#define OCC_ATTR_popcnt __attribute__((target("popcnt")))
+#define occ_line_count_popcnt(p, n, c, t) occ_count_popcnt(p, n, c)
+#define occ_line_count4_popcnt(p, n, cnt, t) occ_count4_popcnt(p, n, cnt)
+#define OCC_ATTR_avx2 __attribute__((target("avx2")))
+#define occ_line_count_avx2(p, n, c, t) occ_vcount_avx2(p, n, c, 1 << (t))
+#define occ_line_count4_avx2(p, n, cnt, t) occ_vcount4_avx2(p, n, cnt, 1 << (t))
+#define OCC_ATTR_avx512 __attribute__((target("avx2,avx512vl,avx512vpopcntdq")))
+#define occ_line_count_avx512(p, n, c, t) occ_vcount_avx512(p, n, c, 1 << (t))
+#define occ_line_count4_avx512(p, n, cnt, t) occ_vcount4_avx512(p, n, cnt, 1 << (t))
+#endif
+
+#define OCC_LINE_FUNCS(kern, t)																					\
+	OCC_ATTR_##kern																								\
+	static uint64_t line_occ_##kern##_##t(const bwt_t *bwt, uint64_t k, ubyte_t c)								\
+	{																											\
+		const uint32_t *p = bwt->occ_line + k / occ_line_bases(t) * occ_line_words(t);							\
+		uint64_t n = bwt->occ_super[(k / occ_line_bases(t)) >> OCC_SUPER_SHIFT << 2 | c] + p[occ_line_cells(t) + c];\
+		return n + occ_line_count_##kern(p, k % occ_line_bases(t) + 1, c, t);									\
+	}																											\
+																												\
+	OCC_ATTR_##kern																								\
+	static void line_occ4_##kern##_##t(const bwt_t *bwt, uint64_t k, uint64_t cnt[4])							\
+	{																											\
+		const uint32_t *p = bwt->occ_line + k / occ_line_bases(t) * occ_line_words(t);							\
+		const uint64_t *s = bwt->occ_super + ((k / occ_line_bases(t)) >> OCC_SUPER_SHIFT << 2);					\
+		for (int c = 0; c < 4; ++c)																				\
+			cnt[c] = s[c] + p[occ_line_cells(t) + c];															\
+		occ_line_count4_##kern(p, k % occ_line_bases(t) + 1, cnt, t);											\
+	}																											\
+																												\
+	OCC_ATTR_##kern																								\
+	static void line_2occ_##kern##_##t(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok,		\
+										uint64_t *ol)															\
+	{																											\
+		uint64_t _k = k - (k >= bwt->primary);																	\
+		uint64_t _l = l - (l >= bwt->primary);																	\
+		if (_l / occ_line_bases(t) != _k / occ_line_bases(t) || k == (uint64_t) (-1) || l == (uint64_t) (-1))	\
+		{																										\
+			*ok = bwt_occ(bwt, k, c);																			\
+			*ol = bwt_occ(bwt, l, c);																			\
+			return;																								\
+		}																										\
+		const uint32_t *p = bwt->occ_line + _k / occ_line_bases(t) * occ_line_words(t);						\
+		uint64_t n = bwt->occ_super[(_k / occ_line_bases(t)) >> OCC_SUPER_SHIFT << 2 | c] + p[occ_line_cells(t) + c];\
+		*ok = n + occ_line_count_##kern(p, _k % occ_line_bases(t) + 1, c, t);									\
+		*ol = n + occ_line_count_##kern(p, _l % occ_line_bases(t) + 1, c, t);									\
+	}																											\
+																												\
+	OCC_ATTR_##kern																								\
+	static void line_2occ4_##kern##_##t(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4],				\
+										uint64_t cntl[4])														\
+	{																											\
+		uint64_t _k = k - (k >= bwt->primary);																	\
+		uint64_t _l = l - (l >= bwt->primary);																	\
+		if (_l / occ_line_bases(t) != _k / occ_line_bases(t) || k == (uint64_t) (-1) || l == (uint64_t) (-1))	\
+		{																										\
+			bwt_occ4(bwt, k, cntk);																				\
+			bwt_occ4(bwt, l, cntl);																				\
+			return;																								\
+		}																										\
+		const uint32_t *p = bwt->occ_line + _k / occ_line_bases(t) * occ_line_words(t);						\
+		const uint64_t *s = bwt->occ_super + ((_k / occ_line_bases(t)) >> OCC_SUPER_SHIFT << 2);				\
+		for (int c = 0; c < 4; ++c)																				\
+			cntk[c] = cntl[c] = s[c] + p[occ_line_cells(t) + c];												\
+		occ_line_count4_##kern(p, _k % occ_line_bases(t) + 1, cntk, t);										\
+		occ_line_count4_##kern(p, _l % occ_line_bases(t) + 1, cntl, t);										\
+	}																											\
+																												\
+	static ubyte_t line_b0_##kern##_##t(const bwt_t *bwt, uint64_t k)											\
+	{																											\
+		uint32_t x = bwt->occ_line[k / occ_line_bases(t) * occ_line_words(t) + k % occ_line_bases(t) / 16];	\
+		return x >> ((~k & 15) << 1) & 3;																		\
+	}
+
+#define OCC_LINE_OPS(kern, t) { line_occ_##kern##_##t, line_occ4_##kern##_##t, line_2occ_##kern##_##t, line_2occ4_##kern##_##t, line_b0_##kern##_##t }
+
+//The functions of the kernel kern for each size of the lines, inside occ_line_kern
+#define OCC_LINE_KERNEL(kern)																					\
+	OCC_LINE_FUNCS(kern, 0)																						\
+	OCC_LINE_FUNCS(kern, 1)																						\
+	OCC_LINE_FUNCS(kern, 2)																						\
+	OCC_LINE_FUNCS(kern, 3)																						\
+	static const occ_line_ops_t occ_line_##kern[OCC_LINE_TYPES] = {												\
+		OCC_LINE_OPS(kern, 0), OCC_LINE_OPS(kern, 1), OCC_LINE_OPS(kern, 2), OCC_LINE_OPS(kern, 3)				\
+	};
+
+OCC_LINE_KERNEL(scalar)
+#ifdef OCC_X86_KERNELS
+OCC_LINE_KERNEL(popcnt)
+OCC_LINE_KERNEL(avx2)
+OCC_LINE_KERNEL(avx512)
+#endif
+
+//From the slowest to the fastest, the first one is the scalar kernel
+static const occ_kernel_t occ_kernels[] = {
+	{ "scalar", 0, 0, occ_line_scalar },
+#ifdef OCC_X86_KERNELS
+	{ "popcnt", occ_count4_popcnt, occ_count_popcnt, occ_line_popcnt },
+	{ "avx2", occ_count4_avx2, occ_count_avx2, occ_line_avx2 },
+	{ "avx512", occ_count4_avx512, occ_count_avx512, occ_line_avx512 },
+#endif
+	{ 0, 0, 0, 0 }
+};
+
+//Return true if the CPU can run the kernel
+static int occ_kernel_supported(const occ_kernel_t *kernel)
+{
+#ifdef OCC_X86_KERNELS
+	if (strcmp(kernel->name, "popcnt") == 0)
+		return __builtin_cpu_supports("popcnt");
+	if (strcmp(kernel->name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(kernel->name, "avx512") == 0)
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+	return 1;
+}
+
+//Kernel used by the occurrence functions
+static const occ_kernel_t *occ_kernel = occ_kernels;
 
 /*
  * Same of original method present in bwt.c.
@@ -43,10 +389,14 @@ uint64_t bwt_occ(const bwt_t *bwt, uint64_t k, ubyte_t c)
 	if (k == (uint64_t) (-1))
 		return 0;
 	k -= (k >= bwt->primary); // because $ is not in bwt
+	if (bwt->occ_ops)
+		return bwt->occ_ops->occ(bwt, k, c);
 
 	// retrieve Occ at k/OCC_INTERVAL
 	n = ((uint64_t*) (p = bwt_occ_intv(bwt, k)))[c];
 	p += sizeof(uint64_t); // jump to the start of the first BWT cell
+	if (occ_kernel->count)
+		return n + occ_kernel->count(p, (k & OCC_INTV_MASK) + 1, c);
 
 	// calculate Occ up to the last k/32
 	end = p + (((k >> 5) - ((k & ~OCC_INTV_MASK) >> 5)) << 1);
@@ -68,6 +418,11 @@ uint64_t bwt_occ(const bwt_t *bwt, uint64_t k, ubyte_t c)
 void bwt_2occ(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok, uint64_t *ol)
 {
 	uint64_t _k, _l;
+	if (bwt->occ_ops)
+	{
+		bwt->occ_ops->occ2(bwt, k, l, c, ok, ol);
+		return;
+	}
 	_k = (k >= bwt->primary) ? k - 1 : k;
 	_l = (l >= bwt->primary) ? l - 1 : l;
 	if (_l / OCC_INTERVAL != _k / OCC_INTERVAL || k == (uint64_t) (-1) || l == (uint64_t) (-1))
@@ -85,6 +440,12 @@ void bwt_2occ(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok,
 			--l;
 		n = ((uint64_t*) (p = bwt_occ_intv(bwt, k)))[c];
 		p += sizeof(uint64_t);
+		if (occ_kernel->count)
+		{
+			*ok = n + occ_kernel->count(p, (k & OCC_INTV_MASK) + 1, c);
+			*ol = n + occ_kernel->count(p, (l & OCC_INTV_MASK) + 1, c);
+			return;
+		}
 		// calculate *ok
 		j = k >> 5 << 5;
 		for (i = k / OCC_INTERVAL * OCC_INTERVAL; i < j; i += 32, p += 2)
@@ -113,6 +474,11 @@ void bwt_2occ(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok,
 void bwt_2occ4(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4], uint64_t cntl[4])
 {
 	uint64_t _k, _l;
+	if (bwt->occ_ops)
+	{
+		bwt->occ_ops->occ24(bwt, k, l, cntk, cntl);
+		return;
+	}
 	_k = k - (k >= bwt->primary);
 	_l = l - (l >= bwt->primary);
 	if (_l >> OCC_INTV_SHIFT != _k >> OCC_INTV_SHIFT || k == (uint64_t) (-1)
@@ -130,6 +496,13 @@ void bwt_2occ4(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4], uint6
 		p = bwt_occ_intv(bwt, k);
 		memcpy(cntk, p, 4 * sizeof(uint64_t));
 		p += sizeof(uint64_t); // sizeof(bwtint_t) = 4*(sizeof(bwtint_t)/sizeof(uint32_t))
+		if (occ_kernel->count4)
+		{
+			memcpy(cntl, cntk, 4 * sizeof(uint64_t));
+			occ_kernel->count4(p, (k & OCC_INTV_MASK) + 1, cntk);
+			occ_kernel->count4(p, (l & OCC_INTV_MASK) + 1, cntl);
+			return;
+		}
 		// prepare cntk[]
 		endk = p + ((k >> 4) - ((k & ~OCC_INTV_MASK) >> 4));
 		endl = p + ((l >> 4) - ((l & ~OCC_INTV_MASK) >> 4));
@@ -154,6 +527,27 @@ void bwt_2occ4(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4], uint6
 		cntl[3] += y >> 24;
 	}
 }
+/*
+ * It's the same method present in bwt.c file.
+ * Extend the bi-interval ik of the FMD-index with each base: if is_back, ok[c] is the bi-interval of cP,
+ * otherwise ok[c] is the bi-interval of P(3-c)
+ */
+void bwt_extend(const bwt_t *bwt, const bwtintv_t *ik, bwtintv_t ok[4], int is_back)
+{
+	uint64_t tk[4], tl[4];
+	int i;
+	bwt_2occ4(bwt, ik->x[!is_back] - 1, ik->x[!is_back] - 1 + ik->x[2], tk, tl);
+	for (i = 0; i != 4; ++i)
+	{
+		ok[i].x[!is_back] = bwt->L2[i] + 1 + tk[i];
+		ok[i].x[2] = tl[i] - tk[i];
+	}
+	ok[3].x[is_back] = ik->x[is_back] + (ik->x[!is_back] <= bwt->primary && ik->x[!is_back] + ik->x[2] - 1 >= bwt->primary);
+	ok[2].x[is_back] = ok[3].x[is_back] + ok[3].x[2];
+	ok[1].x[is_back] = ok[2].x[is_back] + ok[2].x[2];
+	ok[0].x[is_back] = ok[1].x[is_back] + ok[1].x[2];
+}
+
 //It's the same method present in bwt.c file.
 static void bwt_occ4(const bwt_t *bwt, uint64_t k, uint64_t cnt[4])
 {
@@ -165,9 +559,19 @@ static void bwt_occ4(const bwt_t *bwt, uint64_t k, uint64_t cnt[4])
 		return;
 	}
 	k -= (k >= bwt->primary); // because $ is not in bwt
+	if (bwt->occ_ops)
+	{
+		bwt->occ_ops->occ4(bwt, k, cnt);
+		return;
+	}
 	p = bwt_occ_intv(bwt, k);
 	memcpy(cnt, p, 4 * sizeof(uint64_t));
 	p += sizeof(uint64_t); // sizeof(bwtint_t) = 4*(sizeof(bwtint_t)/sizeof(uint32_t))
+	if (occ_kernel->count4)
+	{
+		occ_kernel->count4(p, (k & OCC_INTV_MASK) + 1, cnt);
+		return;
+	}
 	end = p + ((k >> 4) - ((k & ~OCC_INTV_MASK) >> 4)); // this is the end point of the following loop
 	for (x = 0; p < end; ++p)
 		x += __occ_aux4(bwt, *p);
@@ -188,3 +592,129 @@ static inline int __occ_aux(uint64_t y, int c)
 	y = (y & 0x3333333333333333ull) + (y >> 2 & 0x3333333333333333ull);
 	return ((y + (y >> 4)) & 0xf0f0f0f0f0f0f0full) * 0x101010101010101ull >> 56;
 }
+
+/*
+ * Replace the blocks of OCC_INTERVAL bases of bwt (bwt->bwt) with the cache-line layout (see occ.h) with lines of
+ * occ_intv bases (64, 192, 448 or 960), so the occurrences of any position are read from a single line (also by
+ * bwt_2occ4, when k and l are inside the same line). With the default OCC_LINE_DEFAULT, the lines are 64 bytes and
+ * the occurrences use 2/3 of the original memory. Return -1 if occ_intv isn't supported or the memory can't be
+ * allocated, bwt is then unchanged.
+ */
+int bwt_occ_align(bwt_t *bwt, int occ_intv)
+{
+	int t = occ_intv_type(occ_intv);
+	if (t < 0)
+	{
+		fprintf(stderr, "Unsupported occurrence interval %d: it must be 64, 192, 448 or 960.\n", occ_intv);
+		return -1;
+	}
+	if (bwt->occ_line)
+		return bwt->occ_line_type == t ? 0 : -1;
+
+	//The positions of the BWT without the primary are 0..seq_len - 1, the last line is always allocated
+	uint64_t n_lines = bwt->seq_len / occ_line_bases(t) + 1;
+	uint64_t n_cells = (bwt->seq_len + 15) >> 4;
+	uint32_t *line = (uint32_t*) aligned_alloc(64, (n_lines * occ_line_words(t) * sizeof(uint32_t) + 63) & ~63ull);
+	uint64_t *super = (uint64_t*) malloc((((n_lines - 1) >> OCC_SUPER_SHIFT) + 1) * 4 * sizeof(uint64_t));
+	if (line == 0 || super == 0)
+	{
+		fprintf(stderr, "Impossible to allocate the cache-line layout of the occurrences.\n");
+		free(line);
+		free(super);
+		return -1;
+	}
+	memset(line, 0, n_lines * occ_line_words(t) * sizeof(uint32_t));
+
+	uint64_t cnt[4] = { 0, 0, 0, 0 };
+	for (uint64_t i = 0; i < n_lines; ++i)
+	{
+		uint32_t *p = line + i * occ_line_words(t);
+		uint64_t *s = super + ((i >> OCC_SUPER_SHIFT) << 2);
+		if ((i & ((1 << OCC_SUPER_SHIFT) - 1)) == 0)
+			memcpy(s, cnt, 4 * sizeof(uint64_t));
+		for (int c = 0; c < 4; ++c)
+			p[occ_line_cells(t) + c] = cnt[c] - s[c];
+
+		//The cell j is the cell j % 8 of the block j / 8 of bwt->bwt, after its 4 counts of 64 bits
+		for (uint64_t j = i * occ_line_cells(t); j < (i + 1) * occ_line_cells(t) && j < n_cells; ++j)
+		{
+			p[j - i * occ_line_cells(t)] = bwt->bwt[(j >> 3 << 4) + sizeof(uint64_t) + (j & 7)];
+			uint32_t x = __occ_aux4(bwt, bwt->bwt[(j >> 3 << 4) + sizeof(uint64_t) + (j & 7)]);
+			for (int c = 0; c < 4; ++c)
+				cnt[c] += x >> (c << 3) & 0xff;
+		}
+	}
+
+	if (bwt->bwt_map)
+		munmap(bwt->bwt_map, bwt->bwt_map_len);
+	else
+		free(bwt->bwt);
+	bwt->bwt = 0;
+	bwt->bwt_map = 0;
+	bwt->occ_line = line;
+	bwt->occ_super = super;
+	bwt->occ_line_type = t;
+	bwt_occ_resolve(bwt);
+	return 0;
+}
+
+//Type of the lines of occ_intv bases (see occ_line_bases), -1 if there isn't
+int occ_intv_type(int occ_intv)
+{
+	for (int t = 0; t < OCC_LINE_TYPES; ++t)
+		if (occ_line_bases(t) == occ_intv)
+			return t;
+	return -1;
+}
+
+//Base at k of the BWT without the primary, with the cache-line layout (see bwt_B0 in sa.h)
+ubyte_t bwt_line_b0(const bwt_t *bwt, uint64_t k)
+{
+	return bwt->occ_ops->b0(bwt, k);
+}
+
+/*
+ * Resolve the functions of the cache-line layout of bwt (occ_ops) for the selected kernel and the size of its lines,
+ * so the occurrence functions call them without looking up the kernel. It's called when the layout is built or
+ * mapped (bwt_occ_align, idx_image_open) and after occ_set_kernel, for the indexes already loaded.
+ */
+void bwt_occ_resolve(bwt_t *bwt)
+{
+	bwt->occ_ops = bwt->occ_line ? occ_kernel->line + bwt->occ_line_type : 0;
+}
+
+//When the library is loaded, the fastest kernel supported by the CPU is selected
+__attribute__((constructor))
+static void occ_init(void)
+{
+#ifdef OCC_X86_KERNELS
+	__builtin_cpu_init();
+#endif
+	for (const occ_kernel_t *kernel = occ_kernels; kernel->name; ++kernel)
+		if (occ_kernel_supported(kernel))
+			occ_kernel = kernel;
+}
+
+//Name of the kernel used by the occurrence functions
+const char* occ_kernel_name(void)
+{
+	return occ_kernel->name;
+}
+
+/*
+ * Use the kernel name (scalar, popcnt, avx2 or avx512) instead of the one selected at load time, for example
+ * to compare them. It must not be called during a search. The indexes with the cache-line layout already loaded keep
+ * the previous kernel until bwt_occ_resolve. Return -1 if the kernel doesn't exist or the CPU can't run it.
+ */
+int occ_set_kernel(const char *name)
+{
+	for (const occ_kernel_t *kernel = occ_kernels; kernel->name; ++kernel)
+		if (strcmp(kernel->name, name) == 0)
+		{
+			if (!occ_kernel_supported(kernel))
+				return -1;
+			occ_kernel = kernel;
+			return 0;
+		}
+	return -1;
+}
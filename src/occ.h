@@ -41,6 +41,22 @@ typedef unsigned char ubyte_t;
 #define OCC_INTERVAL   (1LL<<OCC_INTV_SHIFT)
 #define OCC_INTV_MASK  (OCC_INTERVAL - 1)
 
+/*
+ * Cache-line layout of the occurrences (see bwt_occ_align): lines aligned to the cache lines, each one with the bases of
+ * occ_line_cells(t) cells of 16 bases followed by the occurrences of each base before the line, relative to its
+ * superblock (4 x 32 bits). The type t (0..OCC_LINE_TYPES - 1) of the lines is chosen when the index is loaded: lines of
+ * 32, 64, 128 or 256 bytes, with 64, 192, 448 or 960 bases. The occurrences before each superblock of 2^OCC_SUPER_SHIFT
+ * lines are inside occ_super.
+ */
+#define OCC_LINE_TYPES 4
+#define OCC_LINE_DEFAULT 192
+#define OCC_SUPER_SHIFT 16
+#define occ_line_words(t) (8 << (t))
+#define occ_line_cells(t) (occ_line_words(t) - 4)
+#define occ_line_bases(t) (occ_line_cells(t) << 4)
+
+#define bwt_occ_line(b, k) ((b)->occ_line + (k) / occ_line_bases((b)->occ_line_type) * occ_line_words((b)->occ_line_type))
+
 #ifndef BWT_T
 typedef struct
 {
@@ -55,12 +71,43 @@ typedef struct
 	int sa_intv;
 	uint64_t n_sa;
 	uint64_t *sa;
+	// text-order samples (see bwt_cal_sa_text): if sa_rank isn't NULL, sa has n_sa values of sa_width bits, one for each row marked in sa_rank
+	uint64_t *sa_rank;
+	int sa_width;
+	// SA intervals of all the strings of length 1..kmi_q, optional (see kmer_index.c)
+	int kmi_q;
+	uint64_t *kmi;
+	// cache-line layout of the occurrences (see bwt_occ_align in occ.c), if it's not NULL bwt is NULL; occ_line_type is the size of its lines
+	uint32_t *occ_line;
+	uint64_t *occ_super;
+	int occ_line_type;
+	const struct occ_line_ops_s *occ_ops; // functions of the kernel for occ_line_type, NULL without occ_line (see bwt_occ_resolve)
+	// if they aren't NULL, bwt and sa are inside the mappings of the .bwt and .sa files (see bwa_idx_map_bwt)
+	void *bwt_map, *sa_map;
+	uint64_t bwt_map_len, sa_map_len;
 
 } bwt_t;
 #define BWT_T
 #endif
 
-#define bwt_occ_intv(b, k) ((b)->bwt + ((k)>>7<<4))
+//Prefetch the block of the occurrences read by bwt_occ4 and bwt_2occ4 for k (nothing for k = -1)
+#define bwt_prefetch_occ(b, k) do {															\
+		uint64_t _k = (k);																	\
+		if (_k != (uint64_t) (-1))															\
+		{																					\
+			_k -= (_k >= (b)->primary);														\
+			__builtin_prefetch((b)->occ_line ? bwt_occ_line(b, _k) : bwt_occ_intv(b, _k));	\
+		}																					\
+	} while (0)
+
+/*
+ * Same of bwtintv_t in bwt.h, without info: x[0] is the start of the SA interval of a string,
+ * x[1] the start of the SA interval of its r.c. and x[2] the size of both
+ */
+typedef struct
+{
+	uint64_t x[3];
+} bwtintv_t;
 
 #define __occ_aux4(bwt, b)											\
 	((bwt)->cnt_table[(b)&0xff] + (bwt)->cnt_table[(b)>>8&0xff]		\
@@ -73,6 +120,13 @@ extern "C"
 	uint64_t bwt_occ(const bwt_t *bwt, uint64_t k, ubyte_t c);
 	void bwt_2occ(const bwt_t *bwt, uint64_t k, uint64_t l, ubyte_t c, uint64_t *ok, uint64_t *ol);
 	void bwt_2occ4(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t cntk[4], uint64_t cntl[4]);
+	void bwt_extend(const bwt_t *bwt, const bwtintv_t *ik, bwtintv_t ok[4], int is_back);
+	int bwt_occ_align(bwt_t *bwt, int occ_intv);
+	int occ_intv_type(int occ_intv);
+	ubyte_t bwt_line_b0(const bwt_t *bwt, uint64_t k);
+	void bwt_occ_resolve(bwt_t *bwt);
+	const char* occ_kernel_name(void);
+	int occ_set_kernel(const char *name);
 #ifdef __cplusplus
 }
 #endif
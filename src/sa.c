@@ -27,6 +27,7 @@
 #include "kvec.h"
 
 static inline uint64_t bwt_invPsi(const bwt_t *bwt, uint64_t k);
+static uint64_t bwt_sa_text(const bwt_t *bwt, uint64_t k);
 
 /*
  * It's the same of the original method present in bwt.c
@@ -34,6 +35,9 @@ static inline uint64_t bwt_invPsi(const bwt_t *bwt, uint64_t k);
  */
 uint64_t bwt_sa(const bwt_t *bwt, uint64_t k)
 {
+	if (bwt->sa_rank)
+		return bwt_sa_text(bwt, k);
+
 	uint64_t sa = 0, mask = bwt->sa_intv - 1;
 	while (k & mask)
 	{
@@ -42,8 +46,9 @@ uint64_t bwt_sa(const bwt_t *bwt, uint64_t k)
 	}
 
 	/* without setting bwt->sa[0] = -1, the following line should be
-	 changed to (sa + bwt->sa[k/bwt->sa_intv]) % (bwt->seq_len + 1) */
-	return sa + bwt->sa[k / bwt->sa_intv];
+	 changed to (sa + bwt->sa[k/bwt->sa_intv]) % (bwt->seq_len + 1).
+	 The mapped SA (see bwt_map_sa) can't be changed, so k = 0 is solved here */
+	return k ? sa + bwt->sa[k / bwt->sa_intv] : sa - 1;
 }
 
 /*
@@ -62,6 +67,8 @@ void bwt_cal_sa(bwt_t *bwt, int intv)
 
 	if (bwt->sa)
 		free(bwt->sa);
+	free(bwt->sa_rank);
+	bwt->sa_rank = 0;
 	bwt->sa_intv = intv;
 	bwt->n_sa = (bwt->seq_len + intv) / intv;
 	bwt->sa = (uint64_t*) calloc(bwt->n_sa, sizeof(uint64_t));
@@ -80,6 +87,179 @@ void bwt_cal_sa(bwt_t *bwt, int intv)
 	bwt->sa[0] = (uint64_t) -1; // before this line, bwt->sa[0] = bwt->seq_len
 }
 
+//Number of the rows before k marked in sa_rank, if k is marked it's the index of its value
+static inline uint64_t sa_rank(const uint64_t *sa_rank, uint64_t k)
+{
+	const uint64_t *p = sa_rank + (k / SA_RANK_ROWS << 3);
+	int r = k % SA_RANK_ROWS, w = r >> 6;
+	uint64_t n = p[0];
+	for (int i = 1; i <= w; ++i)
+		n += __builtin_popcountll(p[i]);
+	return n + __builtin_popcountll(p[w + 1] & ((1ULL << (r & 63)) - 1));
+}
+
+static inline int sa_marked(const uint64_t *sa_rank, uint64_t k)
+{
+	int r = k % SA_RANK_ROWS;
+	return sa_rank[(k / SA_RANK_ROWS << 3) + 1 + (r >> 6)] >> (r & 63) & 1;
+}
+
+//i-th value of sa_width bits of the text-order samples
+static inline uint64_t sa_text_val(const bwt_t *bwt, uint64_t i)
+{
+	uint64_t b = i * bwt->sa_width, x = bwt->sa[b >> 6] >> (b & 63);
+	if ((b & 63) + bwt->sa_width > 64)
+		x |= bwt->sa[(b >> 6) + 1] << (64 - (b & 63));
+	return bwt->sa_width == 64 ? x : x & ((1ULL << bwt->sa_width) - 1);
+}
+
+/*
+ * Same of bwt_sa with the text-order samples: the rows of the positions multiple of sa_intv are marked, so k reaches
+ * a marked row in at most sa_intv - 1 steps (position 0 is always marked, so the steps never pass through the row 0).
+ */
+static uint64_t bwt_sa_text(const bwt_t *bwt, uint64_t k)
+{
+	uint64_t sa = 0;
+	if (k == 0)
+		return (uint64_t) -1; // same of bwt_sa, the row of the empty suffix
+	while (!sa_marked(bwt->sa_rank, k))
+	{
+		++sa;
+		k = bwt_invPsi(bwt, k);
+	}
+	return sa + sa_text_val(bwt, sa_rank(bwt->sa_rank, k)) * bwt->sa_intv;
+}
+
+//Prefetch what bwt_sa_batch reads for the row k: the occurrences of its step and the mark of its sample
+static inline void sa_batch_prefetch(const bwt_t *bwt, uint64_t k)
+{
+	bwt_prefetch_occ(bwt, k);
+	if (bwt->sa_rank)
+		__builtin_prefetch(bwt->sa_rank + (k / SA_RANK_ROWS << 3));
+}
+
+/*
+ * Same of bwt_sa for each row of [k,l]: out[t - k] = bwt_sa(bwt, t). The walks of SA_BATCH_WALKS rows go on
+ * together, one step each in turn, and the memory read by the next step of a walk is prefetched, so the cache
+ * misses of the walks overlap instead of following one another. A walk that reaches a sample prefetches its value
+ * and stores it at its next turn, then it's replaced by the next row of [k,l].
+ */
+void bwt_sa_batch(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t *out)
+{
+	uint64_t row[SA_BATCH_WALKS], t[SA_BATCH_WALKS], steps[SA_BATCH_WALKS], sample[SA_BATCH_WALKS];
+	uint64_t next = k, mask = bwt->sa_intv - 1;
+	int n = 0;
+
+	for (; n < SA_BATCH_WALKS && next <= l; ++n, ++next)
+	{
+		row[n] = t[n] = next;
+		steps[n] = 0;
+		sample[n] = (uint64_t) -1;
+		sa_batch_prefetch(bwt, next);
+	}
+	while (n > 0)
+	{
+		for (int i = 0; i < n;)
+		{
+			uint64_t r = row[i];
+			if (sample[i] == (uint64_t) -1 && r != 0)
+			{
+				if (bwt->sa_rank ? sa_marked(bwt->sa_rank, r) : (r & mask) == 0)
+				{
+					sample[i] = bwt->sa_rank ? sa_rank(bwt->sa_rank, r) : r / bwt->sa_intv;
+					__builtin_prefetch(bwt->sa_rank ? bwt->sa + (sample[i] * bwt->sa_width >> 6) : bwt->sa + sample[i]);
+				}
+				else
+				{
+					row[i] = bwt_invPsi(bwt, r);
+					++steps[i];
+					sa_batch_prefetch(bwt, row[i]);
+				}
+				++i;
+				continue;
+			}
+
+			// the walk is ended, the values are the same of bwt_sa and bwt_sa_text (the row 0 is the empty suffix)
+			if (r == 0)
+				out[t[i] - k] = steps[i] - 1;
+			else if (bwt->sa_rank)
+				out[t[i] - k] = steps[i] + sa_text_val(bwt, sample[i]) * bwt->sa_intv;
+			else
+				out[t[i] - k] = steps[i] + bwt->sa[sample[i]];
+
+			if (next <= l) // the next row takes its place
+			{
+				row[i] = t[i] = next++;
+				steps[i] = 0;
+				sample[i] = (uint64_t) -1;
+				sa_batch_prefetch(bwt, row[i]);
+				++i;
+			}
+			else // the last walk takes its place
+			{
+				--n;
+				row[i] = row[n];
+				t[i] = t[n];
+				steps[i] = steps[n];
+				sample[i] = sample[n];
+			}
+		}
+	}
+}
+
+/*
+ * Same of bwt_cal_sa, but the samples are the rows of the positions multiple of intv (text order) instead of the rows
+ * multiple of intv: the sampled rows are marked in sa_rank and the values p / intv of their positions are stored
+ * with sa_width bits, in the order of the rows. bwt_sa then needs at most intv - 1 steps for each row.
+ */
+void bwt_cal_sa_text(bwt_t *bwt, int intv)
+{
+	uint64_t isa, sa, i, n, *rows;
+	int intv_round = intv;
+
+	kv_roundup32(intv_round);
+	xassert(intv_round == intv, "SA sample interval is not a power of 2.");
+	xassert(bwt->bwt, "bwt_t::bwt is not initialized.");
+
+	free(bwt->sa);
+	free(bwt->sa_rank);
+	bwt->sa_intv = intv;
+	bwt->n_sa = n = sa_text_n(bwt->seq_len, intv);
+	bwt->sa_width = sa_text_width(n);
+	bwt->sa_rank = (uint64_t*) calloc(sa_rank_words(bwt->seq_len), sizeof(uint64_t));
+	bwt->sa = (uint64_t*) calloc(sa_val_words(n, bwt->sa_width), sizeof(uint64_t));
+
+	// row of each sampled position, the positions are visited from the last one as in bwt_cal_sa
+	rows = (uint64_t*) malloc(n * sizeof(uint64_t));
+	isa = 0;
+	sa = bwt->seq_len;
+	for (i = 0; i < bwt->seq_len; ++i)
+	{
+		--sa;
+		isa = bwt_invPsi(bwt, isa);
+		if (sa % intv == 0)
+			rows[sa / intv] = isa;
+	}
+
+	for (i = 0; i < n; ++i)
+		bwt->sa_rank[(rows[i] / SA_RANK_ROWS << 3) + 1 + (rows[i] % SA_RANK_ROWS >> 6)] |= 1ULL << (rows[i] & 63);
+	for (i = 8, n = 0; i < sa_rank_words(bwt->seq_len); i += 8) // SA_RANK_ROWS is a multiple of 64
+	{
+		for (int j = i - 7; j < i; ++j)
+			n += __builtin_popcountll(bwt->sa_rank[j]);
+		bwt->sa_rank[i] = n;
+	}
+
+	for (i = 0; i < bwt->n_sa; ++i)
+	{
+		uint64_t r = sa_rank(bwt->sa_rank, rows[i]), b = r * bwt->sa_width;
+		bwt->sa[b >> 6] |= i << (b & 63);
+		if ((b & 63) + bwt->sa_width > 64)
+			bwt->sa[(b >> 6) + 1] |= i >> (64 - (b & 63));
+	}
+	free(rows);
+}
+
 //It's the same method present in bwt.c
 static inline uint64_t bwt_invPsi(const bwt_t *bwt, uint64_t k) // compute inverse CSA
 {
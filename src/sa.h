@@ -93,6 +93,20 @@ typedef struct
 	int sa_intv;
 	bwtint_t n_sa;
 	bwtint_t *sa;
+	// text-order samples (see bwt_cal_sa_text): if sa_rank isn't NULL, sa has n_sa values of sa_width bits, one for each row marked in sa_rank
+	bwtint_t *sa_rank;
+	int sa_width;
+	// SA intervals of all the strings of length 1..kmi_q, optional (see kmer_index.c)
+	int kmi_q;
+	bwtint_t *kmi;
+	// cache-line layout of the occurrences (see bwt_occ_align in occ.c), if it's not NULL bwt is NULL; occ_line_type is the size of its lines
+	uint32_t *occ_line;
+	bwtint_t *occ_super;
+	int occ_line_type;
+	const struct occ_line_ops_s *occ_ops; // functions of the kernel for occ_line_type, NULL without occ_line (see bwt_occ_resolve)
+	// if they aren't NULL, bwt and sa are inside the mappings of the .bwt and .sa files (see bwa_idx_map_bwt)
+	void *bwt_map, *sa_map;
+	uint64_t bwt_map_len, sa_map_len;
 } bwt_t;
 
 #endif
@@ -104,9 +118,31 @@ typedef struct
 /* retrieve a character from the $-removed BWT string. Note that
  * bwt_t::bwt is not exactly the BWT string and therefore this macro is
  * called bwt_B0 instead of bwt_B */
-#define bwt_B0(b, k) (bwt_bwt(b, k)>>((~(k)&0xf)<<1)&3)
+#define bwt_B0(b, k) ((b)->occ_ops ? bwt_line_b0(b, k) : bwt_bwt(b, k)>>((~(k)&0xf)<<1)&3)
+
+
+//Text-order samples of the suffix array (see bwt_cal_sa_text)
+#define SA_TEXT_ORDER (1ULL << 32) // added to the interval inside the header of the .sa file
+#define SA_RANK_ROWS 448 // rows of a line of sa_rank (64 bytes): the marked rows before the line and 7 words of marks
+#define sa_rank_words(seq_len) (((seq_len) / SA_RANK_ROWS + 1) << 3)
+#define sa_text_n(seq_len, intv) (((seq_len) - 1) / (intv) + 1) // samples of the positions 0, intv, 2 * intv, ... < seq_len
+#define sa_val_words(n, width) ((((n) * (width) + 63) >> 6) + 1) // the last word is read only by sa_text_val
+
+//Bits of each value of the text-order samples: the sample of the position p stores p / intv < n
+static inline int sa_text_width(uint64_t n)
+{
+	int w = 1;
+	while (w < 64 && (n - 1) >> w)
+		++w;
+	return w;
+}
+
+#define SA_BATCH_WALKS 16 // walks of the rows that bwt_sa_batch goes on together
+#define SA_BATCH_ROWS 256 // rows located by each call of bwt_sa_batch during the searches
 
 uint64_t bwt_sa(const bwt_t *bwt, uint64_t k);
+void bwt_sa_batch(const bwt_t *bwt, uint64_t k, uint64_t l, uint64_t *out);
 void bwt_cal_sa(bwt_t *bwt, int intv);
+void bwt_cal_sa_text(bwt_t *bwt, int intv);
 
 #endif
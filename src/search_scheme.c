@@ -0,0 +1,244 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "bounded_backtracking_seach.h"
+#include "occ.h"
+
+extern int verbose_bound_backtracking_search;
+
+static void build_search(lib_aln_search_ctx_t* ctx, int first, int n_parts, int max_diff, int min_diff);
+static void run_search_steps(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+static bool report_scheme_hits(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx);
+
+static int comp_hit_k(const void * elem1, const void * elem2);
+static int comp_hit_mm(const void * elem1, const void * elem2);
+
+/*
+ * Engine based on the search schemes of Kucherov et al. (Approximate string matching using a bidirectional index, 2016),
+ * that uses the FMD-index as a bidirectional index: the bi-interval of a partial hit can be extended both on the left
+ * and on the right (see bwt_extend), so no second index is needed.
+ *
+ * The pattern is split in max_diff + 1 parts, so each hit has at least one part without mismatches: if i is the first
+ * of them, the search i matches part i exactly, then the parts i-1, ..., 0 (where the j-th has at least a mismatch, so
+ * after it the partial hit has at least j mismatches) and finally the parts i+1, ..., max_diff. In this way the
+ * mismatches are allowed only after that the SA interval has been narrowed by an exact match.
+ *
+ * A hit can be found by several searches, so the hits are sorted and the duplicates removed. The hits are the same of
+ * the backtracking and they are reported in increasing number of mismatches, but inside the same number of mismatches
+ * their order may be different.
+ */
+void search_scheme_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	input_query* info_seq = &ctx->seq;
+	const int max_diff = info_seq->max_diff;
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "Start search_scheme_match\n");
+
+	if (info_seq->type_search == ARBITRARY_HIT || info_seq->type_search == ALL_BEST_HIT || info_seq->type_search == UNIQUE_BEST_HIT)
+	{
+		/*
+		 * The backtracking returns a hit with the minimum number of mismatches, so the hits
+		 * with exactly d mismatches are searched only if there aren't hits with less mismatches
+		 * (for the best modes, if the stratum d has a hit, it's the last one)
+		 */
+		for (int d = 0; d <= max_diff; d++)
+		{
+			ctx->scheme_hits.n = 0;
+			for (int first = 0; first <= d; first++)
+			{
+				build_search(ctx, first, d + 1, d, d);
+				run_search_steps(idx, ctx);
+			}
+			if (report_scheme_hits(idx, ctx) || ctx->best_mm >= 0)
+				return;
+		}
+		return;
+	}
+
+	ctx->scheme_hits.n = 0;
+	for (int first = 0; first <= max_diff; first++)
+	{
+		build_search(ctx, first, max_diff + 1, max_diff, 0);
+		run_search_steps(idx, ctx);
+	}
+	report_scheme_hits(idx, ctx);
+}
+
+/*
+ * Store inside ctx->scheme_steps the steps of the search that starts from the part first (the pattern is
+ * split in n_parts parts). The hits of the search have at most max_diff and at least min_diff mismatches.
+ */
+static void build_search(lib_aln_search_ctx_t* ctx, int first, int n_parts, int max_diff, int min_diff)
+{
+	const uint32_t len = ctx->seq.len;
+
+	kv_reserve(scheme_step_t, ctx->scheme_steps, len);
+	ctx->scheme_steps.n = len;
+	scheme_step_t* steps = ctx->scheme_steps.a;
+	uint32_t n = 0;
+
+	//The part p is [p * len / n_parts, (p + 1) * len / n_parts)
+	for (int p = first; p >= 0; p--)
+	{
+		uint32_t beg = (uint64_t) p * len / n_parts;
+		uint32_t end = (uint64_t) (p + 1) * len / n_parts;
+
+		//From right to left, the part first must be matched exactly
+		for (uint32_t i = end; i > beg; i--, n++)
+		{
+			steps[n].pos = i - 1;
+			steps[n].is_back = 1;
+			steps[n].lo = 0;
+			steps[n].up = p == first ? 0 : max_diff;
+		}
+		//Each part on the left of first has at least one mismatch
+		steps[n - 1].lo = first - p;
+	}
+
+	//From left to right, the parts on the right of first
+	for (uint32_t i = (uint64_t) (first + 1) * len / n_parts; i < len; i++, n++)
+	{
+		steps[n].pos = i;
+		steps[n].is_back = 0;
+		steps[n].lo = 0;
+		steps[n].up = max_diff;
+	}
+
+	if (steps[len - 1].lo < min_diff)
+		steps[len - 1].lo = min_diff;
+}
+
+//Run the search stored inside ctx->scheme_steps, the hits found are added to ctx->scheme_hits
+static void run_search_steps(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	const bwt_t* bwt = idx->bwt;
+	const scheme_step_t* steps = ctx->scheme_steps.a;
+	const uint32_t n_steps = ctx->scheme_steps.n;
+	const ubyte_t* seq = ctx->seq.seq;
+	bwtintv_t ok[4];
+
+	//A previous search has reached the limits of the query
+	if (ctx->status & LIMIT_STOP_FLAGS)
+		return;
+
+	//Depth-first visit, the root is the empty string
+	ctx->scheme_stack.n = 0;
+	scheme_entry_t* root = kv_pushp(scheme_entry_t, ctx->scheme_stack);
+	root->ik.x[0] = root->ik.x[1] = 0;
+	root->ik.x[2] = bwt->seq_len + 1;
+	root->step = 0;
+	root->n_mm = 0;
+
+	while (ctx->scheme_stack.n)
+	{
+		scheme_entry_t e = ctx->scheme_stack.a[--ctx->scheme_stack.n];
+
+		if (e.step == n_steps)
+		{
+			scheme_hit_t* h = kv_pushp(scheme_hit_t, ctx->scheme_hits);
+			h->k = e.ik.x[0];
+			h->l = e.ik.x[0] + e.ik.x[2] - 1;
+			h->n_mm = e.n_mm;
+			continue;
+		}
+
+		if (search_ctx_expand(ctx))
+			return;
+
+		const scheme_step_t* st = &steps[e.step];
+		bwt_extend(bwt, &e.ik, ok, st->is_back);
+
+		//Try to extend the current partial hit with every possible base, N is always a mismatch
+		for (int c = 0; c < 4; c++)
+		{
+			const bwtintv_t* ik = st->is_back ? &ok[c] : &ok[3 - c];
+			int n_mm = e.n_mm + (c != seq[st->pos]);
+
+			if (ik->x[2] == 0 || n_mm > st->up || n_mm < st->lo)
+				continue;
+
+			scheme_entry_t* p = kv_pushp(scheme_entry_t, ctx->scheme_stack);
+			p->ik = *ik;
+			p->step = e.step + 1;
+			p->n_mm = n_mm;
+		}
+	}
+}
+
+/*
+ * Remove the duplicates from ctx->scheme_hits and handle each hit (see search_ctx_report_hit),
+ * in increasing number of mismatches. Return true if the search must be stopped.
+ */
+static bool report_scheme_hits(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	scheme_hit_t* hits = ctx->scheme_hits.a;
+	size_t n = 0;
+
+	if (ctx->scheme_hits.n == 0)
+		return false;
+
+	//Two hits with the same SA interval are the same string
+	qsort(hits, ctx->scheme_hits.n, sizeof(scheme_hit_t), comp_hit_k);
+	for (size_t i = 1; i < ctx->scheme_hits.n; i++)
+		if (hits[i].k != hits[n].k)
+			hits[++n] = hits[i];
+	ctx->scheme_hits.n = ++n;
+
+	qsort(hits, n, sizeof(scheme_hit_t), comp_hit_mm);
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "Number of SA intervals found by the search schemes: %zu\n", n);
+
+	for (size_t i = 0; i < n; i++)
+		if (search_ctx_report_hit(idx, ctx, hits[i].k, hits[i].l, hits[i].n_mm))
+			return true;
+
+	return false;
+}
+
+static int comp_hit_k(const void * elem1, const void * elem2)
+{
+	const scheme_hit_t* a = (const scheme_hit_t*) elem1;
+	const scheme_hit_t* b = (const scheme_hit_t*) elem2;
+
+	if (a->k == b->k)
+		return 0;
+	return a->k < b->k ? -1 : 1;
+}
+
+static int comp_hit_mm(const void * elem1, const void * elem2)
+{
+	const scheme_hit_t* a = (const scheme_hit_t*) elem1;
+	const scheme_hit_t* b = (const scheme_hit_t*) elem2;
+
+	if (a->n_mm != b->n_mm)
+		return a->n_mm < b->n_mm ? -1 : 1;
+	return comp_hit_k(elem1, elem2);
+}
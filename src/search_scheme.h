@@ -0,0 +1,58 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef SEARCH_SCHEME_H
+#define SEARCH_SCHEME_H
+
+#include <inttypes.h>
+#include "occ.h"
+
+/*
+ * A step of a search scheme: the base pos of the pattern is added on the left (is_back) or on the right
+ * of the partial hit, then its number of mismatches must be inside [lo,up].
+ */
+typedef struct
+{
+	uint32_t pos;
+	uint8_t is_back;
+	uint8_t lo, up;
+} scheme_step_t;
+
+//Partial hit of a search scheme: the first step bases of the search have been matched
+typedef struct
+{
+	bwtintv_t ik;
+	uint32_t step;
+	uint8_t n_mm;
+} scheme_entry_t;
+
+//Hit found by a search scheme: [k,l] is its SA interval
+typedef struct
+{
+	uint64_t k, l;
+	uint8_t n_mm;
+} scheme_hit_t;
+
+#endif
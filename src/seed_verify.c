@@ -0,0 +1,274 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "bounded_backtracking_seach.h"
+#include "sa.h"
+#include "occ.h"
+
+#define _get_pac(pac, l) ((pac)[(l)>>2]>>((~(l)&3)<<1)&3)
+
+extern int verbose_bound_backtracking_search;
+
+static void pack_pattern(lib_aln_search_ctx_t* ctx);
+static void add_candidates(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint32_t beg, uint32_t end);
+static int verify_candidate(const bwaidx_t* idx, const lib_aln_search_ctx_t* ctx, uint64_t pos);
+static inline uint64_t get_pac_word(const uint8_t* pac, int64_t l_pac, int64_t x);
+static inline uint8_t get_text_base(const uint8_t* pac, int64_t l_pac, int64_t x);
+
+static int comp_pos(const void * elem1, const void * elem2);
+static int comp_seed_hit(const void * elem1, const void * elem2);
+
+/*
+ * Seed and verify engine. The pattern is split in max_diff + 1 pieces: by the pigeonhole principle each hit contains
+ * at least one of them without mismatches (a piece that contains N always has a mismatch, so it isn't used).
+ * The exact occurrences of each piece (found by backward search and located with the SA) give the candidate start
+ * positions of the hits inside the text of the FMD-index. Each candidate is verified only once, counting the
+ * mismatches 32 bases at a time directly on the 2-bit encoded pac.
+ *
+ * The verified occurrences with the same string are the same hit: its SA interval is calculated and it's handled like
+ * a hit of the backtracking (see search_ctx_report_hit), so the results have the same semantics. The hits are reported
+ * in increasing number of mismatches.
+ */
+void seed_verify_match(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx)
+{
+	input_query* info_seq = &ctx->seq;
+	const uint32_t len = info_seq->len;
+	const int n_pieces = info_seq->max_diff + 1;
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "Start seed_verify_match\n");
+
+	pack_pattern(ctx);
+
+	//Candidate start positions of the hits, from the exact occurrences of each piece
+	ctx->seed_cand.n = 0;
+	for (int p = 0; p < n_pieces; p++)
+		add_candidates(idx, ctx, (uint64_t) p * len / n_pieces, (uint64_t) (p + 1) * len / n_pieces);
+
+	//An occurrence with several pieces without mismatches is verified once
+	qsort(ctx->seed_cand.a, ctx->seed_cand.n, sizeof(uint64_t), comp_pos);
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "Number of candidates (with duplicates): %zu\n", ctx->seed_cand.n);
+
+	ctx->seed_hits.n = ctx->seed_str.n = 0;
+	for (size_t i = 0; i < ctx->seed_cand.n; i++)
+	{
+		uint64_t pos = ctx->seed_cand.a[i];
+		if (i > 0 && pos == ctx->seed_cand.a[i - 1])
+			continue;
+		if (search_ctx_expand(ctx))
+			break;
+
+		int n_mm = verify_candidate(idx, ctx, pos);
+		if (n_mm > info_seq->max_diff)
+			continue;
+
+		seed_hit_t* h = kv_pushp(seed_hit_t, ctx->seed_hits);
+		h->pos = pos;
+		h->len = len;
+		h->n_mm = n_mm;
+
+		kv_reserve(uint8_t, ctx->seed_str, ctx->seed_str.n + len);
+		for (uint32_t j = 0; j < len; j++)
+			ctx->seed_str.a[ctx->seed_str.n++] = get_text_base(idx->pac, idx->bns->l_pac, pos + j);
+	}
+
+	//The pool of the strings doesn't change anymore
+	for (size_t i = 0; i < ctx->seed_hits.n; i++)
+		ctx->seed_hits.a[i].hit = ctx->seed_str.a + i * len;
+
+	//The occurrences of the same hit become adjacent
+	qsort(ctx->seed_hits.a, ctx->seed_hits.n, sizeof(seed_hit_t), comp_seed_hit);
+
+	for (size_t i = 0; i < ctx->seed_hits.n; i++)
+	{
+		const seed_hit_t* h = &ctx->seed_hits.a[i];
+		if (i > 0 && comp_seed_hit(h - 1, h) == 0)
+			continue;
+
+		//The hit is inside the index, so its SA interval is never empty
+		uint64_t k = 0, l = idx->bwt->seq_len;
+		bwt_match_exact_alt(idx->bwt, len, h->hit, &k, &l);
+
+		if (search_ctx_report_hit(idx, ctx, k, l, h->n_mm))
+			return;
+	}
+}
+
+/*
+ * Store inside ctx->seed_words the pattern and its r.c. packed 32 bases for each word, as in the pac (the first base
+ * in the most significant bits), followed by the masks where each N of the pattern and of its r.c. has the bits 01.
+ */
+static void pack_pattern(lib_aln_search_ctx_t* ctx)
+{
+	const ubyte_t* seq = ctx->seq.seq;
+	const uint32_t len = ctx->seq.len;
+	const uint32_t n_words = (len + 31) >> 5;
+
+	kv_reserve(uint64_t, ctx->seed_words, 4 * n_words);
+	ctx->seed_words.n = 4 * n_words;
+	uint64_t* w = ctx->seed_words.a;
+	memset(w, 0, 4 * n_words * sizeof(uint64_t));
+
+	for (uint32_t j = 0; j < len; j++)
+	{
+		int shift = (~j & 31) << 1;
+		uint8_t c = seq[j], c_rc = seq[len - j - 1];
+
+		if (c < 4)
+			w[j >> 5] |= (uint64_t) c << shift;
+		else
+			w[2 * n_words + (j >> 5)] |= 1ULL << shift;
+
+		if (c_rc < 4)
+			w[n_words + (j >> 5)] |= (uint64_t) (3 - c_rc) << shift;
+		else
+			w[3 * n_words + (j >> 5)] |= 1ULL << shift;
+	}
+}
+
+//Add to ctx->seed_cand the start positions of the pattern given by the exact occurrences of its bases [beg,end)
+static void add_candidates(const bwaidx_t* idx, lib_aln_search_ctx_t* ctx, uint32_t beg, uint32_t end)
+{
+	uint64_t k = 0, l = idx->bwt->seq_len;
+
+	//No exact occurrences (also if the piece contains N)
+	if (bwt_match_exact_alt(idx->bwt, end - beg, ctx->seq.seq + beg, &k, &l) == 0)
+		return;
+
+	kv_reserve(uint64_t, ctx->seed_cand, ctx->seed_cand.n + (l - k + 1));
+	uint64_t sa_rows[SA_BATCH_ROWS];
+	for (uint64_t t = k; t <= l; t += SA_BATCH_ROWS)
+	{
+		//Positions of the piece inside the text of the FMD-index (forward strand followed by r.c. strand)
+		uint64_t n_rows = l - t + 1 < SA_BATCH_ROWS ? l - t + 1 : SA_BATCH_ROWS;
+		bwt_sa_batch(idx->bwt, t, t + n_rows - 1, sa_rows);
+
+		for (uint64_t j = 0; j < n_rows; j++)
+		{
+			//Each located occurrence is an expansion of the query
+			if (search_ctx_expand(ctx))
+				return;
+
+			//The pattern must be inside the text
+			uint64_t pos = sa_rows[j];
+			if (pos < beg || pos - beg + ctx->seq.len > (uint64_t) idx->bns->l_pac << 1)
+				continue;
+
+			ctx->seed_cand.a[ctx->seed_cand.n++] = pos - beg;
+		}
+	}
+}
+
+/*
+ * Number of mismatches between the pattern and the text of the FMD-index that starts at pos.
+ * It stops counting when they are more than max_diff.
+ */
+static int verify_candidate(const bwaidx_t* idx, const lib_aln_search_ctx_t* ctx, uint64_t pos)
+{
+	const int64_t l_pac = idx->bns->l_pac;
+	const uint32_t len = ctx->seq.len;
+	const int max_diff = ctx->seq.max_diff;
+	int n_mm = 0;
+
+	//Occurrence that bridges the two strands: it's compared base by base
+	if (pos < l_pac && pos + len > l_pac)
+	{
+		for (uint32_t j = 0; j < len && n_mm <= max_diff; j++)
+			n_mm += get_text_base(idx->pac, l_pac, pos + j) != ctx->seq.seq[j];
+		return n_mm;
+	}
+
+	/*
+	 * Inside the r.c. strand the text is the r.c. of the forward strand that starts at x,
+	 * so the r.c. of the pattern is compared with the forward strand
+	 */
+	const uint32_t n_words = (len + 31) >> 5;
+	const bool is_rc = pos >= l_pac;
+	const int64_t x = is_rc ? (l_pac << 1) - pos - len : (int64_t) pos;
+	const uint64_t* pattern = ctx->seed_words.a + (is_rc ? n_words : 0);
+	const uint64_t* n_mask = ctx->seed_words.a + (is_rc ? 3 : 2) * n_words;
+
+	for (uint32_t i = 0; i < n_words && n_mm <= max_diff; i++)
+	{
+		uint64_t d = get_pac_word(idx->pac, l_pac, x + (i << 5)) ^ pattern[i];
+
+		//Bits 01 for each different base (or N of the pattern)
+		d = ((d | d >> 1) & 0x5555555555555555ULL) | n_mask[i];
+
+		//Only the bases of the pattern
+		if (len - (i << 5) < 32)
+			d &= ~0ULL << ((32 - (len - (i << 5))) << 1);
+
+		n_mm += __builtin_popcountll(d);
+	}
+	return n_mm;
+}
+
+//32 bases of the forward strand starting at x, the first base in the most significant bits (0 after the end)
+static inline uint64_t get_pac_word(const uint8_t* pac, int64_t l_pac, int64_t x)
+{
+	const int64_t n_bytes = (l_pac + 3) >> 2;
+	const int64_t b = x >> 2;
+	const int shift = (x & 3) << 1;
+	uint64_t w = 0;
+
+	//The 9 bytes that contain the 32 bases
+	for (int i = 0; i < 8; i++)
+		w = w << 8 | (b + i < n_bytes ? pac[b + i] : 0);
+	if (shift)
+		w = w << shift | (b + 8 < n_bytes ? pac[b + 8] : 0) >> (8 - shift);
+
+	return w;
+}
+
+//Base x of the text of the FMD-index
+static inline uint8_t get_text_base(const uint8_t* pac, int64_t l_pac, int64_t x)
+{
+	return x < l_pac ? _get_pac(pac, x) : 3 - _get_pac(pac, (l_pac << 1) - 1 - x);
+}
+
+static int comp_pos(const void * elem1, const void * elem2)
+{
+	if (*(uint64_t*) elem1 == *(uint64_t*) elem2)
+		return 0;
+	return *(uint64_t*) elem1 < *(uint64_t*) elem2 ? -1 : 1;
+}
+
+//By number of mismatches, then by string
+static int comp_seed_hit(const void * elem1, const void * elem2)
+{
+	const seed_hit_t* a = (const seed_hit_t*) elem1;
+	const seed_hit_t* b = (const seed_hit_t*) elem2;
+
+	if (a->n_mm != b->n_mm)
+		return a->n_mm < b->n_mm ? -1 : 1;
+	return memcmp(a->hit, b->hit, a->len);
+}
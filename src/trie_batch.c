@@ -0,0 +1,228 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "bounded_backtracking_seach.h"
+#include "trie_batch.h"
+#include "occ.h"
+
+extern int verbose_bound_backtracking_search;
+
+static uint32_t new_node(trie_batch_t* t);
+static int comp_trie_hit(const void * elem1, const void * elem2);
+
+/*
+ * Batch search on the trie of the patterns: the patterns that share a prefix (of the string that is searched, so a
+ * suffix of the r.c.) share also the partial hits of that prefix, so each rank query on the BWT is done once for
+ * all of them instead of once for each pattern.
+ */
+trie_batch_t* trie_batch_init(const uint32_t n_patterns)
+{
+	trie_batch_t* t = (trie_batch_t*) calloc(1, sizeof(trie_batch_t));
+
+	kv_reserve(uint32_t, t->next_end, n_patterns);
+	t->next_end.n = n_patterns;
+	kv_reserve(size_t, t->hits_offset, n_patterns + 1);
+	t->hits_offset.n = n_patterns + 1;
+	memset(t->hits_offset.a, 0, t->hits_offset.n * sizeof(size_t));
+
+	//Root
+	new_node(t);
+
+	return t;
+}
+
+void trie_batch_destroy(trie_batch_t* t)
+{
+	if (t == 0)
+		return;
+
+	kv_destroy(t->nodes);
+	kv_destroy(t->next_end);
+	kv_destroy(t->stack);
+	kv_destroy(t->hits);
+	kv_destroy(t->pattern_hits);
+	kv_destroy(t->hits_offset);
+	free(t);
+}
+
+/*
+ * Insert the encoded pattern seq (see search_ctx_prepare) with index id, width is calculated by cal_width.
+ * Like the backtracking the bases are searched from seq[len - 1] to seq[0], so the node at depth d
+ * still needs at least width[len - d - 1].bid mismatches for this pattern.
+ */
+void trie_batch_add(trie_batch_t* t, const uint32_t id, const ubyte_t* seq, const uint32_t len, const bwt_width_t* width)
+{
+	uint32_t x = 0;
+
+	for (uint32_t d = 0; d < len; d++)
+	{
+		if (t->nodes.a[x].min_bid > width[len - d - 1].bid)
+			t->nodes.a[x].min_bid = width[len - d - 1].bid;
+
+		int c = seq[len - d - 1] > 3 ? 4 : seq[len - d - 1];
+		if (t->nodes.a[x].child[c] == 0)
+		{
+			uint32_t y = new_node(t);
+			t->nodes.a[x].child[c] = y;
+		}
+		x = t->nodes.a[x].child[c];
+	}
+
+	//Nothing is left to match
+	t->nodes.a[x].min_bid = 0;
+
+	t->next_end.a[id] = t->nodes.a[x].first_end;
+	t->nodes.a[x].first_end = id;
+}
+
+/*
+ * Depth-first search of the trie on the FMD-index. For each node, the occurrences of the bases are calculated
+ * once and then they are used by all the children, the node is pruned if its partial hit plus the lower bound
+ * of its patterns exceeds max_diff. All the hits (with at most max_diff mismatches) of every pattern are found,
+ * then they are grouped by pattern and sorted by number of mismatches (see trie_batch_hits).
+ */
+void trie_batch_match(const bwaidx_t* idx, trie_batch_t* t, const int max_diff)
+{
+	const bwt_t* bwt = idx->bwt;
+	trie_entry_t e;
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "Start trie_batch_match, number of nodes: %zu\n", t->nodes.n);
+
+	t->hits.n = t->stack.n = 0;
+
+	e.k = 0;
+	e.l = bwt->seq_len;
+	e.node = 0;
+	e.n_mm = 0;
+	kv_push(trie_entry_t, t->stack, e);
+
+	while (t->stack.n)
+	{
+		e = kv_pop(t->stack);
+		const trie_node_t* x = &t->nodes.a[e.node];
+
+		if (e.n_mm + x->min_bid > max_diff)
+			continue;
+
+		//The patterns that end in this node have a hit
+		for (uint32_t p = x->first_end; p != UINT32_MAX; p = t->next_end.a[p])
+		{
+			trie_hit_t h;
+			h.pattern = p;
+			h.h.k = e.k;
+			h.h.l = e.l;
+			h.h.n_mm = e.n_mm;
+			kv_push(trie_hit_t, t->hits, h);
+		}
+
+		uint64_t cnt_k[4], cnt_l[4];
+		bool is_leaf = true;
+		for (int b = 0; b < 5; b++)
+			if (x->child[b])
+				is_leaf = false;
+		if (is_leaf)
+			continue;
+
+		bwt_2occ4(bwt, e.k - 1, e.l, cnt_k, cnt_l);
+
+		for (int c = 0; c < 4; c++)
+		{
+			uint64_t k = bwt->L2[c] + cnt_k[c] + 1;
+			uint64_t l = bwt->L2[c] + cnt_l[c];
+			if (k > l)
+				continue;
+
+			//x can be invalidated by the push, so the node is read again
+			for (int b = 0; b < 5; b++)
+			{
+				uint32_t y = t->nodes.a[e.node].child[b];
+				int n_mm = e.n_mm + (b != c);
+				if (y == 0 || n_mm > max_diff)
+					continue;
+
+				trie_entry_t f;
+				f.k = k;
+				f.l = l;
+				f.node = y;
+				f.n_mm = n_mm;
+				kv_push(trie_entry_t, t->stack, f);
+			}
+		}
+	}
+
+	qsort(t->hits.a, t->hits.n, sizeof(trie_hit_t), comp_trie_hit);
+
+	memset(t->hits_offset.a, 0, t->hits_offset.n * sizeof(size_t));
+	for (size_t i = 0; i < t->hits.n; i++)
+		t->hits_offset.a[t->hits.a[i].pattern + 1]++;
+	for (size_t i = 1; i < t->hits_offset.n; i++)
+		t->hits_offset.a[i] += t->hits_offset.a[i - 1];
+
+	kv_reserve(scheme_hit_t, t->pattern_hits, t->hits.n);
+	t->pattern_hits.n = t->hits.n;
+	for (size_t i = 0; i < t->hits.n; i++)
+		t->pattern_hits.a[i] = t->hits.a[i].h;
+
+	if (verbose_bound_backtracking_search > 2)
+		fprintf(stderr, "End trie_batch_match, number of SA intervals found: %zu\n", t->hits.n);
+}
+
+//Hits of the pattern id found by trie_batch_match, in increasing number of mismatches
+const scheme_hit_t* trie_batch_hits(const trie_batch_t* t, const uint32_t id, size_t* n_hits)
+{
+	*n_hits = t->hits_offset.a[id + 1] - t->hits_offset.a[id];
+	return t->pattern_hits.a + t->hits_offset.a[id];
+}
+
+static uint32_t new_node(trie_batch_t* t)
+{
+	trie_node_t x;
+
+	memset(x.child, 0, sizeof(x.child));
+	x.first_end = UINT32_MAX;
+	x.min_bid = INT32_MAX;
+	kv_push(trie_node_t, t->nodes, x);
+
+	return t->nodes.n - 1;
+}
+
+static int comp_trie_hit(const void * elem1, const void * elem2)
+{
+	const trie_hit_t* a = (const trie_hit_t*) elem1;
+	const trie_hit_t* b = (const trie_hit_t*) elem2;
+
+	if (a->pattern != b->pattern)
+		return a->pattern < b->pattern ? -1 : 1;
+	if (a->h.n_mm != b->h.n_mm)
+		return a->h.n_mm < b->h.n_mm ? -1 : 1;
+	if (a->h.k == b->h.k)
+		return 0;
+	return a->h.k < b->h.k ? -1 : 1;
+}
@@ -0,0 +1,68 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#ifndef TRIE_BATCH_H
+#define TRIE_BATCH_H
+
+#include <inttypes.h>
+#include "kvec.h"
+#include "search_scheme.h"
+
+/*
+ * Node of the trie of the encoded patterns of a batch, the bases are inserted in the order in which they are searched.
+ * child[c] is the node reached with the base c (A,C,G,T,N), 0 if it doesn't exist (the root is never a child).
+ */
+typedef struct
+{
+	uint32_t child[5];
+	uint32_t first_end; //first pattern that ends in this node, UINT32_MAX if none
+	int min_bid; //lower bound of the mismatches still necessary to every pattern that passes through this node
+} trie_node_t;
+
+//Partial hit of the batch search: the bases from the root to node have been matched and [k,l] is its SA interval
+typedef struct
+{
+	uint64_t k, l;
+	uint32_t node;
+	uint8_t n_mm;
+} trie_entry_t;
+
+//Hit of the pattern with index pattern
+typedef struct
+{
+	uint32_t pattern;
+	scheme_hit_t h;
+} trie_hit_t;
+
+typedef struct
+{
+	kvec_t(trie_node_t) nodes;
+	kvec_t(uint32_t) next_end; //for each pattern, the next pattern that ends in the same node
+	kvec_t(trie_entry_t) stack;
+	kvec_t(trie_hit_t) hits;
+	kvec_t(scheme_hit_t) pattern_hits; //hits without the index of the pattern, in the same order
+	kvec_t(size_t) hits_offset; //the hits of the pattern i are pattern_hits[hits_offset[i], hits_offset[i + 1])
+} trie_batch_t;
+
+#endif
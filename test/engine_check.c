@@ -0,0 +1,1174 @@
+/* The MIT License
+
+ Copyright (c) 2019 Mattia Marcolin.
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+/*
+ * Regression check of the searches. The occurrences found by the backtracking, the search schemes (SEARCH_SCHEME) and
+ * the seeds (SEED_AND_VERIFY) are compared with the ones of a brute force scan of the reference (pac), for ALL_HITS,
+ * ALL_BEST_HIT and COUNT_ONLY, with and without the reverse complement. The index is built with the samples of the
+ * suffix array of lib_aln_index and with text-order samples, and it's loaded by lib_aln_idx_load, lib_aln_idx_load_mmap,
+ * lib_aln_idx_load_lazy and lib_aln_idx_load_packed. The other functions of the library are compared with the same
+ * brute force, or with the functions already checked (see checks).
+ *
+ * The patterns are substrings of the reference, their copies with some mismatches and the strings that bridge the
+ * forward and the reverse complement strand. Without arguments the reference is generated, with repeats and several
+ * sequences. The index files are written inside a temporary directory, removed at the end.
+ *
+ * Usage: engine_check [genome in FASTA format] [number of patterns, default 200]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../src/lib_aln_inexact_matching.h"
+#include "../src/occ.h"
+#include "../src/index_image.h"
+
+#define MAX_MISMATCHES 3
+#define MIN_LEN 3
+#define MAX_LEN 24
+
+#define get_pac(pac, l) ((pac)[(l)>>2]>>((~(l)&3)<<1)&3)
+
+//An occurrence: position (1-based, as the hits), strand and number of mismatches
+typedef struct
+{
+	uint64_t pos;
+	int is_rev_comp, n_mm;
+} occ_t;
+
+typedef struct
+{
+	size_t n, m;
+	occ_t *a;
+} occ_v;
+
+typedef struct
+{
+	int n;
+	char **a;
+} pattern_v;
+
+//A check of the searches of the patterns with the index of prefix, it returns the number of failed searches
+typedef int (*check_f)(const bwaidx_t *idx, const char *prefix, const pattern_v *pv);
+
+static const uint8_t type_search[] = { 0, SEARCH_SCHEME, SEED_AND_VERIFY };
+static const char *engine_name[] = { "backtracking", "search schemes", "seed and verify" };
+
+static uint64_t rand_state = 11;
+
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return rand_state >> 33;
+}
+
+static void occ_push(occ_v *v, uint64_t pos, int is_rev_comp, int n_mm)
+{
+	if (v->n == v->m)
+	{
+		v->m = v->m ? v->m << 1 : 64;
+		v->a = (occ_t*) realloc(v->a, v->m * sizeof(occ_t));
+	}
+	v->a[v->n].pos = pos;
+	v->a[v->n].is_rev_comp = is_rev_comp;
+	v->a[v->n++].n_mm = n_mm;
+}
+
+static int comp_occ(const void *elem1, const void *elem2)
+{
+	const occ_t *a = (const occ_t*) elem1, *b = (const occ_t*) elem2;
+	if (a->pos != b->pos)
+		return a->pos < b->pos ? -1 : 1;
+	if (a->is_rev_comp != b->is_rev_comp)
+		return a->is_rev_comp - b->is_rev_comp;
+	return a->n_mm - b->n_mm;
+}
+
+static int same_occ(occ_v *a, occ_v *b)
+{
+	qsort(a->a, a->n, sizeof(occ_t), comp_occ);
+	qsort(b->a, b->n, sizeof(occ_t), comp_occ);
+	return a->n == b->n && (a->n == 0 || memcmp(a->a, b->a, a->n * sizeof(occ_t)) == 0);
+}
+
+static inline int base_code(char c)
+{
+	return c == 'A' ? 0 : c == 'C' ? 1 : c == 'G' ? 2 : 3;
+}
+
+//Occurrences of the pattern (and of its reverse complement) with at most max_mm mismatches, on the forward strand of the pac
+static void brute_force(const bwaidx_t *idx, const char *pattern, int max_mm, int type_output, occ_v *v)
+{
+	const int64_t l_pac = idx->bns->l_pac;
+	const int len = strlen(pattern);
+	v->n = 0;
+	for (int64_t i = 0; i + len <= l_pac; i++)
+		for (int s = 0; s <= (type_output == ALLOW_REV_COMP); s++)
+		{
+			int n_mm = 0;
+			for (int j = 0; j < len && n_mm <= max_mm; j++)
+				n_mm += get_pac(idx->pac, i + j) != (s ? 3 - base_code(pattern[len - 1 - j]) : base_code(pattern[j]));
+			if (n_mm <= max_mm)
+				occ_push(v, i + 1, s, n_mm);
+		}
+}
+
+//Keep only the occurrences with the minimum number of mismatches, return it (-1 without occurrences)
+static int best_occ(occ_v *v)
+{
+	int best_mm = -1;
+	size_t i, n;
+	for (i = 0; i < v->n; i++)
+		if (best_mm < 0 || v->a[i].n_mm < best_mm)
+			best_mm = v->a[i].n_mm;
+	for (i = n = 0; i < v->n; i++)
+		if (v->a[i].n_mm == best_mm)
+			v->a[n++] = v->a[i];
+	v->n = n;
+	return best_mm;
+}
+
+static void result_set_occ(const lib_aln_result_set_t *rs, occ_v *v)
+{
+	const lib_aln_hit_t *h = lib_aln_rs_hits(rs);
+	v->n = 0;
+	for (uint32_t i = 0; i < rs->n_hits; i++)
+		for (uint32_t j = 0; j < h[i].num_occur; j++)
+			occ_push(v, lib_aln_rs_positions(rs, h + i)[j], h[i].is_rev_comp, h[i].n_mismatches);
+}
+
+//The engines with ALL_HITS, ALL_BEST_HIT and COUNT_ONLY give the occurrences of the brute force
+static int check_engines(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	occ_v exp = { 0, 0, 0 }, best = { 0, 0, 0 }, got = { 0, 0, 0 };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+	{
+		const char *pattern = pv->a[i];
+		for (int max_mm = 0; max_mm <= MAX_MISMATCHES && max_mm <= (strlen(pattern) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+			{
+				uint64_t counts[MAX_MISMATCHES + 1] = { 0 };
+				brute_force(idx, pattern, max_mm, type_output, &exp);
+				for (size_t j = 0; j < exp.n; j++)
+					counts[exp.a[j].n_mm]++;
+				best.n = 0;
+				for (size_t j = 0; j < exp.n; j++)
+					occ_push(&best, exp.a[j].pos, exp.a[j].is_rev_comp, exp.a[j].n_mm);
+				best_occ(&best);
+
+				for (int e = 0; e < 3; e++)
+				{
+					const lib_aln_result_set_t *rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, ALL_HITS | type_search[e], type_output);
+					result_set_occ(rs, &got);
+					if (!same_occ(&exp, &got))
+					{
+						fprintf(stderr, "ALL_HITS of %s with %d mismatch(es), %s, type_output %d: %zu occurrences instead of %zu\n", pattern,
+								max_mm, engine_name[e], type_output, got.n, exp.n);
+						n_failed++;
+					}
+
+					rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, ALL_BEST_HIT | type_search[e], type_output);
+					result_set_occ(rs, &got);
+					if (!same_occ(&best, &got))
+					{
+						fprintf(stderr, "ALL_BEST_HIT of %s with %d mismatch(es), %s, type_output %d: %zu occurrences instead of %zu\n", pattern,
+								max_mm, engine_name[e], type_output, got.n, best.n);
+						n_failed++;
+					}
+
+					rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, COUNT_ONLY | type_search[e], type_output);
+					for (int j = 0; j <= max_mm; j++)
+						if (lib_aln_rs_counts(rs)[j] != counts[j])
+						{
+							fprintf(stderr, "COUNT_ONLY of %s with %d mismatch(es), %s, type_output %d: %" PRIu64 " occurrences with %d mismatch(es) instead of %" PRIu64 "\n",
+									pattern, max_mm, engine_name[e], type_output, lib_aln_rs_counts(rs)[j], j, counts[j]);
+							n_failed++;
+							break;
+						}
+				}
+			}
+	}
+
+	free(exp.a);
+	free(best.a);
+	free(got.a);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+//Positions of the intervals of a result set of lib_aln_bound_backtracking_sa, located by the iterator at most n_iter (<= 64) at a time
+static void interval_occ(const bwaidx_t *idx, const lib_aln_result_set_t *rs, occ_v *v, uint32_t n_iter)
+{
+	lib_aln_pos_iter_t it;
+	uint64_t pos[64];
+	bool is_rev_comp[64];
+	uint32_t n;
+	v->n = 0;
+	for (uint64_t i = 0; i < rs->n_intervals; i++)
+	{
+		lib_aln_pos_iter_init(&it, idx, lib_aln_rs_intervals(rs) + i);
+		while ((n = lib_aln_pos_iter_next(&it, pos, is_rev_comp, n_iter)) > 0)
+			for (uint32_t j = 0; j < n; j++)
+				occ_push(v, pos[j], is_rev_comp[j], lib_aln_rs_intervals(rs)[i].n_mismatches);
+	}
+}
+
+//Every occurrence of got is inside exp
+static int inside_occ(const occ_v *exp, const occ_v *got)
+{
+	for (size_t i = 0; i < got->n; i++)
+	{
+		size_t j = 0;
+		while (j < exp->n && comp_occ(exp->a + j, got->a + i) != 0)
+			j++;
+		if (j == exp->n)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * ARBITRARY_HIT gives some occurrences of the brute force (none only without occurrences), UNIQUE_BEST_HIT the best one
+ * if it's unique (otherwise the count 2 of its mismatches). With lib_aln_bound_backtracking_sa, ALL_BEST_HIT and
+ * ARBITRARY_HIT must stop only at an interval with positions, even when all the first ones are r.c. or bridge the strands.
+ */
+static int check_best_modes(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	occ_v exp = { 0, 0, 0 }, best = { 0, 0, 0 }, got = { 0, 0, 0 };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+	{
+		const char *pattern = pv->a[i];
+		for (int max_mm = 0; max_mm <= MAX_MISMATCHES && max_mm <= (strlen(pattern) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+			{
+				brute_force(idx, pattern, max_mm, type_output, &exp);
+				best.n = 0;
+				for (size_t j = 0; j < exp.n; j++)
+					occ_push(&best, exp.a[j].pos, exp.a[j].is_rev_comp, exp.a[j].n_mm);
+				int best_mm = best_occ(&best);
+
+				for (int e = 0; e < 3; e++)
+				{
+					const lib_aln_result_set_t *rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, ARBITRARY_HIT | type_search[e], type_output);
+					result_set_occ(rs, &got);
+					if ((got.n == 0) != (exp.n == 0) || !inside_occ(&exp, &got))
+					{
+						fprintf(stderr, "ARBITRARY_HIT of %s with %d mismatch(es), %s, type_output %d: %zu occurrences not of the brute force\n", pattern,
+								max_mm, engine_name[e], type_output, got.n);
+						n_failed++;
+					}
+
+					rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, UNIQUE_BEST_HIT | type_search[e], type_output);
+					result_set_occ(rs, &got);
+					if (best.n == 1 ? !same_occ(&best, &got) : got.n != 0 || (best.n > 1 && lib_aln_rs_counts(rs)[best_mm] != 2))
+					{
+						fprintf(stderr, "UNIQUE_BEST_HIT of %s with %d mismatch(es), %s, type_output %d: %zu occurrences, %zu best occurrences\n", pattern,
+								max_mm, engine_name[e], type_output, got.n, best.n);
+						n_failed++;
+					}
+
+					rs = lib_aln_bound_backtracking_sa(ctx, idx, pattern, max_mm, ALL_BEST_HIT | type_search[e], type_output);
+					interval_occ(idx, rs, &got, 7);
+					if (!same_occ(&best, &got))
+					{
+						fprintf(stderr, "ALL_BEST_HIT of %s with %d mismatch(es), %s, type_output %d, intervals: %zu occurrences instead of %zu\n",
+								pattern, max_mm, engine_name[e], type_output, got.n, best.n);
+						n_failed++;
+					}
+
+					rs = lib_aln_bound_backtracking_sa(ctx, idx, pattern, max_mm, ARBITRARY_HIT | type_search[e], type_output);
+					interval_occ(idx, rs, &got, 7);
+					if ((got.n == 0) != (exp.n == 0) || !inside_occ(&exp, &got))
+					{
+						fprintf(stderr, "ARBITRARY_HIT of %s with %d mismatch(es), %s, type_output %d, intervals: %zu occurrences not of the brute force\n",
+								pattern, max_mm, engine_name[e], type_output, got.n);
+						n_failed++;
+					}
+				}
+			}
+	}
+
+	free(exp.a);
+	free(best.a);
+	free(got.a);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+/*
+ * Under the limits the occurrences (and the counts of COUNT_ONLY) are a part of the ones of the brute force,
+ * all of them if no limit is reached.
+ */
+static int check_limits(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const lib_aln_limits_t limits[] = { { 2, 0, 0, 0 }, { 0, 5, 0, 0 }, { 0, 0, 3, 0 }, { 0, 0, 40, 0 }, { 0, 0, 0, 1e-9 } };
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	occ_v exp = { 0, 0, 0 }, got = { 0, 0, 0 };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+	{
+		const char *pattern = pv->a[i];
+		for (int max_mm = 0; max_mm <= MAX_MISMATCHES && max_mm <= (strlen(pattern) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+			{
+				uint64_t counts[MAX_MISMATCHES + 1] = { 0 };
+				brute_force(idx, pattern, max_mm, type_output, &exp);
+				for (size_t j = 0; j < exp.n; j++)
+					counts[exp.a[j].n_mm]++;
+
+				for (int e = 0; e < 3; e++)
+					for (int m = 0; m < sizeof(limits) / sizeof(limits[0]); m++)
+					{
+						lib_aln_search_ctx_set_limits(ctx, limits + m);
+						const lib_aln_result_set_t *rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, ALL_HITS | type_search[e], type_output);
+						result_set_occ(rs, &got);
+						if (!inside_occ(&exp, &got) || (rs->status == 0 && got.n != exp.n))
+						{
+							fprintf(stderr, "ALL_HITS of %s with %d mismatch(es), %s, type_output %d, limits %d: %zu occurrences of %zu, status %u\n",
+									pattern, max_mm, engine_name[e], type_output, m, got.n, exp.n, rs->status);
+							n_failed++;
+						}
+
+						rs = lib_aln_bound_backtracking_rs(ctx, idx, pattern, max_mm, COUNT_ONLY | type_search[e], type_output);
+						for (int j = 0; j <= max_mm; j++)
+							if (lib_aln_rs_counts(rs)[j] > counts[j] || (rs->status == 0 && lib_aln_rs_counts(rs)[j] != counts[j]))
+							{
+								fprintf(stderr, "COUNT_ONLY of %s with %d mismatch(es), %s, type_output %d, limits %d: %" PRIu64 " occurrences with %d mismatch(es) of %" PRIu64 ", status %u\n",
+										pattern, max_mm, engine_name[e], type_output, m, lib_aln_rs_counts(rs)[j], j, counts[j], rs->status);
+								n_failed++;
+								break;
+							}
+					}
+			}
+	}
+
+	free(exp.a);
+	free(got.a);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+static int same_hit(const lib_aln_result_set_t *a, const lib_aln_hit_t *ha, const lib_aln_result_set_t *b, const lib_aln_hit_t *hb)
+{
+	return ha->num_occur == hb->num_occur && ha->n_mismatches == hb->n_mismatches && ha->is_rev_comp == hb->is_rev_comp
+		&& memcmp(lib_aln_rs_positions(a, ha), lib_aln_rs_positions(b, hb), ha->num_occur * sizeof(uint64_t)) == 0
+		&& memcmp(lib_aln_rs_different_positions(a, ha), lib_aln_rs_different_positions(b, hb), ha->n_mismatches * sizeof(uint32_t)) == 0
+		&& strcmp(lib_aln_rs_hit_string(a, ha), lib_aln_rs_hit_string(b, hb)) == 0;
+}
+
+/*
+ * The hits (with their strings and different positions), the counts and the status of two result sets are the same.
+ * The order of the hits depends on the order of the visit (for example of the trie), so it isn't compared.
+ */
+static int same_rs(const lib_aln_result_set_t *a, const lib_aln_result_set_t *b)
+{
+	if (a == 0 || b == 0)
+		return a == b;
+	if (a->n_hits != b->n_hits || a->n_counts != b->n_counts || a->status != b->status
+		|| memcmp(lib_aln_rs_counts(a), lib_aln_rs_counts(b), a->n_counts * sizeof(uint64_t)) != 0)
+		return 0;
+
+	//The string and the strand identify a hit
+	for (uint32_t i = 0; i < a->n_hits; i++)
+	{
+		uint32_t j = 0;
+		while (j < b->n_hits && !same_hit(a, lib_aln_rs_hits(a) + i, b, lib_aln_rs_hits(b) + j))
+			j++;
+		if (j == b->n_hits)
+			return 0;
+	}
+	return 1;
+}
+
+//A search of a set of patterns, it returns a result set for each pattern
+typedef lib_aln_result_set_t** (*batch_f)(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm, uint8_t type_search,
+											uint8_t type_output);
+
+/*
+ * The result sets of a batch search are the same of lib_aln_bound_backtracking_rs, for the modes whose hits don't depend
+ * on the order of the search (not ARBITRARY_HIT)
+ */
+static int check_batch_f(const bwaidx_t *idx, const pattern_v *pv, const char *name, batch_f f)
+{
+	static const uint8_t types[] = { ALL_HITS, COUNT_ONLY, ALL_BEST_HIT, UNIQUE_BEST_HIT };
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	const char **patterns = (const char**) malloc(pv->n * sizeof(char*));
+	int n_failed = 0;
+
+	for (int max_mm = 0; max_mm <= 2; max_mm++)
+	{
+		//The same patterns of check_engines
+		uint32_t n = 0;
+		for (int i = 0; i < pv->n; i++)
+			if (strlen(pv->a[i]) >= 2 * max_mm + 1)
+				patterns[n++] = pv->a[i];
+
+		for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+			for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+				for (int e = 0; e < 3; e++)
+				{
+					lib_aln_result_set_t **results = f(idx, patterns, n, max_mm, types[t] | type_search[e], type_output);
+					for (uint32_t i = 0; i < n; i++)
+						if (!same_rs(results[i], lib_aln_bound_backtracking_rs(ctx, idx, patterns[i], max_mm, types[t] | type_search[e], type_output)))
+						{
+							fprintf(stderr, "%s of %s with %d mismatch(es), %s, type_search %d, type_output %d: not the hits of lib_aln_bound_backtracking_rs\n",
+									name, patterns[i], max_mm, engine_name[e], types[t], type_output);
+							n_failed++;
+						}
+					lib_aln_batch_destroy(results, n);
+				}
+	}
+
+	free(patterns);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+static lib_aln_result_set_t** batch_threads(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm, uint8_t type_search,
+											uint8_t type_output)
+{
+	return lib_aln_bound_backtracking_batch(idx, patterns, n_patterns, max_mm, type_search, type_output, 4);
+}
+
+//lib_aln_bound_backtracking_batch with 4 threads
+static int check_batch(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	return check_batch_f(idx, pv, "lib_aln_bound_backtracking_batch", batch_threads);
+}
+
+static lib_aln_result_set_t** batch_trie(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm, uint8_t type_search,
+										uint8_t type_output)
+{
+	return lib_aln_bound_backtracking_batch_trie(idx, patterns, n_patterns, max_mm, type_search, type_output, 4);
+}
+
+//lib_aln_bound_backtracking_batch_trie with 4 threads, the patterns share many prefixes and suffixes
+static int check_batch_trie(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	return check_batch_f(idx, pv, "lib_aln_bound_backtracking_batch_trie", batch_trie);
+}
+
+static lib_aln_result_set_t** batch_interleaved(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm,
+												uint8_t type_search, uint8_t type_output)
+{
+	return lib_aln_bound_backtracking_batch_interleaved(idx, patterns, n_patterns, max_mm, type_search, type_output, 2, 16);
+}
+
+static lib_aln_result_set_t** batch_interleaved_max(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm,
+													uint8_t type_search, uint8_t type_output)
+{
+	return lib_aln_bound_backtracking_batch_interleaved(idx, patterns, n_patterns, max_mm, type_search, type_output, 2, 1000);
+}
+
+//lib_aln_bound_backtracking_batch_interleaved with 2 threads, 16 patterns together and more than MAX_INTERLEAVED
+static int check_batch_interleaved(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	return check_batch_f(idx, pv, "lib_aln_bound_backtracking_batch_interleaved, 16 patterns", batch_interleaved)
+			+ check_batch_f(idx, pv, "lib_aln_bound_backtracking_batch_interleaved, 1000 patterns", batch_interleaved_max);
+}
+
+//Contexts of batch_ctx, reused by all its batches
+static lib_aln_search_ctx_t *batch_ctx[3];
+
+static lib_aln_result_set_t** batch_contexts(const bwaidx_t *idx, const char **patterns, uint32_t n_patterns, uint8_t max_mm, uint8_t type_search,
+											uint8_t type_output)
+{
+	return lib_aln_bound_backtracking_batch_ctx(batch_ctx, 3, idx, patterns, n_patterns, max_mm, type_search, type_output);
+}
+
+static int same_sr(search_result **a, uint32_t n_a, search_result **b, uint32_t n_b)
+{
+	if (n_a != n_b)
+		return 0;
+	for (uint32_t i = 0; i < n_a; i++)
+		if (a[i]->num_occur != b[i]->num_occur || a[i]->n_mismatches != b[i]->n_mismatches || a[i]->is_rev_comp != b[i]->is_rev_comp
+			|| memcmp(a[i]->positions_to_ref, b[i]->positions_to_ref, a[i]->num_occur * sizeof(uint64_t)) != 0
+			|| memcmp(a[i]->different_positions, b[i]->different_positions, a[i]->n_mismatches * sizeof(uint32_t)) != 0
+			|| strcmp(a[i]->hit, b[i]->hit) != 0)
+			return 0;
+	return 1;
+}
+
+/*
+ * A context reused by all the searches (lib_aln_bound_backtracking_ctx) gives the hits of lib_aln_bound_backtracking,
+ * and lib_aln_bound_backtracking_batch_ctx with 3 reused contexts the result sets of lib_aln_bound_backtracking_rs
+ */
+static int check_contexts(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const uint8_t types[] = { ALL_HITS, ALL_BEST_HIT, UNIQUE_BEST_HIT };
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+		for (int max_mm = 0; max_mm <= 2 && max_mm <= (strlen(pv->a[i]) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+				for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+					for (int e = 0; e < 3; e++)
+					{
+						uint32_t n_a, n_b;
+						search_result **a = lib_aln_bound_backtracking_ctx(ctx, idx, pv->a[i], max_mm, &n_a, types[t] | type_search[e], type_output);
+						search_result **b = lib_aln_bound_backtracking(idx, pv->a[i], max_mm, &n_b, types[t] | type_search[e], type_output);
+						if (!same_sr(a, n_a, b, n_b))
+						{
+							fprintf(stderr, "lib_aln_bound_backtracking_ctx of %s with %d mismatch(es), %s, type_search %d, type_output %d: %u hits instead of %u\n",
+									pv->a[i], max_mm, engine_name[e], types[t], type_output, n_a, n_b);
+							n_failed++;
+						}
+						lib_aln_sr_destroy(b, n_b);
+					}
+	lib_aln_search_ctx_destroy(ctx);
+
+	for (int i = 0; i < 3; i++)
+		batch_ctx[i] = lib_aln_search_ctx_init();
+	n_failed += check_batch_f(idx, pv, "lib_aln_bound_backtracking_batch_ctx", batch_contexts);
+	for (int i = 0; i < 3; i++)
+		lib_aln_search_ctx_destroy(batch_ctx[i]);
+
+	return n_failed;
+}
+
+//The positions of the intervals of ALL_HITS, located by the iterator, are the ones of lib_aln_bound_backtracking_rs
+static int check_intervals(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const uint32_t n_iter[] = { 1, 7, 64 };
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	occ_v exp = { 0, 0, 0 }, got = { 0, 0, 0 };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+		for (int max_mm = 0; max_mm <= MAX_MISMATCHES && max_mm <= (strlen(pv->a[i]) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+				for (int e = 0; e < 3; e++)
+				{
+					result_set_occ(lib_aln_bound_backtracking_rs(ctx, idx, pv->a[i], max_mm, ALL_HITS | type_search[e], type_output), &exp);
+					for (int j = 0; j < 3; j++)
+					{
+						interval_occ(idx, lib_aln_bound_backtracking_sa(ctx, idx, pv->a[i], max_mm, ALL_HITS | type_search[e], type_output), &got, n_iter[j]);
+						if (!same_occ(&exp, &got))
+						{
+							fprintf(stderr, "lib_aln_bound_backtracking_sa of %s with %d mismatch(es), %s, type_output %d, %u positions at a time: %zu occurrences instead of %zu\n",
+									pv->a[i], max_mm, engine_name[e], type_output, n_iter[j], got.n, exp.n);
+							n_failed++;
+						}
+					}
+				}
+
+	free(exp.a);
+	free(got.a);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+//Data of collect_hit: the occurrences of the hits passed to the callback, which stops the search after stop_after hits (0 never)
+typedef struct
+{
+	occ_v v;
+	int n_calls, stop_after;
+} collect_t;
+
+static int collect_hit(const search_result *hit, void *data)
+{
+	collect_t *c = (collect_t*) data;
+	for (uint32_t j = 0; j < hit->num_occur; j++)
+		occ_push(&c->v, hit->positions_to_ref[j], hit->is_rev_comp, hit->n_mismatches);
+	return ++c->n_calls == c->stop_after;
+}
+
+/*
+ * The hits passed to the callback by ALL_HITS and ALL_BEST_HIT are the ones of lib_aln_bound_backtracking_rs,
+ * and the callback that returns 1 at the first hit stops the search
+ */
+static int check_callbacks(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const uint8_t types[] = { ALL_HITS, ALL_BEST_HIT };
+	lib_aln_search_ctx_t *ctx = lib_aln_search_ctx_init();
+	occ_v exp = { 0, 0, 0 };
+	collect_t c = { { 0, 0, 0 }, 0, 0 };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+		for (int max_mm = 0; max_mm <= MAX_MISMATCHES && max_mm <= (strlen(pv->a[i]) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+				for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+					for (int e = 0; e < 3; e++)
+					{
+						const lib_aln_result_set_t *rs = lib_aln_bound_backtracking_rs(ctx, idx, pv->a[i], max_mm, types[t] | type_search[e], type_output);
+						const uint32_t n_hits = rs->n_hits;
+						result_set_occ(rs, &exp);
+
+						c.v.n = c.n_calls = c.stop_after = 0;
+						int n = lib_aln_bound_backtracking_cb(ctx, idx, pv->a[i], max_mm, types[t] | type_search[e], type_output, collect_hit, &c);
+						if (n != n_hits || c.n_calls != n_hits || !same_occ(&exp, &c.v))
+						{
+							fprintf(stderr, "lib_aln_bound_backtracking_cb of %s with %d mismatch(es), %s, type_search %d, type_output %d: %d hits instead of %u\n",
+									pv->a[i], max_mm, engine_name[e], types[t], type_output, n, n_hits);
+							n_failed++;
+						}
+
+						c.v.n = c.n_calls = 0;
+						c.stop_after = 1;
+						n = lib_aln_bound_backtracking_cb(ctx, idx, pv->a[i], max_mm, types[t] | type_search[e], type_output, collect_hit, &c);
+						if (n != (n_hits > 0) || c.n_calls != n || !inside_occ(&exp, &c.v))
+						{
+							fprintf(stderr, "lib_aln_bound_backtracking_cb of %s with %d mismatch(es), %s, type_search %d, type_output %d: %d hits after the stop\n",
+									pv->a[i], max_mm, engine_name[e], types[t], type_output, n);
+							n_failed++;
+						}
+					}
+
+	free(exp.a);
+	free(c.v.a);
+	lib_aln_search_ctx_destroy(ctx);
+	return n_failed;
+}
+
+/*
+ * The searches with idx_b and ctx_b give the result sets of the searches with idx_a and ctx_a (the same index loaded
+ * in another way, or a context with other settings)
+ */
+static int compare_searches(const bwaidx_t *idx_a, lib_aln_search_ctx_t *ctx_a, const bwaidx_t *idx_b, lib_aln_search_ctx_t *ctx_b,
+							const pattern_v *pv, const char *name)
+{
+	static const uint8_t types[] = { ALL_HITS, COUNT_ONLY, ALL_BEST_HIT, UNIQUE_BEST_HIT };
+	int n_failed = 0;
+
+	for (int i = 0; i < pv->n; i++)
+		for (int max_mm = 0; max_mm <= 2 && max_mm <= (strlen(pv->a[i]) - 1) / 2; max_mm++)
+			for (int type_output = ALLOW_REV_COMP; type_output <= NO_REV_COMP; type_output++)
+				for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+					for (int e = 0; e < 3; e++)
+					{
+						const lib_aln_result_set_t *a = lib_aln_bound_backtracking_rs(ctx_a, idx_a, pv->a[i], max_mm, types[t] | type_search[e], type_output);
+						const lib_aln_result_set_t *b = lib_aln_bound_backtracking_rs(ctx_b, idx_b, pv->a[i], max_mm, types[t] | type_search[e], type_output);
+						if (!same_rs(a, b))
+						{
+							fprintf(stderr, "%s, %s with %d mismatch(es), %s, type_search %d, type_output %d: not the hits of the reference search\n",
+									name, pv->a[i], max_mm, engine_name[e], types[t], type_output);
+							n_failed++;
+						}
+					}
+	return n_failed;
+}
+
+/*
+ * With the k-mer table the searches are the same: with q = 4 the table is built in memory and the shortest patterns are
+ * read entirely from it, with q = 8 it's saved and loaded from the .kmi file. The file is removed, so the other loaders
+ * don't use it.
+ */
+static int check_kmi(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	lib_aln_search_ctx_t *ctx_a = lib_aln_search_ctx_init(), *ctx_b = lib_aln_search_ctx_init();
+	char *fn = (char*) malloc(strlen(prefix) + 5);
+	int n_failed = 0;
+
+	bwaidx_t *kmi_idx = lib_aln_idx_load(prefix);
+	if (lib_aln_kmi_build(kmi_idx, 0, 4, 2) != 0)
+	{
+		fprintf(stderr, "Impossible to build the k-mer table with q = 4.\n");
+		n_failed++;
+	}
+	n_failed += compare_searches(idx, ctx_a, kmi_idx, ctx_b, pv, "k-mer table, q = 4");
+	lib_aln_idx_destroy(kmi_idx);
+
+	strcat(strcpy(fn, prefix), ".kmi");
+	kmi_idx = lib_aln_idx_load(prefix);
+	if (lib_aln_kmi_build(kmi_idx, prefix, 8, 2) != 0)
+	{
+		fprintf(stderr, "Impossible to write %s.\n", fn);
+		n_failed++;
+	}
+	lib_aln_idx_destroy(kmi_idx);
+
+	kmi_idx = lib_aln_idx_load(prefix);
+	if (kmi_idx->bwt->kmi_q != 8)
+	{
+		fprintf(stderr, "The k-mer table hasn't been loaded from %s.\n", fn);
+		n_failed++;
+	}
+	n_failed += compare_searches(idx, ctx_a, kmi_idx, ctx_b, pv, ".kmi, q = 8");
+	lib_aln_idx_destroy(kmi_idx);
+	remove(fn);
+
+	free(fn);
+	lib_aln_search_ctx_destroy(ctx_a);
+	lib_aln_search_ctx_destroy(ctx_b);
+	return n_failed;
+}
+
+/*
+ * A context with a cache of the extensions gives the result sets of a context without it, with a small cache (whose
+ * entries are often replaced) and with a large one, which must be used by the searches
+ */
+static int check_cache(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const uint32_t n_entries[] = { 64, 1 << 16 };
+	lib_aln_search_ctx_t *ctx_a = lib_aln_search_ctx_init(), *ctx_b = lib_aln_search_ctx_init();
+	char name[32];
+	int n_failed = 0;
+
+	for (int j = 0; j < 2; j++)
+	{
+		uint64_t hits, misses;
+		lib_aln_search_ctx_set_cache(ctx_b, n_entries[j]);
+		snprintf(name, sizeof(name), "cache of %u entries", n_entries[j]);
+		n_failed += compare_searches(idx, ctx_a, idx, ctx_b, pv, name);
+
+		lib_aln_search_ctx_cache_stats(ctx_b, &hits, &misses);
+		if (hits == 0 || misses == 0)
+		{
+			fprintf(stderr, "The cache of %u entries has %" PRIu64 " hits and %" PRIu64 " misses.\n", n_entries[j], hits, misses);
+			n_failed++;
+		}
+	}
+
+	lib_aln_search_ctx_destroy(ctx_a);
+	lib_aln_search_ctx_destroy(ctx_b);
+	return n_failed;
+}
+
+//Occurrences of each base before each row (occ[(k + 1) * 4 + c] = bwt_occ(k, c), also for k = -1)
+static uint64_t* occ_table(const bwt_t *bwt)
+{
+	uint64_t *occ = (uint64_t*) malloc((bwt->seq_len + 2) * 4 * sizeof(uint64_t));
+	for (uint64_t k = (uint64_t) -1; k != bwt->seq_len + 1; k++)
+		for (int c = 0; c < 4; c++)
+			occ[(k + 1) * 4 + c] = bwt_occ(bwt, k, c);
+	return occ;
+}
+
+//Base of each position of the BWT without $ (bwt_line_b0), the one counted by the occurrences of its row
+static ubyte_t* b0_table(const bwt_t *bwt, const uint64_t *occ)
+{
+	ubyte_t *b0 = (ubyte_t*) malloc(bwt->seq_len);
+	for (uint64_t r = 0; r <= bwt->seq_len; r++)
+		for (int c = 0; c < 4 && r != bwt->primary; c++)
+			if (occ[(r + 1) * 4 + c] != occ[r * 4 + c])
+				b0[r - (r > bwt->primary)] = c;
+	return b0;
+}
+
+/*
+ * bwt_occ, bwt_2occ and bwt_2occ4 of bwt give the occurrences of occ_table for every row (and for the rows l after k
+ * inside the same block or line, or in another one), and the bases of bwt_line_b0 are the ones of b0 (if it isn't NULL)
+ */
+static int check_occ_functions(const bwt_t *bwt, const uint64_t *occ, const ubyte_t *b0, const char *name)
+{
+	static const uint64_t dist[] = { 0, 1, 7, 100, 250, 1000 };
+	int n_failed = 0;
+
+	for (uint64_t k = (uint64_t) -1; k != bwt->seq_len + 1; k++)
+	{
+		const uint64_t *ok = occ + (k + 1) * 4;
+		for (int c = 0; c < 4; c++)
+			if (bwt_occ(bwt, k, c) != ok[c])
+			{
+				fprintf(stderr, "%s: bwt_occ of the row %" PRId64 " and the base %d is %" PRIu64 " instead of %" PRIu64 "\n", name, k, c,
+						bwt_occ(bwt, k, c), ok[c]);
+				n_failed++;
+			}
+
+		for (int j = 0; j < sizeof(dist) / sizeof(dist[0]); j++)
+		{
+			uint64_t l = k + dist[j], cnt_k[4], cnt_l[4], n_k, n_l;
+			if (l != (uint64_t) -1 && l > bwt->seq_len)
+				break;
+			const uint64_t *ol = occ + (l + 1) * 4;
+			bwt_2occ4(bwt, k, l, cnt_k, cnt_l);
+			if (memcmp(cnt_k, ok, 4 * sizeof(uint64_t)) != 0 || memcmp(cnt_l, ol, 4 * sizeof(uint64_t)) != 0)
+			{
+				fprintf(stderr, "%s: wrong bwt_2occ4 of the rows %" PRId64 " and %" PRId64 "\n", name, k, l);
+				n_failed++;
+			}
+			for (int c = 0; c < 4; c++)
+			{
+				bwt_2occ(bwt, k, l, c, &n_k, &n_l);
+				if (n_k != ok[c] || n_l != ol[c])
+				{
+					fprintf(stderr, "%s: wrong bwt_2occ of the rows %" PRId64 " and %" PRId64 " and the base %d\n", name, k, l, c);
+					n_failed++;
+				}
+			}
+		}
+	}
+
+	for (uint64_t k = 0; b0 && k < bwt->seq_len; k++)
+		if (bwt_line_b0(bwt, k) != b0[k])
+		{
+			fprintf(stderr, "%s: bwt_line_b0 of the row %" PRIu64 " is %d instead of %d\n", name, k, bwt_line_b0(bwt, k), b0[k]);
+			n_failed++;
+		}
+
+	return n_failed;
+}
+
+/*
+ * Each kernel supported by the CPU gives the occurrences of the original code of bwt.c (the scalar kernel on the layout
+ * of the .bwt file, mapped by lib_aln_idx_load_mmap), with the layout of the .bwt file and with the cache-line layout of idx
+ * (whose bwt_line_b0 gives the bases counted by the occurrences)
+ */
+static int check_kernels(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const char *kernels[] = { "scalar", "popcnt", "avx2", "avx512" };
+	const char *selected = occ_kernel_name();
+	bwaidx_t *map_idx = lib_aln_idx_load_mmap(prefix, 0);
+	char name[64];
+	int n_failed = 0;
+
+	occ_set_kernel("scalar");
+	uint64_t *occ = occ_table(map_idx->bwt);
+	ubyte_t *b0 = b0_table(map_idx->bwt, occ);
+
+	for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+	{
+		if (occ_set_kernel(kernels[i]) != 0)
+			continue;
+		bwt_occ_resolve(idx->bwt);
+		snprintf(name, sizeof(name), "%s kernel, layout of the .bwt file", kernels[i]);
+		n_failed += check_occ_functions(map_idx->bwt, occ, 0, name);
+		snprintf(name, sizeof(name), "%s kernel, cache-line layout", kernels[i]);
+		n_failed += check_occ_functions(idx->bwt, occ, b0, name);
+	}
+	occ_set_kernel(selected);
+	bwt_occ_resolve(idx->bwt);
+
+	free(occ);
+	free(b0);
+	lib_aln_idx_destroy(map_idx);
+	return n_failed;
+}
+
+/*
+ * The cache-line layout with lines of each size, loaded by lib_aln_idx_load_occ and from a packed file, gives the
+ * occurrences and the bases of the layout of the .bwt file
+ */
+static int check_occ_lines(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	static const int occ_intv[] = { 64, 192, 448, 960 };
+	bwaidx_t *map_idx = lib_aln_idx_load_mmap(prefix, 0);
+	uint64_t *occ = occ_table(map_idx->bwt);
+	ubyte_t *b0 = b0_table(map_idx->bwt, occ);
+	char name[64], *fn = (char*) malloc(strlen(prefix) + 9);
+	int n_failed = 0;
+
+	strcat(strcpy(fn, prefix), ".occ.img");
+	for (int i = 0; i < sizeof(occ_intv) / sizeof(occ_intv[0]); i++)
+	{
+		bwaidx_t *line_idx = lib_aln_idx_load_occ(prefix, occ_intv[i]);
+		snprintf(name, sizeof(name), "lib_aln_idx_load_occ, %d bases", occ_intv[i]);
+		if (line_idx == 0 || line_idx->bwt->occ_line == 0)
+		{
+			fprintf(stderr, "%s: the index hasn't the cache-line layout\n", name);
+			n_failed++;
+		}
+		else
+			n_failed += check_occ_functions(line_idx->bwt, occ, b0, name);
+		lib_aln_idx_destroy(line_idx);
+
+		snprintf(name, sizeof(name), "lib_aln_idx_load_packed, %d bases", occ_intv[i]);
+		line_idx = lib_aln_idx_pack(prefix, fn, occ_intv[i]) == 0 ? lib_aln_idx_load_packed(fn, 0) : 0;
+		if (line_idx == 0 || line_idx->bwt->occ_line == 0)
+		{
+			fprintf(stderr, "%s: the index hasn't the cache-line layout\n", name);
+			n_failed++;
+		}
+		else
+			n_failed += check_occ_functions(line_idx->bwt, occ, b0, name);
+		lib_aln_idx_destroy(line_idx);
+	}
+	remove(fn);
+
+	free(fn);
+	free(occ);
+	free(b0);
+	lib_aln_idx_destroy(map_idx);
+	return n_failed;
+}
+
+/*
+ * The index attached from the shared memory gives the result sets of idx. An image whose magic isn't stored yet, as seen
+ * by a process attaching the segment while lib_aln_idx_shm_stage writes it, is rejected.
+ */
+static int check_shm(const bwaidx_t *idx, const char *prefix, const pattern_v *pv)
+{
+	lib_aln_search_ctx_t *ctx_a = lib_aln_search_ctx_init(), *ctx_b = lib_aln_search_ctx_init();
+	int n_failed = 0;
+
+	bwaidx_t *shm_idx = lib_aln_idx_shm_stage(prefix) == 0 ? lib_aln_idx_shm_attach(prefix) : 0;
+	if (shm_idx == 0)
+	{
+		fprintf(stderr, "Impossible to attach %s from the shared memory.\n", prefix);
+		n_failed++;
+	}
+	else
+	{
+		n_failed += compare_searches(idx, ctx_a, shm_idx, ctx_b, pv, "shared memory");
+		lib_aln_idx_destroy(shm_idx);
+	}
+	lib_aln_idx_shm_drop(prefix);
+
+	idx_image_header_t h;
+	char magic[sizeof(h.magic)];
+	idx_image_layout(idx, &h);
+	char *base = (char*) mmap(0, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	idx_image_write(idx, &h, base);
+	memcpy(magic, base, sizeof(magic));
+	memset(base, 0, sizeof(magic));
+	if (idx_image_open(base, h.size, "the image without magic") != 0)
+	{
+		fprintf(stderr, "The image without magic has been opened.\n");
+		n_failed++;
+	}
+	memcpy(base, magic, sizeof(magic));
+	bwaidx_t *image_idx = idx_image_open(base, h.size, "the image");
+	if (image_idx == 0)
+	{
+		fprintf(stderr, "The image of the index can't be opened.\n");
+		n_failed++;
+		munmap(base, h.size);
+	}
+	else
+		lib_aln_idx_destroy(image_idx);
+
+	lib_aln_search_ctx_destroy(ctx_a);
+	lib_aln_search_ctx_destroy(ctx_b);
+	return n_failed;
+}
+
+//Checks run once for each kind of samples of the suffix array, with lib_aln_idx_load (the engines are checked with each loader)
+static const struct
+{
+	const char *name;
+	check_f f;
+} checks[] = {
+	{ "engines", check_engines },
+	{ "best modes", check_best_modes },
+	{ "limits", check_limits },
+	{ "batch", check_batch },
+	{ "contexts", check_contexts },
+	{ "intervals", check_intervals },
+	{ "callbacks", check_callbacks },
+	{ "trie batch", check_batch_trie },
+	{ "k-mer table", check_kmi },
+	{ "cache", check_cache },
+	{ "interleaved batch", check_batch_interleaved },
+	{ "kernels", check_kernels },
+	{ "occurrence lines", check_occ_lines },
+	{ "shared memory", check_shm },
+};
+
+static void add_pattern(pattern_v *pv, const bwaidx_t *idx, int64_t beg, int len)
+{
+	const int64_t l_pac = idx->bns->l_pac;
+	char *p = (char*) malloc(len + 1);
+	for (int j = 0; j < len; j++)
+	{
+		int64_t x = beg + j; // on the r.c. strand after l_pac
+		p[j] = "ACGT"[x < l_pac ? get_pac(idx->pac, x) : 3 - get_pac(idx->pac, (l_pac << 1) - 1 - x)];
+	}
+	p[len] = 0;
+	pv->a[pv->n++] = p;
+}
+
+//Substrings of the reference, their copies with mismatches and the strings across the end of the forward strand
+static void gen_patterns(const bwaidx_t *idx, int n_patterns, pattern_v *pv)
+{
+	const int64_t l_pac = idx->bns->l_pac;
+	pv->n = 0;
+	pv->a = (char**) malloc((n_patterns + MAX_LEN) * sizeof(char*));
+	rand_state = 11; // the patterns are the same for each index
+
+	for (int len = MIN_LEN + 2; len <= MAX_LEN && len <= l_pac; len += 4)
+		add_pattern(pv, idx, l_pac - len / 2, len);
+
+	while (pv->n < n_patterns)
+	{
+		int len = MIN_LEN + next_rand() % (MAX_LEN - MIN_LEN + 1);
+		if (l_pac < len)
+			continue;
+		add_pattern(pv, idx, next_rand() % (l_pac - len + 1), len);
+
+		//A copy with a mismatch every 6 bases
+		char *p = strdup(pv->a[pv->n - 1]);
+		for (int j = next_rand() % 6; j < len; j += 6)
+			p[j] = "ACGT"[(base_code(p[j]) + 1 + next_rand() % 3) & 3];
+		pv->a[pv->n++] = p;
+	}
+}
+
+//Reference of n_seqs sequences with exact and approximate copies of previous segments, tandem repeats and homopolymers
+static void gen_reference(const char *fn, int n_seqs, int seq_len)
+{
+	char *s = (char*) malloc(seq_len + 1);
+	FILE *fp = fopen(fn, "w");
+
+	rand_state = 7;
+	for (int i = 0; i < n_seqs; i++)
+	{
+		int n = 0;
+		while (n < seq_len)
+		{
+			int type = next_rand() % 8, len = 0;
+			if (type == 0 && n > 200) // copy, with some mismatches
+			{
+				int beg = next_rand() % (n - 100);
+				len = 20 + next_rand() % 80;
+				for (int j = 0; j < len && n + j < seq_len; j++)
+					s[n + j] = next_rand() % 30 ? s[beg + j] : "ACGT"[next_rand() & 3];
+			}
+			else if (type == 1) // tandem repeat
+			{
+				int period = 1 + next_rand() % 6;
+				len = period * (3 + next_rand() % 8);
+				for (int j = 0; j < len && n + j < seq_len; j++)
+					s[n + j] = j < period ? "ACGT"[next_rand() & 3] : s[n + j - period];
+			}
+			else
+			{
+				len = 10 + next_rand() % 50;
+				for (int j = 0; j < len && n + j < seq_len; j++)
+					s[n + j] = "ACGT"[next_rand() & 3];
+			}
+			n += len;
+		}
+		s[seq_len] = 0;
+		fprintf(fp, ">seq%d\n", i + 1);
+		for (int j = 0; j < seq_len; j += 60)
+			fprintf(fp, "%.60s\n", s + j);
+	}
+
+	fclose(fp);
+	free(s);
+}
+
+//Load the index of prefix with each loader, check the engines and run the other checks once. Return the number of failed searches.
+static int check_loaders(const char *prefix, const char *sampling, int n_patterns)
+{
+	static const char *loader_name[] = { "lib_aln_idx_load", "lib_aln_idx_load_mmap", "lib_aln_idx_load_lazy", "lib_aln_idx_load_packed" };
+	char *fn = (char*) malloc(strlen(prefix) + 5);
+	int n_failed = 0;
+	pattern_v pv = { 0, 0 };
+
+	strcat(strcpy(fn, prefix), ".img");
+	if (lib_aln_idx_pack(prefix, fn, 192) != 0)
+		fprintf(stderr, "Impossible to write %s.\n", fn);
+
+	for (int i = 0; i < 4; i++)
+	{
+		bwaidx_t *idx = i == 0 ? lib_aln_idx_load(prefix) : i == 1 ? lib_aln_idx_load_mmap(prefix, 0) :
+						i == 2 ? lib_aln_idx_load_lazy(prefix, 192, IDX_LAZY_SA | IDX_LAZY_PAC) : lib_aln_idx_load_packed(fn, 0);
+		if (idx == 0)
+		{
+			printf("%s, %-24s index load failed\n", sampling, loader_name[i]);
+			n_failed++;
+			continue;
+		}
+		if (pv.n == 0)
+			gen_patterns(idx, n_patterns, &pv);
+
+		for (int c = 0; c < sizeof(checks) / sizeof(checks[0]); c++)
+		{
+			if (i > 0 && checks[c].f != check_engines)
+				continue;
+			int n = checks[c].f(idx, prefix, &pv);
+			printf("%s, %-24s %-20s %s\n", sampling, loader_name[i], checks[c].name, n ? "FAILED" : "ok");
+			n_failed += n;
+		}
+		lib_aln_idx_destroy(idx);
+	}
+
+	for (int i = 0; i < pv.n; i++)
+		free(pv.a[i]);
+	free(pv.a);
+	free(fn);
+	return n_failed;
+}
+
+//Remove the temporary directory and the index files inside it
+static void remove_dir(const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	char fn[1024];
+	while (d && (e = readdir(d)) != 0)
+		if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+		{
+			snprintf(fn, sizeof(fn), "%s/%s", dir, e->d_name);
+			remove(fn);
+		}
+	if (d)
+		closedir(d);
+	rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/engine_check_XXXXXX", path[1024], prefix[1024];
+	int n_patterns = argc > 2 ? atoi(argv[2]) : 200;
+	int n_failed = 0;
+
+	if (mkdtemp(dir) == 0)
+	{
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	//Path where is locate database sequences in the FASTA format
+	if (argc > 1)
+		snprintf(path, sizeof(path), "%s", argv[1]);
+	else
+	{
+		snprintf(path, sizeof(path), "%s/ref.fa", dir);
+		gen_reference(path, 3, 1000);
+	}
+
+	//Samples of lib_aln_index
+	snprintf(prefix, sizeof(prefix), "%s/row", dir);
+	lib_aln_index(path, prefix, BWTALGO_AUTO);
+	n_failed += check_loaders(prefix, "SA_SAMPLE_ROW", n_patterns);
+
+	//Text-order samples, with a short interval so that the hits are located also by the samples of the text
+	snprintf(prefix, sizeof(prefix), "%s/text", dir);
+	lib_aln_index_sa(path, prefix, BWTALGO_AUTO, 4, SA_SAMPLE_TEXT);
+	n_failed += check_loaders(prefix, "SA_SAMPLE_TEXT", n_patterns);
+
+	remove_dir(dir);
+
+	if (n_failed)
+	{
+		printf("%d searches failed the checks.\n", n_failed);
+		return EXIT_FAILURE;
+	}
+	printf("All the checks passed.\n");
+	return 0;
+}